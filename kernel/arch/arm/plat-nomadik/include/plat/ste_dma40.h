@@ -180,6 +180,20 @@ int stedma40_set_dev_addr(struct dma_chan *chan,
 			  dma_addr_t src_dev_addr,
 			  dma_addr_t dst_dev_addr);
 
+/**
+ * stedma40_set_coalesce() - batch the completions of a logical channel
+ * @chan: the DMA channel, allocated and logical
+ * @max_pending: number of done jobs collected before the callbacks run,
+ *		 zero to run them as each job completes
+ * @timeout_us: longest time a done job waits for the others
+ *
+ * For clients that do not need their callback as soon as a job is done.
+ * Returns 0 or -EINVAL.
+ */
+int stedma40_set_coalesce(struct dma_chan *chan,
+			  unsigned int max_pending,
+			  unsigned int timeout_us);
+
 /*
  * stedma40_get_src_addr - get current source address
  * @chan: the DMA channel
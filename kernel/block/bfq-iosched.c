@@ -30,6 +30,13 @@
  * the paper, this implementation adds several little heuristics, and
  * a hierarchical extension, based on H-WF2Q+.
  *
+ * On non-rotational devices (see bfq_nonrot()) the seek heuristics make
+ * no sense and idling only costs throughput.  There BFQ idles only for
+ * queues whose weight is being raised for low latency, charges queues
+ * for the time they held the device rather than just for the sectors
+ * they moved, and lets processes interleaving sequential I/O share a
+ * single queue.
+ *
  * B-WF2Q+ is based on WF2Q+, that is described in [2], together with
  * H-WF2Q+, while the augmented tree used to implement B-WF2Q+ with O(log N)
  * complexity derives from the one introduced with EEVDF in [3].
@@ -110,6 +117,16 @@ static DEFINE_IDA(cic_index_ida);
 
 #define BFQQ_SEEKY(bfqq) ((bfqq)->seek_mean > (8 * 1024))
 
+/* Value of bfq_nonrot to follow the queue's rotational flag. */
+#define BFQ_NONROT_AUTO		2
+
+/*
+ * Non-rotational mode: max distance, in sectors, between the end of
+ * the last dispatch and the next request of a queue cooperating with
+ * the active one.
+ */
+#define BFQQ_CLOSE_THR		256
+
 /* Min samples used for peak rate estimation (for autotuning). */
 #define BFQ_PEAK_RATE_SAMPLES	32
 
@@ -144,6 +161,18 @@ static inline int bfq_bio_sync(struct bio *bio)
 	return 0;
 }
 
+/*
+ * The device is not rotational.  Checked on use, since drivers usually
+ * set the queue flag after the elevator has been initialized.
+ */
+static inline int bfq_nonrot(struct bfq_data *bfqd)
+{
+	if (bfqd->bfq_nonrot == BFQ_NONROT_AUTO)
+		return blk_queue_nonrot(bfqd->queue);
+
+	return bfqd->bfq_nonrot;
+}
+
 /*
  * Scheduler run of queue, if there are requests pending and no one in the
  * driver that will restart queueing.
@@ -197,6 +226,17 @@ static struct request *bfq_choose_req(struct bfq_data *bfqd,
 
 	last = bfqd->last_position;
 
+	/*
+	 * Without a head to move, just stay close to the last
+	 * position, to keep sequential streams together.
+	 */
+	if (bfq_nonrot(bfqd)) {
+		d1 = s1 >= last ? s1 - last : last - s1;
+		d2 = s2 >= last ? s2 - last : last - s2;
+
+		return d1 <= d2 ? rq1 : rq2;
+	}
+
 	/*
 	 * By definition, 1KiB is 2 sectors.
 	 */
@@ -603,7 +643,8 @@ static void bfq_arm_slice_timer(struct bfq_data *bfqd)
 	 * BFQ_MIN_TT. This happened to help reduce latency.
 	 */
 	sl = bfqd->bfq_slice_idle;
-	if (bfq_sample_valid(bfqq->seek_samples) && BFQQ_SEEKY(bfqq) &&
+	if (!bfq_nonrot(bfqd) &&
+	    bfq_sample_valid(bfqq->seek_samples) && BFQQ_SEEKY(bfqq) &&
 	    bfqq->entity.service > bfq_max_budget(bfqd) / 8)
 		sl = min(sl, msecs_to_jiffies(BFQ_MIN_TT));
 
@@ -938,6 +979,47 @@ static int bfq_update_peak_rate(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 	return expected > (4 * bfqq->entity.budget) / 3;
 }
 
+/**
+ * bfq_bfqq_charge_time - charge a queue for the time it held the device.
+ * @bfqd: device owning the queue.
+ * @bfqq: the queue to charge.
+ * @compensate: if true, do not count the time spent idling.
+ *
+ * On flash the cost of a request depends little on its position and a
+ * lot on its type and size: a small random write may take longer than
+ * a large sequential read.  In non-rotational mode the service time
+ * of the slice, converted to sectors at the estimated peak rate, is
+ * charged whenever it exceeds the sectors actually served, so that
+ * queues that keep the device busy pay for it.  The charge is capped to
+ * the budget to keep the timestamps consistent.
+ */
+static void bfq_bfqq_charge_time(struct bfq_data *bfqd,
+				 struct bfq_queue *bfqq, int compensate)
+{
+	struct bfq_entity *entity = &bfqq->entity;
+	bfq_service_t charge;
+	ktime_t end;
+	u64 usecs;
+
+	if (bfq_bfqq_budget_new(bfqq) ||
+	    bfqd->peak_rate_samples < BFQ_PEAK_RATE_SAMPLES)
+		return;
+
+	end = compensate ? bfqd->last_idling_start : ktime_get();
+	usecs = ktime_to_us(ktime_sub(end, bfqd->last_budget_start));
+	if (usecs >= LONG_MAX)
+		return;
+
+	charge = (bfq_service_t)(usecs * bfqd->peak_rate >> BFQ_RATE_SHIFT);
+	charge = min(charge, entity->budget);
+
+	if (charge > entity->service) {
+		bfq_log_bfqq(bfqd, bfqq, "charge_time: %llu us, %lu sects",
+			     usecs, charge);
+		bfq_bfqq_served(bfqq, charge - entity->service);
+	}
+}
+
 /**
  * bfq_bfqq_expire - expire a queue.
  * @bfqd: device owning the queue.
@@ -991,9 +1073,18 @@ static void bfq_bfqq_expire(struct bfq_data *bfqd,
 	 * processes may timeout just for bad luck. To avoid punishing
 	 * them we do not charge a full budget to a process that
 	 * succeeded in consuming at least 2/3 of its budget.
+	 *
+	 * On non-rotational devices seeky is not slow, and the time
+	 * charge accounts for the queues that do hold the device.
 	 */
-	if (slow || (reason == BFQ_BFQQ_BUDGET_TIMEOUT &&
-		     bfq_bfqq_budget_left(bfqq) >=  bfqq->entity.budget / 3))
+	if (bfq_nonrot(bfqd)) {
+		slow = 0;
+		bfq_bfqq_charge_time(bfqd, bfqq, compensate);
+		/* Cooperation ended, see bfq_setup_cooperator(). */
+		if (bfq_bfqq_coop(bfqq) && BFQQ_SEEKY(bfqq))
+			bfq_mark_bfqq_split_coop(bfqq);
+	} else if (slow || (reason == BFQ_BFQQ_BUDGET_TIMEOUT &&
+		   bfq_bfqq_budget_left(bfqq) >=  bfqq->entity.budget / 3))
 		bfq_bfqq_charge_full_budget(bfqq);
 
 	bfq_log_bfqq(bfqd, bfqq,
@@ -1303,6 +1394,84 @@ static void bfq_put_queue(struct bfq_queue *bfqq)
 	kmem_cache_free(bfq_pool, bfqq);
 }
 
+/*
+ * References held by processes, i.e., neither by in-flight requests nor
+ * by the service tree, which bfq_get_entity() takes while on_st is set.
+ */
+static inline int bfqq_process_refs(struct bfq_queue *bfqq)
+{
+	int process_refs, io_refs;
+
+	io_refs = bfqq->allocated[READ] + bfqq->allocated[WRITE];
+	process_refs = atomic_read(&bfqq->ref) - io_refs - bfqq->entity.on_st;
+	BUG_ON(process_refs < 0);
+	return process_refs;
+}
+
+/*
+ * Schedule the processes using the queue with less process references
+ * to be moved to the other one.  The move is done by bfq_merge_bfqqs()
+ * on their next request, the references they will need on the new queue
+ * are taken here.
+ */
+static void bfq_setup_merge(struct bfq_queue *bfqq, struct bfq_queue *new_bfqq)
+{
+	int process_refs, new_process_refs;
+	struct bfq_queue *__bfqq;
+
+	/*
+	 * If there are no process references on new_bfqq, then it is
+	 * unsafe to follow the ->new_bfqq chain as other bfqq's in the
+	 * chain may have dropped their last reference (not just their
+	 * last process reference).
+	 */
+	if (!bfqq_process_refs(new_bfqq))
+		return;
+
+	/* Avoid a circular list and skip interim queue merges. */
+	while ((__bfqq = new_bfqq->new_bfqq)) {
+		if (__bfqq == bfqq)
+			return;
+		new_bfqq = __bfqq;
+	}
+
+	process_refs = bfqq_process_refs(bfqq);
+	new_process_refs = bfqq_process_refs(new_bfqq);
+	if (process_refs == 0 || new_process_refs == 0)
+		return;
+
+	bfq_log_bfqq(bfqq->bfqd, bfqq, "scheduling merge with queue %d",
+		     new_bfqq->pid);
+
+	if (new_process_refs >= process_refs) {
+		bfqq->new_bfqq = new_bfqq;
+		atomic_add(process_refs, &new_bfqq->ref);
+	} else {
+		new_bfqq->new_bfqq = bfqq;
+		atomic_add(new_process_refs, &bfqq->ref);
+	}
+}
+
+/*
+ * Drop the references taken by bfq_setup_merge() on the queues that
+ * bfqq, which is going away, was to be merged with.
+ */
+static void bfq_put_cooperator(struct bfq_queue *bfqq)
+{
+	struct bfq_queue *__bfqq, *next;
+
+	__bfqq = bfqq->new_bfqq;
+	while (__bfqq) {
+		if (__bfqq == bfqq) {
+			WARN(1, "bfqq->new_bfqq loop detected.\n");
+			break;
+		}
+		next = __bfqq->new_bfqq;
+		bfq_put_queue(__bfqq);
+		__bfqq = next;
+	}
+}
+
 static void bfq_exit_bfqq(struct bfq_data *bfqd, struct bfq_queue *bfqq)
 {
 	if (bfqq == bfqd->active_queue) {
@@ -1310,6 +1479,8 @@ static void bfq_exit_bfqq(struct bfq_data *bfqd, struct bfq_queue *bfqq)
 		bfq_schedule_dispatch(bfqd);
 	}
 
+	bfq_put_cooperator(bfqq);
+
 	bfq_log_bfqq(bfqd, bfqq, "exit_bfqq: %p, %d", bfqq, bfqq->ref);
 	bfq_put_queue(bfqq);
 }
@@ -1582,8 +1753,14 @@ static void bfq_update_idle_window(struct bfq_data *bfqd,
 
 	enable_idle = bfq_bfqq_idle_window(bfqq);
 
+	/*
+	 * On flash, idling is worth its cost only to keep the latency
+	 * of interactive queues (those being weight-raised) low.
+	 */
 	if (atomic_read(&cic->ioc->nr_tasks) == 0 ||
-	    bfqd->bfq_slice_idle == 0 || (bfqd->hw_tag && BFQQ_SEEKY(bfqq)))
+	    bfqd->bfq_slice_idle == 0 ||
+	    (bfq_nonrot(bfqd) ? bfqq->high_weight_budget == 0 :
+	     bfqd->hw_tag && BFQQ_SEEKY(bfqq)))
 		enable_idle = 0;
 	else if (bfq_sample_valid(cic->ttime_samples)) {
 		if (cic->ttime_mean > bfqd->bfq_slice_idle)
@@ -1600,6 +1777,40 @@ static void bfq_update_idle_window(struct bfq_data *bfqd,
 		bfq_clear_bfqq_idle_window(bfqq);
 }
 
+/*
+ * Non-rotational mode: rq, just queued in bfqq, lies close to the end of
+ * the last request dispatched from the active queue.  The two queues are
+ * likely to belong to processes interleaving a single sequential stream,
+ * each of them would idle or be charged on its own: schedule them to be
+ * merged.
+ */
+static void bfq_setup_cooperator(struct bfq_data *bfqd,
+				 struct bfq_queue *bfqq, struct request *rq)
+{
+	struct bfq_queue *active_bfqq = bfqd->active_queue;
+	sector_t pos = blk_rq_pos(rq), last = bfqd->last_position;
+
+	if (!bfq_nonrot(bfqd) || active_bfqq == NULL || active_bfqq == bfqq)
+		return;
+
+	if (!bfq_bfqq_sync(bfqq) || !bfq_bfqq_sync(active_bfqq) ||
+	    bfqq->new_bfqq != NULL || active_bfqq->new_bfqq != NULL)
+		return;
+
+	if (bfqq->entity.sched_data != active_bfqq->entity.sched_data ||
+	    bfqq->entity.ioprio_class != active_bfqq->entity.ioprio_class)
+		return;
+
+	if (!bfq_sample_valid(active_bfqq->seek_samples) ||
+	    BFQQ_SEEKY(active_bfqq))
+		return;
+
+	if ((pos >= last ? pos - last : last - pos) > BFQQ_CLOSE_THR)
+		return;
+
+	bfq_setup_merge(bfqq, active_bfqq);
+}
+
 /*
  * Called when a new fs request (rq) is added to bfqq.  Check if there's
  * something we should do about it.
@@ -1614,7 +1825,8 @@ static void bfq_rq_enqueued(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 
 	bfq_update_io_thinktime(bfqd, cic);
 	bfq_update_io_seektime(bfqd, bfqq, rq);
-	if (bfqq->entity.service > bfq_max_budget(bfqd) / 8 ||
+	if (bfq_nonrot(bfqd) ||
+	    bfqq->entity.service > bfq_max_budget(bfqd) / 8 ||
 	    ! BFQQ_SEEKY(bfqq))
 		bfq_update_idle_window(bfqd, bfqq, cic);
 
@@ -1625,6 +1837,8 @@ static void bfq_rq_enqueued(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 
 	bfqq->last_request_pos = blk_rq_pos(rq) + blk_rq_sectors(rq);
 
+	bfq_setup_cooperator(bfqd, bfqq, rq);
+
 	if (bfqq == bfqd->active_queue) {
 		if (bfq_bfqq_wait_request(bfqq)) {
 			/*
@@ -1813,6 +2027,45 @@ static void bfq_put_request(struct request *rq)
 	}
 }
 
+/*
+ * Move the process owning cic to the queue bfqq has been scheduled to be
+ * merged with.  The process reference on bfqq is dropped, the one on the
+ * new queue has been taken by bfq_setup_merge().
+ */
+static struct bfq_queue *
+bfq_merge_bfqqs(struct bfq_data *bfqd, struct cfq_io_context *cic,
+		struct bfq_queue *bfqq)
+{
+	bfq_log_bfqq(bfqd, bfqq, "merging with queue %d",
+		     bfqq->new_bfqq->pid);
+	cic_set_bfqq(cic, bfqq->new_bfqq, 1);
+	bfq_mark_bfqq_coop(bfqq->new_bfqq);
+	bfq_put_queue(bfqq);
+	return cic_to_bfqq(cic, 1);
+}
+
+/*
+ * A shared queue turned out to be seeky: give the process a private queue
+ * again, or just reset the state if it is the last one using the queue.
+ */
+static struct bfq_queue *
+bfq_split_bfqq(struct cfq_io_context *cic, struct bfq_queue *bfqq)
+{
+	bfq_log_bfqq(bfqq->bfqd, bfqq, "splitting queue");
+
+	if (bfqq_process_refs(bfqq) == 1) {
+		bfqq->pid = current->pid;
+		bfq_clear_bfqq_coop(bfqq);
+		bfq_clear_bfqq_split_coop(bfqq);
+		return bfqq;
+	}
+
+	cic_set_bfqq(cic, NULL, 1);
+	bfq_put_cooperator(bfqq);
+	bfq_put_queue(bfqq);
+	return NULL;
+}
+
 /*
  * Allocate bfq data structures associated with this request.
  */
@@ -1838,6 +2091,7 @@ static int bfq_set_request(struct request_queue *q, struct request *rq,
 
 	bfqg = bfq_cic_update_cgroup(cic);
 
+new_queue:
 	bfqq = cic_to_bfqq(cic, is_sync);
 	if (bfqq == NULL) {
 		bfqq = bfq_get_queue(bfqd, bfqg, is_sync, cic->ioc, gfp_mask);
@@ -1845,6 +2099,27 @@ static int bfq_set_request(struct request_queue *q, struct request *rq,
 			goto queue_fail;
 
 		cic_set_bfqq(cic, bfqq, is_sync);
+	} else if (is_sync) {
+		/*
+		 * The queue was found to be seeky while shared: go back
+		 * to a queue of our own.
+		 */
+		if (bfq_bfqq_coop(bfqq) && bfq_bfqq_split_coop(bfqq)) {
+			bfqq = bfq_split_bfqq(cic, bfqq);
+			if (bfqq == NULL)
+				goto new_queue;
+		}
+
+		/*
+		 * Check to see if this queue is scheduled to merge with
+		 * another, closely cooperating queue.  The merging of
+		 * queues happens here as it must be done in process
+		 * context, and the queues must still be in the same group.
+		 */
+		if (bfqq->new_bfqq != NULL &&
+		    bfqq->new_bfqq->entity.sched_data ==
+		    bfqq->entity.sched_data)
+			bfqq = bfq_merge_bfqqs(bfqd, cic, bfqq);
 	}
 
 	bfqq->allocated[rw]++;
@@ -2064,6 +2339,7 @@ static void *bfq_init_queue(struct request_queue *q)
 	bfqd->bfq_back_max = bfq_back_max;
 	bfqd->bfq_back_penalty = bfq_back_penalty;
 	bfqd->bfq_slice_idle = bfq_slice_idle;
+	bfqd->bfq_nonrot = BFQ_NONROT_AUTO;
 	bfqd->bfq_max_budget_async_rq = bfq_max_budget_async_rq;
 	bfqd->bfq_timeout[BLK_RW_ASYNC] = bfq_timeout_async;
 	bfqd->bfq_timeout[BLK_RW_SYNC] = bfq_timeout_sync;
@@ -2133,6 +2409,7 @@ SHOW_FUNCTION(bfq_max_budget_async_rq_show, bfqd->bfq_max_budget_async_rq, 0);
 SHOW_FUNCTION(bfq_timeout_sync_show, bfqd->bfq_timeout[BLK_RW_SYNC], 1);
 SHOW_FUNCTION(bfq_timeout_async_show, bfqd->bfq_timeout[BLK_RW_ASYNC], 1);
 SHOW_FUNCTION(bfq_low_latency_show, bfqd->low_latency, 0);
+SHOW_FUNCTION(bfq_nonrot_show, bfqd->bfq_nonrot, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -2161,6 +2438,7 @@ STORE_FUNCTION(bfq_back_seek_max_store, &bfqd->bfq_back_max, 0, INT_MAX, 0);
 STORE_FUNCTION(bfq_back_seek_penalty_store, &bfqd->bfq_back_penalty, 1,
 		INT_MAX, 0);
 STORE_FUNCTION(bfq_slice_idle_store, &bfqd->bfq_slice_idle, 0, INT_MAX, 1);
+STORE_FUNCTION(bfq_nonrot_store, &bfqd->bfq_nonrot, 0, BFQ_NONROT_AUTO, 0);
 STORE_FUNCTION(bfq_max_budget_async_rq_store, &bfqd->bfq_max_budget_async_rq,
 		1, INT_MAX, 0);
 STORE_FUNCTION(bfq_timeout_async_store, &bfqd->bfq_timeout[BLK_RW_ASYNC], 0,
@@ -2245,6 +2523,7 @@ static struct elv_fs_entry bfq_attrs[] = {
 	BFQ_ATTR(timeout_sync),
 	BFQ_ATTR(timeout_async),
 	BFQ_ATTR(low_latency),
+	BFQ_ATTR(nonrot),
 	__ATTR_NULL
 };
 
@@ -206,6 +206,8 @@ struct bfq_group;
  * @bfq_back_penalty: weight of backward seeks wrt forward ones.
  * @bfq_back_max: maximum allowed backward seek.
  * @bfq_slice_idle: maximum idling time.
+ * @bfq_nonrot: non-rotational mode: 0 off, 1 on, 2 (default) follow the
+ *              rotational flag of the queue.
  * @bfq_user_max_budget: user-configured max budget value (0 for auto-tuning).
  * @bfq_max_budget_async_rq: maximum budget (in nr of requests) allotted to
  *                           async queues.
@@ -260,6 +262,7 @@ struct bfq_data {
 	unsigned int bfq_back_penalty;
 	unsigned int bfq_back_max;
 	unsigned int bfq_slice_idle;
+	unsigned int bfq_nonrot;
 
 	unsigned int bfq_user_max_budget;
 	unsigned int bfq_max_budget_async_rq;
@@ -293,6 +296,8 @@ struct bfq_data {
  * @pid: pid of the process owning the queue, used for logging purposes.
  * @last_activation_time: time of the last (idle -> backlogged) transition
  * @high_weight_budget: number of sectors left to serve with boosted weight
+ * @new_bfqq: queue the processes using this one are to be moved to, once
+ *            it has been found to cooperate with it (holds a reference).
  *
  * A bfq_queue is a leaf request queue; it can be associated to an io_context
  * or more (if it is an async one).  @cgroup holds a reference to the
@@ -335,6 +340,8 @@ struct bfq_queue {
 
 	u64 last_activation_time;
 	bfq_service_t high_weight_budget;
+
+	struct bfq_queue *new_bfqq;
 };
 
 enum bfqq_state_flags {
@@ -346,6 +353,8 @@ enum bfqq_state_flags {
 	BFQ_BFQQ_FLAG_prio_changed,	/* task priority has changed */
 	BFQ_BFQQ_FLAG_sync,		/* synchronous queue */
 	BFQ_BFQQ_FLAG_budget_new,	/* no completion with this budget */
+	BFQ_BFQQ_FLAG_coop,		/* shared by cooperating processes */
+	BFQ_BFQQ_FLAG_split_coop,	/* shared queue to be split */
 };
 
 #define BFQ_BFQQ_FNS(name)						\
@@ -370,6 +379,8 @@ BFQ_BFQQ_FNS(idle_window);
 BFQ_BFQQ_FNS(prio_changed);
 BFQ_BFQQ_FNS(sync);
 BFQ_BFQQ_FNS(budget_new);
+BFQ_BFQQ_FNS(coop);
+BFQ_BFQQ_FNS(split_coop);
 #undef BFQ_BFQQ_FNS
 
 /* Logging facilities. */
@@ -1098,6 +1098,7 @@ ssize_t elv_iosched_store(struct request_queue *q, const char *name,
 							elevator_name);
 	return count;
 }
+EXPORT_SYMBOL_GPL(elv_iosched_store);
 
 ssize_t elv_iosched_show(struct request_queue *q, char *name)
 {
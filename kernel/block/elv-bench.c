@@ -0,0 +1,716 @@
+/*
+ * I/O scheduler benchmark
+ *
+ * Replays a request stream against a null block device with a simple
+ * service time model, once per elevator, so that the schedulers can be
+ * compared on the same input without real hardware.
+ *
+ * The interface lives in debugfs under elvbench/:
+ *
+ *   trace     write blktrace-style lines "<time_us> <RWBS> <sector> <sectors>"
+ *             to append to the trace; opening with O_TRUNC clears it
+ *   workload  write "launch", "scan" or "install" to replace the trace
+ *             with a synthetic one
+ *   run       write a list of elevator names, or "all", to replay the
+ *             trace under each of them in turn
+ *   results   per-class latency percentiles, merge rate and the CPU time
+ *             spent submitting and dispatching, for the last run
+ *
+ * The device serves one request at a time and takes service_us plus
+ * sector_ns per sector for each, so that requests queue up and the
+ * elevator has something to sort and merge. Data is never copied.
+ */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/genhd.h>
+#include <linux/bio.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/completion.h>
+
+#define ELVBENCH_MAX_IOS	65536
+#define ELVBENCH_MAX_SECTORS	256
+#define ELVBENCH_RESULTS_SIZE	(16 * PAGE_SIZE)
+
+static unsigned int service_us = 150;	/* per request */
+static unsigned int sector_ns = 4000;	/* per 512 byte sector, ~120MB/s */
+static unsigned int capacity_mb = 4096;
+
+module_param(service_us, uint, 0644);
+module_param(sector_ns, uint, 0644);
+module_param(capacity_mb, uint, 0444);
+
+enum {
+	ELVBENCH_SYNC_READ,
+	ELVBENCH_SYNC_WRITE,
+	ELVBENCH_ASYNC_READ,
+	ELVBENCH_ASYNC_WRITE,
+	ELVBENCH_CLASSES,
+};
+
+static const char *elvbench_class_names[ELVBENCH_CLASSES] = {
+	"sync_read", "sync_write", "async_read", "async_write",
+};
+
+struct elvbench_io {
+	u32 time_us;		/* submit time, from the start of the trace */
+	u32 sectors;
+	u64 sector;
+	u8 write;
+	u8 sync;
+};
+
+static inline int elvbench_class(struct elvbench_io *io)
+{
+	return (io->sync ? 0 : 2) + (io->write ? 1 : 0);
+}
+
+struct elvbench_dev {
+	spinlock_t lock;
+	struct request_queue *queue;
+	struct gendisk *disk;
+	struct block_device *bdev;
+	int major;
+
+	/* the request being served, completed by the timer */
+	struct request *active;
+	struct hrtimer timer;
+
+	/* counters of the current run, under the queue lock */
+	unsigned long requests;
+	u64 dispatch_ns;
+};
+
+static struct elvbench_dev elvbench;
+
+/* the trace and the results of its last replay */
+static DEFINE_MUTEX(elvbench_mutex);
+static struct elvbench_io *elvbench_ios;
+static unsigned int elvbench_nr_ios;
+static char elvbench_line[128];
+static unsigned int elvbench_line_len;
+
+/* per io state while replaying */
+static ktime_t *elvbench_start;
+static u32 *elvbench_lat_us;
+static atomic_t elvbench_inflight;
+static struct completion elvbench_done;
+static struct page *elvbench_page;
+
+static char *elvbench_results;
+static size_t elvbench_results_len;
+
+/*
+ * The null device
+ */
+
+static void elvbench_start_request(struct elvbench_dev *dev)
+{
+	struct request *rq;
+	ktime_t t0 = ktime_get();
+	u64 ns;
+
+	rq = blk_fetch_request(dev->queue);
+	dev->dispatch_ns += ktime_to_ns(ktime_sub(ktime_get(), t0));
+	if (!rq)
+		return;
+
+	if (!blk_fs_request(rq)) {
+		__blk_end_request_all(rq, -EIO);
+		return;
+	}
+
+	dev->active = rq;
+	dev->requests++;
+	ns = (u64) service_us * NSEC_PER_USEC +
+	     (u64) blk_rq_sectors(rq) * sector_ns;
+	hrtimer_start(&dev->timer, ns_to_ktime(ns), HRTIMER_MODE_REL);
+}
+
+/* called with the queue lock held */
+static void elvbench_request_fn(struct request_queue *q)
+{
+	struct elvbench_dev *dev = q->queuedata;
+
+	while (!dev->active && blk_peek_request(q))
+		elvbench_start_request(dev);
+}
+
+static enum hrtimer_restart elvbench_timer_fn(struct hrtimer *timer)
+{
+	struct elvbench_dev *dev =
+		container_of(timer, struct elvbench_dev, timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	__blk_end_request_all(dev->active, 0);
+	dev->active = NULL;
+	__blk_run_queue(dev->queue);
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static const struct block_device_operations elvbench_fops = {
+	.owner = THIS_MODULE,
+};
+
+static int elvbench_create_dev(struct elvbench_dev *dev)
+{
+	int err = -ENOMEM;
+
+	spin_lock_init(&dev->lock);
+	hrtimer_init(&dev->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->timer.function = elvbench_timer_fn;
+
+	dev->major = register_blkdev(0, "elvbench");
+	if (dev->major < 0)
+		return dev->major;
+
+	dev->queue = blk_init_queue(elvbench_request_fn, &dev->lock);
+	if (!dev->queue)
+		goto out_unregister;
+	dev->queue->queuedata = dev;
+	blk_queue_logical_block_size(dev->queue, 512);
+	blk_queue_max_hw_sectors(dev->queue, ELVBENCH_MAX_SECTORS);
+
+	dev->disk = alloc_disk(1);
+	if (!dev->disk)
+		goto out_queue;
+	dev->disk->major = dev->major;
+	dev->disk->first_minor = 0;
+	dev->disk->fops = &elvbench_fops;
+	dev->disk->private_data = dev;
+	dev->disk->queue = dev->queue;
+	sprintf(dev->disk->disk_name, "elvbench0");
+	set_capacity(dev->disk, (sector_t) capacity_mb << 11);
+	add_disk(dev->disk);
+
+	dev->bdev = bdget_disk(dev->disk, 0);
+	if (!dev->bdev)
+		goto out_disk;
+	err = blkdev_get(dev->bdev, FMODE_READ | FMODE_WRITE);
+	if (err)
+		goto out_disk;
+
+	return 0;
+
+out_disk:
+	del_gendisk(dev->disk);
+	put_disk(dev->disk);
+out_queue:
+	blk_cleanup_queue(dev->queue);
+out_unregister:
+	unregister_blkdev(dev->major, "elvbench");
+	return err;
+}
+
+static void elvbench_destroy_dev(struct elvbench_dev *dev)
+{
+	blkdev_put(dev->bdev, FMODE_READ | FMODE_WRITE);
+	del_gendisk(dev->disk);
+	put_disk(dev->disk);
+	blk_cleanup_queue(dev->queue);
+	unregister_blkdev(dev->major, "elvbench");
+}
+
+/*
+ * Replay
+ */
+
+static void elvbench_end_io(struct bio *bio, int err)
+{
+	unsigned int i = (unsigned long) bio->bi_private;
+
+	elvbench_lat_us[i] = ktime_to_us(ktime_sub(ktime_get(),
+						   elvbench_start[i]));
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&elvbench_inflight))
+		complete(&elvbench_done);
+}
+
+static int elvbench_submit(struct elvbench_io *io, unsigned int i)
+{
+	unsigned int pages = DIV_ROUND_UP(io->sectors, PAGE_SIZE >> 9);
+	unsigned int left = io->sectors << 9;
+	struct bio *bio;
+	int rw;
+
+	bio = bio_alloc(GFP_KERNEL, pages);
+	if (!bio)
+		return -ENOMEM;
+
+	/* every segment points at the same page, the device never looks */
+	while (left) {
+		unsigned int len = min_t(unsigned int, left, PAGE_SIZE);
+
+		if (bio_add_page(bio, elvbench_page, len, 0) != len)
+			break;
+		left -= len;
+	}
+	bio->bi_sector = io->sector;
+	bio->bi_bdev = elvbench.bdev;
+	bio->bi_end_io = elvbench_end_io;
+	bio->bi_private = (void *) (unsigned long) i;
+
+	if (io->write)
+		rw = io->sync ? WRITE_SYNC : WRITE;
+	else
+		rw = io->sync ? READ_SYNC : READ;
+
+	atomic_inc(&elvbench_inflight);
+	elvbench_start[i] = ktime_get();
+	submit_bio(rw, bio);
+	return 0;
+}
+
+static int elvbench_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+#define elvbench_printf(fmt, args...)					\
+	(elvbench_results_len += scnprintf(elvbench_results +		\
+				elvbench_results_len,			\
+				ELVBENCH_RESULTS_SIZE - elvbench_results_len, \
+				fmt, ##args))
+
+static void elvbench_report(const char *name, u64 elapsed_us,
+			    unsigned long bios, unsigned long requests,
+			    u64 submit_ns, u64 dispatch_ns)
+{
+	u32 *lat = vmalloc(elvbench_nr_ios * sizeof(*lat));
+	unsigned int i, c, n;
+
+	elvbench_printf("%s: ios %u elapsed_ms %llu requests %lu "
+			"merged %lu%% submit_ns %llu dispatch_ns %llu\n",
+			name, elvbench_nr_ios, div_u64(elapsed_us, 1000), requests,
+			bios ? 100 - requests * 100 / bios : 0,
+			bios ? div_u64(submit_ns, bios) : 0,
+			requests ? div_u64(dispatch_ns, requests) : 0);
+	if (!lat)
+		return;
+
+	/* latencies in us, per class */
+	for (c = 0; c < ELVBENCH_CLASSES; c++) {
+		for (i = n = 0; i < elvbench_nr_ios; i++)
+			if (elvbench_class(&elvbench_ios[i]) == c)
+				lat[n++] = elvbench_lat_us[i];
+		if (!n)
+			continue;
+
+		sort(lat, n, sizeof(*lat), elvbench_cmp_u32, NULL);
+		elvbench_printf("  %-11s n %u p50 %u p90 %u p99 %u max %u\n",
+				elvbench_class_names[c], n, lat[n / 2],
+				lat[n * 9 / 10], lat[n * 99 / 100], lat[n - 1]);
+	}
+	vfree(lat);
+}
+
+static int elvbench_run_one(const char *name)
+{
+	struct request_queue *q = elvbench.queue;
+	unsigned long requests;
+	u64 submit_ns = 0, dispatch_ns;
+	ktime_t start;
+	unsigned int i;
+	int err = 0;
+
+	elv_iosched_store(q, name, strlen(name));
+	if (strcmp(q->elevator->elevator_type->elevator_name, name)) {
+		elvbench_printf("%s: not available\n", name);
+		return 0;
+	}
+
+	spin_lock_irq(q->queue_lock);
+	elvbench.requests = 0;
+	elvbench.dispatch_ns = 0;
+	spin_unlock_irq(q->queue_lock);
+
+	init_completion(&elvbench_done);
+	atomic_set(&elvbench_inflight, 1);
+	start = ktime_get();
+
+	for (i = 0; i < elvbench_nr_ios; i++) {
+		struct elvbench_io *io = &elvbench_ios[i];
+		ktime_t due = ktime_add_us(start, io->time_us);
+		ktime_t t0;
+
+		if (ktime_to_ns(ktime_sub(due, ktime_get())) > 0) {
+			set_current_state(TASK_UNINTERRUPTIBLE);
+			schedule_hrtimeout(&due, HRTIMER_MODE_ABS);
+		}
+
+		t0 = ktime_get();
+		err = elvbench_submit(io, i);
+		submit_ns += ktime_to_ns(ktime_sub(ktime_get(), t0));
+		if (err)
+			break;
+	}
+
+	/* push out whatever the elevator still holds */
+	blk_unplug(q);
+	if (!atomic_dec_and_test(&elvbench_inflight))
+		wait_for_completion(&elvbench_done);
+
+	spin_lock_irq(q->queue_lock);
+	requests = elvbench.requests;
+	dispatch_ns = elvbench.dispatch_ns;
+	spin_unlock_irq(q->queue_lock);
+
+	if (err) {
+		elvbench_printf("%s: failed at io %u (%d)\n", name, i, err);
+		return err;
+	}
+
+	elvbench_report(name, ktime_to_us(ktime_sub(ktime_get(), start)),
+			elvbench_nr_ios, requests, submit_ns, dispatch_ns);
+	return 0;
+}
+
+static const char *elvbench_all =
+	"noop deadline anticipatory cfq bfq vr sio zen flash";
+
+static int elvbench_run(char *names)
+{
+	char *name;
+	int err = 0;
+
+	if (!strcmp(names, "all"))
+		names = (char *) elvbench_all;
+
+	elvbench_results_len = 0;
+	elvbench_printf("service_us %u sector_ns %u, latencies in us\n",
+			service_us, sector_ns);
+
+	names = kstrdup(names, GFP_KERNEL);
+	if (!names)
+		return -ENOMEM;
+	while (!err && (name = strsep(&names, " ")) != NULL)
+		if (*name)
+			err = elvbench_run_one(name);
+	kfree(names);
+
+	return err;
+}
+
+/*
+ * Traces
+ */
+
+static int elvbench_push(u32 time_us, int write, int sync, u64 sector,
+			 u32 sectors)
+{
+	struct elvbench_io *io;
+	u32 capacity = capacity_mb << 11;
+
+	if (elvbench_nr_ios >= ELVBENCH_MAX_IOS)
+		return -ENOSPC;
+	if (!sectors || sectors > ELVBENCH_MAX_SECTORS)
+		return -EINVAL;
+	if (elvbench_nr_ios && time_us < elvbench_ios[elvbench_nr_ios - 1].time_us)
+		return -EINVAL;
+
+	io = &elvbench_ios[elvbench_nr_ios++];
+	io->time_us = time_us;
+	io->write = write;
+	io->sync = sync;
+	io->sector = do_div(sector, capacity - sectors);
+	io->sectors = sectors;
+	return 0;
+}
+
+/* "<time_us> <RWBS> <sector> <sectors>", as blkparse prints them */
+static int elvbench_parse(char *line)
+{
+	unsigned long long sector;
+	unsigned int time_us, sectors;
+	char rwbs[8];
+
+	line = strim(line);
+	if (!*line || *line == '#')
+		return 0;
+	if (sscanf(line, "%u %7s %llu %u", &time_us, rwbs, &sector,
+		   &sectors) != 4)
+		return -EINVAL;
+	if (!strchr(rwbs, 'R') && !strchr(rwbs, 'W'))
+		return -EINVAL;
+
+	return elvbench_push(time_us, strchr(rwbs, 'W') != NULL,
+			     strchr(rwbs, 'S') != NULL, sector, sectors);
+}
+
+static int elvbench_trace_open(struct inode *inode, struct file *file)
+{
+	if (file->f_flags & O_TRUNC) {
+		mutex_lock(&elvbench_mutex);
+		elvbench_nr_ios = 0;
+		elvbench_line_len = 0;
+		mutex_unlock(&elvbench_mutex);
+	}
+	return 0;
+}
+
+static ssize_t elvbench_trace_write(struct file *file,
+				    const char __user *buf, size_t count,
+				    loff_t *ppos)
+{
+	size_t done = 0;
+	int err = 0;
+	char c;
+
+	mutex_lock(&elvbench_mutex);
+	while (!err && done < count) {
+		if (get_user(c, buf + done)) {
+			err = -EFAULT;
+			break;
+		}
+		done++;
+
+		if (c != '\n') {
+			if (elvbench_line_len < sizeof(elvbench_line) - 1)
+				elvbench_line[elvbench_line_len++] = c;
+			continue;
+		}
+		elvbench_line[elvbench_line_len] = '\0';
+		elvbench_line_len = 0;
+		err = elvbench_parse(elvbench_line);
+	}
+	mutex_unlock(&elvbench_mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations elvbench_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = elvbench_trace_open,
+	.write = elvbench_trace_write,
+};
+
+/*
+ * Synthetic workloads, from a fixed seed so that every run sees the
+ * same stream. Times are in us, sizes in sectors.
+ */
+static u32 elvbench_seed;
+
+static u32 elvbench_rand(u32 range)
+{
+	elvbench_seed = elvbench_seed * 1103515245 + 12345;
+	return (elvbench_seed >> 8) % range;
+}
+
+/* app launch: bursts of small sync reads through a few files, readahead */
+static void elvbench_gen_launch(void)
+{
+	u32 t = 0;
+	int file, i;
+
+	for (file = 0; file < 400; file++) {
+		u64 base = elvbench_rand(512 << 11);
+		int reads = 1 + elvbench_rand(8);
+
+		for (i = 0; i < reads; i++) {
+			u32 len = 8 << elvbench_rand(3);
+
+			elvbench_push(t, 0, 1, base, len);
+			base += len;
+			t += 50 + elvbench_rand(400);
+		}
+		if (elvbench_rand(3) == 0)
+			elvbench_push(t, 0, 0, base, 256);
+		if (elvbench_rand(10) == 0)
+			elvbench_push(t, 1, 1, (3u << 21) + elvbench_rand(8192), 8);
+		t += elvbench_rand(2000);
+	}
+}
+
+/* media scan: sequential async reads, metadata reads, database writes */
+static void elvbench_gen_scan(void)
+{
+	u32 t = 0;
+	int file, i;
+
+	for (file = 0; file < 300; file++) {
+		u64 base = (u64) elvbench_rand(2048) << 11;
+
+		elvbench_push(t, 0, 1, elvbench_rand(64 << 11), 8);
+		t += 100 + elvbench_rand(300);
+		for (i = 0; i < 4; i++) {
+			elvbench_push(t, 0, 0, base + i * 256, 256);
+			t += 200 + elvbench_rand(800);
+		}
+		if (elvbench_rand(2) == 0)
+			elvbench_push(t, 1, 0, (3u << 21) + elvbench_rand(16384), 8);
+	}
+}
+
+/* package install: streaming writes, fsyncs and random reads */
+static void elvbench_gen_install(void)
+{
+	u64 pos = 1u << 21;
+	u32 t = 0;
+	int i;
+
+	for (i = 0; i < 4000; i++) {
+		elvbench_push(t, 1, 0, pos, 256);
+		pos += 256;
+		t += 300 + elvbench_rand(200);
+
+		if (i % 64 == 63)
+			elvbench_push(t, 1, 1, (3u << 21) + elvbench_rand(8192), 8);
+		if (elvbench_rand(4) == 0) {
+			elvbench_push(t, 0, 1, elvbench_rand(512 << 11), 32);
+			t += elvbench_rand(200);
+		}
+	}
+}
+
+static ssize_t elvbench_workload_write(struct file *file,
+				       const char __user *buf, size_t count,
+				       loff_t *ppos)
+{
+	char name[16], *workload;
+	size_t len = min(count, sizeof(name) - 1);
+	int err = 0;
+
+	if (copy_from_user(name, buf, len))
+		return -EFAULT;
+	name[len] = '\0';
+	workload = strim(name);
+
+	mutex_lock(&elvbench_mutex);
+	elvbench_nr_ios = 0;
+	elvbench_seed = 1;
+	if (!strcmp(workload, "launch"))
+		elvbench_gen_launch();
+	else if (!strcmp(workload, "scan"))
+		elvbench_gen_scan();
+	else if (!strcmp(workload, "install"))
+		elvbench_gen_install();
+	else
+		err = -EINVAL;
+	mutex_unlock(&elvbench_mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations elvbench_workload_fops = {
+	.owner = THIS_MODULE,
+	.write = elvbench_workload_write,
+};
+
+static ssize_t elvbench_run_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	char names[128];
+	size_t len = min(count, sizeof(names) - 1);
+	int err;
+
+	if (copy_from_user(names, buf, len))
+		return -EFAULT;
+	names[len] = '\0';
+
+	mutex_lock(&elvbench_mutex);
+	if (elvbench_nr_ios)
+		err = elvbench_run(strim(names));
+	else
+		err = -ENODATA;
+	mutex_unlock(&elvbench_mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations elvbench_run_fops = {
+	.owner = THIS_MODULE,
+	.write = elvbench_run_write,
+};
+
+static ssize_t elvbench_results_read(struct file *file, char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+
+	mutex_lock(&elvbench_mutex);
+	ret = simple_read_from_buffer(buf, count, ppos, elvbench_results,
+				      elvbench_results_len);
+	mutex_unlock(&elvbench_mutex);
+
+	return ret;
+}
+
+static const struct file_operations elvbench_results_fops = {
+	.owner = THIS_MODULE,
+	.read = elvbench_results_read,
+};
+
+static struct dentry *elvbench_dir;
+
+static int __init elvbench_init(void)
+{
+	int err = -ENOMEM;
+
+	elvbench_ios = vmalloc(ELVBENCH_MAX_IOS * sizeof(*elvbench_ios));
+	elvbench_start = vmalloc(ELVBENCH_MAX_IOS * sizeof(*elvbench_start));
+	elvbench_lat_us = vmalloc(ELVBENCH_MAX_IOS * sizeof(*elvbench_lat_us));
+	elvbench_results = vmalloc(ELVBENCH_RESULTS_SIZE);
+	elvbench_page = alloc_page(GFP_KERNEL);
+	if (!elvbench_ios || !elvbench_start || !elvbench_lat_us ||
+	    !elvbench_results || !elvbench_page)
+		goto out_free;
+
+	err = elvbench_create_dev(&elvbench);
+	if (err)
+		goto out_free;
+
+	elvbench_dir = debugfs_create_dir("elvbench", NULL);
+	debugfs_create_file("trace", S_IWUSR, elvbench_dir, NULL,
+			    &elvbench_trace_fops);
+	debugfs_create_file("workload", S_IWUSR, elvbench_dir, NULL,
+			    &elvbench_workload_fops);
+	debugfs_create_file("run", S_IWUSR, elvbench_dir, NULL,
+			    &elvbench_run_fops);
+	debugfs_create_file("results", S_IRUSR, elvbench_dir, NULL,
+			    &elvbench_results_fops);
+
+	return 0;
+
+out_free:
+	if (elvbench_page)
+		__free_page(elvbench_page);
+	vfree(elvbench_results);
+	vfree(elvbench_lat_us);
+	vfree(elvbench_start);
+	vfree(elvbench_ios);
+	return err;
+}
+
+static void __exit elvbench_exit(void)
+{
+	debugfs_remove_recursive(elvbench_dir);
+	elvbench_destroy_dev(&elvbench);
+
+	__free_page(elvbench_page);
+	vfree(elvbench_results);
+	vfree(elvbench_lat_us);
+	vfree(elvbench_start);
+	vfree(elvbench_ios);
+}
+
+module_init(elvbench_init);
+module_exit(elvbench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("I/O scheduler trace replay benchmark");
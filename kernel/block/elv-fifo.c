@@ -0,0 +1,264 @@
+/*
+ * Common FIFO/deadline core for the sio, zen and vr I/O schedulers.
+ *
+ * The schedulers used to carry their own copies of the FIFO handling,
+ * with defaults fixed at compile time and no way to tell how they behave
+ * on a given device. They now share this code, take their defaults from
+ * module parameters, and report per-class counters and latencies through
+ * a "stats" attribute in the queue's iosched directory.
+ */
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+
+#include "elv-fifo.h"
+
+/*
+ * Per-request timestamps in microseconds, truncated to 32 bits. Only
+ * differences are used, so wrapping is harmless.
+ */
+#define rq_insert_us(rq)	((u32) (unsigned long) (rq)->elevator_private2)
+#define rq_dispatch_us(rq)	((u32) (unsigned long) (rq)->elevator_private3)
+
+static inline u32 elv_fifo_now_us(void)
+{
+	return (u32) ktime_to_us(ktime_get());
+}
+
+void elv_fifo_init(struct elv_fifo *ef, const int expire_ms[2][2],
+		   int fifo_batch)
+{
+	int sync, dir;
+
+	memset(ef, 0, sizeof(*ef));
+	for (sync = 0; sync < 2; sync++) {
+		for (dir = 0; dir < 2; dir++) {
+			INIT_LIST_HEAD(&ef->fifo_list[sync][dir]);
+			ef->fifo_expire[sync][dir] =
+				msecs_to_jiffies(expire_ms[sync][dir]);
+		}
+	}
+	ef->fifo_batch = fifo_batch;
+	ef->stats_since = jiffies;
+}
+EXPORT_SYMBOL(elv_fifo_init);
+
+void elv_fifo_exit(struct elv_fifo *ef)
+{
+	BUG_ON(!elv_fifo_empty(ef));
+}
+EXPORT_SYMBOL(elv_fifo_exit);
+
+/*
+ * elv_fifo_add - queue 'rq' on its class's FIFO with its deadline set.
+ * A zero expiry makes requests of that class due at once.
+ */
+void elv_fifo_add(struct elv_fifo *ef, struct request *rq)
+{
+	const int sync = rq_is_sync(rq);
+	const int dir = rq_data_dir(rq);
+
+	rq_set_fifo_time(rq, jiffies + ef->fifo_expire[sync][dir]);
+	list_add_tail(&rq->queuelist, &ef->fifo_list[sync][dir]);
+
+	rq->elevator_private2 = (void *) (unsigned long) elv_fifo_now_us();
+	ef->stats[sync][dir].inserted++;
+}
+EXPORT_SYMBOL(elv_fifo_add);
+
+/*
+ * elv_fifo_merged_requests - 'next' was merged into 'rq'. If next expires
+ * before rq, rq takes over its deadline and its place in the FIFO.
+ */
+void elv_fifo_merged_requests(struct elv_fifo *ef, struct request *rq,
+			      struct request *next)
+{
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
+			list_move(&rq->queuelist, &next->queuelist);
+			rq_set_fifo_time(rq, rq_fifo_time(next));
+		}
+	}
+
+	rq_fifo_clear(next);
+	ef->merged++;
+}
+EXPORT_SYMBOL(elv_fifo_merged_requests);
+
+/*
+ * elv_fifo_dispatch - take 'rq' off its FIFO and move it to the dispatch
+ * queue.
+ */
+void elv_fifo_dispatch(struct elv_fifo *ef, struct request *rq)
+{
+	struct elv_fifo_class_stats *st =
+		&ef->stats[rq_is_sync(rq)][rq_data_dir(rq)];
+	u32 now = elv_fifo_now_us();
+	u32 wait = now - rq_insert_us(rq);
+
+	if (time_after(jiffies, rq_fifo_time(rq)))
+		st->expired++;
+	st->dispatched++;
+	st->wait_us += wait;
+	if (wait > st->max_wait_us)
+		st->max_wait_us = wait;
+	rq->elevator_private3 = (void *) (unsigned long) now;
+
+	rq_fifo_clear(rq);
+	elv_dispatch_add_tail(rq->q, rq);
+	ef->batched++;
+}
+EXPORT_SYMBOL(elv_fifo_dispatch);
+
+void elv_fifo_completed(struct elv_fifo *ef, struct request *rq)
+{
+	struct elv_fifo_class_stats *st =
+		&ef->stats[rq_is_sync(rq)][rq_data_dir(rq)];
+
+	st->completed++;
+	st->service_us += elv_fifo_now_us() - rq_dispatch_us(rq);
+	st->sectors += blk_rq_sectors(rq);
+}
+EXPORT_SYMBOL(elv_fifo_completed);
+
+/*
+ * elv_fifo_expired - the head of the given FIFO if its deadline passed
+ */
+struct request *elv_fifo_expired(struct elv_fifo *ef, int sync, int data_dir)
+{
+	struct list_head *list = &ef->fifo_list[sync][data_dir];
+	struct request *rq;
+
+	if (list_empty(list))
+		return NULL;
+
+	rq = rq_entry_fifo(list->next);
+	if (time_after(jiffies, rq_fifo_time(rq)))
+		return rq;
+
+	return NULL;
+}
+EXPORT_SYMBOL(elv_fifo_expired);
+
+static struct request *elv_fifo_earlier(struct request *a, struct request *b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	return time_after(rq_fifo_time(a), rq_fifo_time(b)) ? b : a;
+}
+
+/*
+ * elv_fifo_oldest - the request of the given sync class that is due first,
+ * reads and writes alike
+ */
+struct request *elv_fifo_oldest(struct elv_fifo *ef, int sync)
+{
+	struct request *rq[2] = { NULL, NULL };
+	int dir;
+
+	for (dir = 0; dir < 2; dir++)
+		if (!list_empty(&ef->fifo_list[sync][dir]))
+			rq[dir] = rq_entry_fifo(ef->fifo_list[sync][dir].next);
+
+	return elv_fifo_earlier(rq[READ], rq[WRITE]);
+}
+EXPORT_SYMBOL(elv_fifo_oldest);
+
+/*
+ * elv_fifo_oldest_expired - of all requests past their deadline, the one
+ * that expired first
+ */
+struct request *elv_fifo_oldest_expired(struct elv_fifo *ef)
+{
+	struct request *rq = NULL;
+	int sync, dir;
+
+	for (sync = 0; sync < 2; sync++)
+		for (dir = 0; dir < 2; dir++)
+			rq = elv_fifo_earlier(rq,
+					      elv_fifo_expired(ef, sync, dir));
+
+	return rq;
+}
+EXPORT_SYMBOL(elv_fifo_oldest_expired);
+
+/*
+ * sysfs helpers
+ */
+
+ssize_t elv_fifo_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+EXPORT_SYMBOL(elv_fifo_var_show);
+
+ssize_t elv_fifo_var_store(int *var, const char *page, size_t count)
+{
+	*var = simple_strtol(page, NULL, 10);
+	return count;
+}
+EXPORT_SYMBOL(elv_fifo_var_store);
+
+static const char *elv_fifo_class_names[2][2] = {
+	{ "async_read", "async_write" },
+	{ "sync_read", "sync_write" },
+};
+
+static inline unsigned long long elv_fifo_avg(u64 total, unsigned long n)
+{
+	return n ? div_u64(total, n) : 0;
+}
+
+/*
+ * Counters since the last reset, one line per class. Latencies are in
+ * microseconds: wait is insert to dispatch, service is dispatch to
+ * completion. Throughput is kb over elapsed_ms.
+ */
+ssize_t elv_fifo_stats_show(struct elv_fifo *ef, char *page)
+{
+	ssize_t len = 0;
+	int sync, dir;
+
+	len += sprintf(page + len, "elapsed_ms %u merged %lu\n",
+		       jiffies_to_msecs(jiffies - ef->stats_since),
+		       ef->merged);
+	len += sprintf(page + len, "class inserted dispatched expired "
+		       "completed avg_wait max_wait avg_service kb\n");
+	for (sync = BLK_RW_SYNC; sync >= BLK_RW_ASYNC; sync--) {
+		for (dir = READ; dir <= WRITE; dir++) {
+			struct elv_fifo_class_stats *st = &ef->stats[sync][dir];
+
+			len += sprintf(page + len,
+				       "%s %lu %lu %lu %lu %llu %u %llu %llu\n",
+				       elv_fifo_class_names[sync][dir],
+				       st->inserted, st->dispatched,
+				       st->expired, st->completed,
+				       elv_fifo_avg(st->wait_us,
+						    st->dispatched),
+				       st->max_wait_us,
+				       elv_fifo_avg(st->service_us,
+						    st->completed),
+				       (unsigned long long) st->sectors >> 1);
+		}
+	}
+
+	return len;
+}
+EXPORT_SYMBOL(elv_fifo_stats_show);
+
+/* any write resets the counters */
+ssize_t elv_fifo_stats_store(struct elv_fifo *ef, const char *page,
+			     size_t count)
+{
+	memset(ef->stats, 0, sizeof(ef->stats));
+	ef->merged = 0;
+	ef->stats_since = jiffies;
+	return count;
+}
+EXPORT_SYMBOL(elv_fifo_stats_store);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Common core of the FIFO deadline IO schedulers");
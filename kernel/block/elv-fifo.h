@@ -0,0 +1,88 @@
+#ifndef ELV_FIFO_H
+#define ELV_FIFO_H
+
+/*
+ * Common core of the deadline-style FIFO schedulers (sio, zen, vr).
+ *
+ * Each scheduler embeds a struct elv_fifo in its elevator data. The core
+ * keeps one FIFO per sync class and data direction, stamps every request
+ * with its deadline, and accounts inserts, dispatches, merges and
+ * completions so the schedulers can be compared on a given device. The
+ * scheduler itself only decides which request goes next.
+ *
+ * Everything here runs under the queue lock, like the elevator hooks that
+ * call it.
+ */
+
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+
+struct elv_fifo_class_stats {
+	unsigned long inserted;
+	unsigned long dispatched;
+	unsigned long expired;		/* dispatched past their deadline */
+	unsigned long completed;
+	u64 wait_us;			/* total insert to dispatch */
+	u32 max_wait_us;
+	u64 service_us;			/* total dispatch to completion */
+	u64 sectors;			/* completed */
+};
+
+struct elv_fifo {
+	struct list_head fifo_list[2][2];	/* [sync][data_dir] */
+	int fifo_expire[2][2];			/* in jiffies */
+	int fifo_batch;
+	unsigned int batched;	/* dispatched since the last fifo check */
+
+	struct elv_fifo_class_stats stats[2][2];
+	unsigned long merged;		/* bio and request merges */
+	unsigned long stats_since;	/* jiffies at the last reset */
+};
+
+/* default deadlines in milliseconds, as [sync][data_dir] */
+void elv_fifo_init(struct elv_fifo *ef, const int expire_ms[2][2],
+		   int fifo_batch);
+void elv_fifo_exit(struct elv_fifo *ef);
+
+void elv_fifo_add(struct elv_fifo *ef, struct request *rq);
+void elv_fifo_merged_requests(struct elv_fifo *ef, struct request *rq,
+			      struct request *next);
+void elv_fifo_dispatch(struct elv_fifo *ef, struct request *rq);
+void elv_fifo_completed(struct elv_fifo *ef, struct request *rq);
+
+struct request *elv_fifo_expired(struct elv_fifo *ef, int sync, int data_dir);
+struct request *elv_fifo_oldest(struct elv_fifo *ef, int sync);
+struct request *elv_fifo_oldest_expired(struct elv_fifo *ef);
+
+static inline int elv_fifo_empty(struct elv_fifo *ef)
+{
+	return list_empty(&ef->fifo_list[BLK_RW_SYNC][READ]) &&
+	       list_empty(&ef->fifo_list[BLK_RW_SYNC][WRITE]) &&
+	       list_empty(&ef->fifo_list[BLK_RW_ASYNC][READ]) &&
+	       list_empty(&ef->fifo_list[BLK_RW_ASYNC][WRITE]);
+}
+
+static inline void elv_fifo_merged(struct elv_fifo *ef)
+{
+	ef->merged++;
+}
+
+/*
+ * elv_fifo_batch_done - true once fifo_batch requests went out since the
+ * last call that returned true; the caller then looks for expired ones.
+ */
+static inline int elv_fifo_batch_done(struct elv_fifo *ef)
+{
+	if (ef->batched <= ef->fifo_batch)
+		return 0;
+	ef->batched = 0;
+	return 1;
+}
+
+ssize_t elv_fifo_var_show(int var, char *page);
+ssize_t elv_fifo_var_store(int *var, const char *page, size_t count);
+ssize_t elv_fifo_stats_show(struct elv_fifo *ef, char *page);
+ssize_t elv_fifo_stats_store(struct elv_fifo *ef, const char *page,
+			     size_t count);
+
+#endif
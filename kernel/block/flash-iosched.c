@@ -0,0 +1,576 @@
+/*
+ * Flash I/O scheduler
+ *
+ * Managed flash (eMMC, SD) remaps writes through an FTL that programs
+ * and erases in units much larger than a sector. Small writes scattered
+ * over many erase blocks make it copy whole blocks around, while the
+ * same writes issued together, block by block, cost little more than
+ * the data itself.
+ *
+ * Reads are dispatched in FIFO order with a deadline, as in sio. Writes
+ * are kept sorted and go out one erase block at a time, in ascending
+ * sector order. An asynchronous write is held back until its erase block
+ * has filled up, it has waited write_hold ms or something forces it out,
+ * so that neighbouring writes get the chance to join it. Sync writes and
+ * writes past their deadline are never held.
+ *
+ * The erase block size comes from the queue's optimal I/O size, which
+ * the MMC block driver sets from the card's CSD/EXT_CSD, unless it is
+ * set through the erase_block_kb attribute.
+ */
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/rbtree.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+
+#include "elv-fifo.h"
+
+enum { ASYNC, SYNC };
+
+/*
+ * Defaults for new queues, in ms; each queue can be tuned further
+ * through its iosched directory in sysfs.
+ */
+static int sync_read_expire = 125;	/* max time before a sync read is submitted. */
+static int sync_write_expire = 1000;	/* max time before a sync write is submitted. */
+static int async_read_expire = 1000;
+static int async_write_expire = 5000;
+
+static int write_hold = 50;		/* max time an async write waits for its erase block */
+static int writes_starved = 2;		/* max times reads can starve a write batch */
+static int erase_block_kb = 512;	/* when the device does not tell */
+
+module_param(sync_read_expire, int, 0644);
+module_param(sync_write_expire, int, 0644);
+module_param(async_read_expire, int, 0644);
+module_param(async_write_expire, int, 0644);
+module_param(write_hold, int, 0644);
+module_param(writes_starved, int, 0644);
+module_param(erase_block_kb, int, 0644);
+
+struct flash_data {
+	struct request_queue *queue;
+
+	/* Request queues, expirations and statistics */
+	struct elv_fifo fifo;
+
+	/* requests sorted by sector, for merging and write batches */
+	struct rb_root sort_list[2];
+
+	/* write batch in progress */
+	struct request *next_write;
+	sector_t batch_end;
+
+	/* erase block that filled up since the last batch */
+	sector_t ready_block;
+	int block_ready;
+
+	unsigned int starved;
+	unsigned long write_batches;
+	unsigned long held;
+
+	/* kicks the queue once a held write is due */
+	struct timer_list hold_timer;
+	struct work_struct unplug_work;
+
+	/* Settings */
+	int write_hold;
+	int writes_starved;
+	unsigned int erase_sectors;	/* 0: from the queue limits */
+};
+
+/*
+ * Erase block size in sectors. The block driver sets its queue limits
+ * after the default elevator was attached, so they are looked up on use.
+ */
+static unsigned int flash_erase_sectors(struct flash_data *fd)
+{
+	unsigned int sectors = fd->erase_sectors;
+
+	if (!sectors)
+		sectors = queue_io_opt(fd->queue) >> 9;
+	if (!sectors)
+		sectors = erase_block_kb << 1;
+
+	return sectors ? sectors : 1;
+}
+
+static inline sector_t flash_block_start(struct flash_data *fd, sector_t pos)
+{
+	sector_t block = pos;
+
+	sector_div(block, flash_erase_sectors(fd));
+	return block * flash_erase_sectors(fd);
+}
+
+static inline struct rb_root *
+flash_rb_root(struct flash_data *fd, struct request *rq)
+{
+	return &fd->sort_list[rq_data_dir(rq)];
+}
+
+/*
+ * flash_block_first - lowest queued write at or after 'start'
+ */
+static struct request *
+flash_block_first(struct flash_data *fd, sector_t start)
+{
+	struct rb_node *n = fd->sort_list[WRITE].rb_node;
+	struct request *rq, *first = NULL;
+
+	while (n) {
+		rq = rb_entry_rq(n);
+		if (blk_rq_pos(rq) < start) {
+			n = n->rb_right;
+		} else {
+			first = rq;
+			n = n->rb_left;
+		}
+	}
+
+	return first;
+}
+
+/*
+ * flash_block_sectors - queued write sectors in the erase block at 'start'
+ */
+static unsigned int
+flash_block_sectors(struct flash_data *fd, sector_t start)
+{
+	sector_t end = start + flash_erase_sectors(fd);
+	struct request *rq = flash_block_first(fd, start);
+	unsigned int sectors = 0;
+
+	while (rq && blk_rq_pos(rq) < end) {
+		sectors += blk_rq_sectors(rq);
+		rq = elv_rb_latter_request(fd->queue, rq);
+	}
+
+	return sectors;
+}
+
+static void flash_add_rq_rb(struct flash_data *fd, struct request *rq)
+{
+	elv_rb_add(flash_rb_root(fd, rq), rq);
+}
+
+static void flash_del_rq_rb(struct flash_data *fd, struct request *rq)
+{
+	/* keep the batch going past a request that leaves the tree */
+	if (fd->next_write == rq) {
+		fd->next_write = elv_rb_latter_request(fd->queue, rq);
+		if (fd->next_write && blk_rq_pos(fd->next_write) >= fd->batch_end)
+			fd->next_write = NULL;
+	}
+
+	elv_rb_del(flash_rb_root(fd, rq), rq);
+}
+
+static void
+flash_add_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	flash_add_rq_rb(fd, rq);
+	elv_fifo_add(&fd->fifo, rq);
+
+	if (rq_data_dir(rq) == WRITE && !fd->block_ready) {
+		sector_t start = flash_block_start(fd, blk_rq_pos(rq));
+
+		if (flash_block_sectors(fd, start) >= flash_erase_sectors(fd)) {
+			fd->ready_block = start;
+			fd->block_ready = 1;
+		}
+	}
+}
+
+static int
+flash_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	sector_t sector = bio->bi_sector + bio_sectors(bio);
+	struct request *rq;
+
+	/* back merges are found through the elevator hash */
+	rq = elv_rb_find(&fd->sort_list[bio_data_dir(bio)], sector);
+	if (rq && elv_rq_merge_ok(rq, bio)) {
+		*req = rq;
+		return ELEVATOR_FRONT_MERGE;
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void
+flash_merged_request(struct request_queue *q, struct request *rq, int type)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/* a front merge moves the request in the tree */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(flash_rb_root(fd, rq), rq);
+		flash_add_rq_rb(fd, rq);
+	}
+	elv_fifo_merged(&fd->fifo);
+}
+
+static void
+flash_merged_requests(struct request_queue *q, struct request *rq,
+		      struct request *next)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * If next expires before rq, rq takes its expire time and
+	 * position in the fifo; next is deleted.
+	 */
+	elv_fifo_merged_requests(&fd->fifo, rq, next);
+	flash_del_rq_rb(fd, next);
+}
+
+static void
+flash_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	elv_fifo_completed(&fd->fifo, rq);
+}
+
+static int
+flash_queue_empty(struct request_queue *q)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	return elv_fifo_empty(&fd->fifo);
+}
+
+static void
+flash_dispatch_request(struct flash_data *fd, struct request *rq)
+{
+	flash_del_rq_rb(fd, rq);
+	elv_fifo_dispatch(&fd->fifo, rq);
+}
+
+static struct request *
+flash_choose_read(struct flash_data *fd)
+{
+	struct list_head *sync = &fd->fifo.fifo_list[SYNC][READ];
+	struct list_head *async = &fd->fifo.fifo_list[ASYNC][READ];
+
+	if (!list_empty(sync))
+		return rq_entry_fifo(sync->next);
+	if (!list_empty(async))
+		return rq_entry_fifo(async->next);
+
+	return NULL;
+}
+
+/*
+ * flash_choose_block - pick the erase block to write next and return
+ * its first request, or NULL if all writes may still wait. '*due' is
+ * set to the time the oldest held write has to go out.
+ */
+static struct request *
+flash_choose_block(struct flash_data *fd, int force, unsigned long *due)
+{
+	struct list_head *async = &fd->fifo.fifo_list[ASYNC][WRITE];
+	struct request *rq;
+	unsigned long queued;
+
+	rq = elv_fifo_expired(&fd->fifo, SYNC, WRITE);
+	if (!rq)
+		rq = elv_fifo_expired(&fd->fifo, ASYNC, WRITE);
+	if (!rq && !list_empty(&fd->fifo.fifo_list[SYNC][WRITE]))
+		rq = rq_entry_fifo(fd->fifo.fifo_list[SYNC][WRITE].next);
+	if (rq)
+		return flash_block_first(fd,
+				flash_block_start(fd, blk_rq_pos(rq)));
+
+	if (fd->block_ready) {
+		fd->block_ready = 0;
+		rq = flash_block_first(fd, fd->ready_block);
+		if (rq && blk_rq_pos(rq) <
+			  fd->ready_block + flash_erase_sectors(fd))
+			return rq;
+	}
+
+	if (list_empty(async))
+		return NULL;
+
+	/* the fifo time is the deadline, step back to the insert time */
+	rq = rq_entry_fifo(async->next);
+	queued = rq_fifo_time(rq) - fd->fifo.fifo_expire[ASYNC][WRITE];
+	*due = queued + fd->write_hold;
+	if (!force && time_before(jiffies, *due))
+		return NULL;
+
+	return flash_block_first(fd, flash_block_start(fd, blk_rq_pos(rq)));
+}
+
+static int
+flash_dispatch_requests(struct request_queue *q, int force)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	int writes = !RB_EMPTY_ROOT(&fd->sort_list[WRITE]);
+	unsigned long due = 0;
+	struct request *rq;
+
+	/* an expired sync read goes before anything else */
+	rq = elv_fifo_expired(&fd->fifo, SYNC, READ);
+	if (rq)
+		goto dispatch_read;
+
+	/* carry on with the erase block being written */
+	if (fd->next_write) {
+		rq = fd->next_write;
+		goto dispatch_write;
+	}
+
+	rq = flash_choose_read(fd);
+	if (rq && (!writes || fd->starved < fd->writes_starved))
+		goto dispatch_read;
+
+	if (writes) {
+		struct request *wrq = flash_choose_block(fd, force, &due);
+
+		if (wrq) {
+			fd->starved = 0;
+			fd->write_batches++;
+			fd->batch_end = flash_block_start(fd, blk_rq_pos(wrq)) +
+					flash_erase_sectors(fd);
+			rq = wrq;
+			goto dispatch_write;
+		}
+	}
+
+	if (rq)
+		goto dispatch_read;
+
+	/* only held writes left, come back when the first is due */
+	if (writes && due) {
+		if (!timer_pending(&fd->hold_timer) ||
+		    time_before(due, fd->hold_timer.expires)) {
+			mod_timer(&fd->hold_timer, due);
+			fd->held++;
+		}
+	}
+	return 0;
+
+dispatch_read:
+	if (writes)
+		fd->starved++;
+	flash_dispatch_request(fd, rq);
+	return 1;
+
+dispatch_write:
+	/* flash_del_rq_rb moves next_write along within the block */
+	fd->next_write = rq;
+	flash_dispatch_request(fd, rq);
+	return 1;
+}
+
+static void flash_kick_queue(struct work_struct *work)
+{
+	struct flash_data *fd =
+		container_of(work, struct flash_data, unplug_work);
+	struct request_queue *q = fd->queue;
+
+	spin_lock_irq(q->queue_lock);
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+static void flash_hold_timer(unsigned long data)
+{
+	struct flash_data *fd = (struct flash_data *) data;
+
+	kblockd_schedule_work(fd->queue, &fd->unplug_work);
+}
+
+static void *
+flash_init_queue(struct request_queue *q)
+{
+	const int expire[2][2] = {
+		[ASYNC] = { async_read_expire, async_write_expire },
+		[SYNC] = { sync_read_expire, sync_write_expire },
+	};
+	struct flash_data *fd;
+
+	fd = kmalloc_node(sizeof(*fd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!fd)
+		return NULL;
+
+	fd->queue = q;
+	elv_fifo_init(&fd->fifo, expire, 0);
+	fd->sort_list[READ] = RB_ROOT;
+	fd->sort_list[WRITE] = RB_ROOT;
+
+	init_timer(&fd->hold_timer);
+	fd->hold_timer.function = flash_hold_timer;
+	fd->hold_timer.data = (unsigned long) fd;
+	INIT_WORK(&fd->unplug_work, flash_kick_queue);
+
+	fd->write_hold = msecs_to_jiffies(write_hold);
+	fd->writes_starved = writes_starved;
+
+	return fd;
+}
+
+static void
+flash_exit_queue(struct elevator_queue *e)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	del_timer_sync(&fd->hold_timer);
+	cancel_work_sync(&fd->unplug_work);
+
+	BUG_ON(!RB_EMPTY_ROOT(&fd->sort_list[READ]));
+	BUG_ON(!RB_EMPTY_ROOT(&fd->sort_list[WRITE]));
+	elv_fifo_exit(&fd->fifo);
+
+	kfree(fd);
+}
+
+/*
+ * sysfs code
+ */
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return elv_fifo_var_show(__data, (page));			\
+}
+SHOW_FUNCTION(flash_sync_read_expire_show, fd->fifo.fifo_expire[SYNC][READ], 1);
+SHOW_FUNCTION(flash_sync_write_expire_show, fd->fifo.fifo_expire[SYNC][WRITE], 1);
+SHOW_FUNCTION(flash_async_read_expire_show, fd->fifo.fifo_expire[ASYNC][READ], 1);
+SHOW_FUNCTION(flash_async_write_expire_show, fd->fifo.fifo_expire[ASYNC][WRITE], 1);
+SHOW_FUNCTION(flash_write_hold_show, fd->write_hold, 1);
+SHOW_FUNCTION(flash_writes_starved_show, fd->writes_starved, 0);
+SHOW_FUNCTION(flash_erase_block_kb_show, flash_erase_sectors(fd) >> 1, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = elv_fifo_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(flash_sync_read_expire_store, &fd->fifo.fifo_expire[SYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_sync_write_expire_store, &fd->fifo.fifo_expire[SYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_async_read_expire_store, &fd->fifo.fifo_expire[ASYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_async_write_expire_store, &fd->fifo.fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_write_hold_store, &fd->write_hold, 0, INT_MAX, 1);
+STORE_FUNCTION(flash_writes_starved_store, &fd->writes_starved, 0, INT_MAX, 0);
+#undef STORE_FUNCTION
+
+/* 0 goes back to the size reported by the device */
+static ssize_t
+flash_erase_block_kb_store(struct elevator_queue *e, const char *page,
+			   size_t count)
+{
+	struct flash_data *fd = e->elevator_data;
+	int kb;
+	int ret = elv_fifo_var_store(&kb, page, count);
+
+	if (kb < 0)
+		kb = 0;
+	else if (kb > 64 * 1024)
+		kb = 64 * 1024;
+	fd->erase_sectors = kb << 1;
+	fd->block_ready = 0;
+	return ret;
+}
+
+static ssize_t flash_stats_show(struct elevator_queue *e, char *page)
+{
+	struct flash_data *fd = e->elevator_data;
+	ssize_t len = elv_fifo_stats_show(&fd->fifo, page);
+
+	len += sprintf(page + len, "write_batches %lu held %lu\n",
+		       fd->write_batches, fd->held);
+	return len;
+}
+
+static ssize_t
+flash_stats_store(struct elevator_queue *e, const char *page, size_t count)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	fd->write_batches = 0;
+	fd->held = 0;
+	return elv_fifo_stats_store(&fd->fifo, page, count);
+}
+
+#define DD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, flash_##name##_show, \
+				      flash_##name##_store)
+
+static struct elv_fs_entry flash_attrs[] = {
+	DD_ATTR(sync_read_expire),
+	DD_ATTR(sync_write_expire),
+	DD_ATTR(async_read_expire),
+	DD_ATTR(async_write_expire),
+	DD_ATTR(write_hold),
+	DD_ATTR(writes_starved),
+	DD_ATTR(erase_block_kb),
+	DD_ATTR(stats),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_flash = {
+	.ops = {
+		.elevator_merge_fn		= flash_merge,
+		.elevator_merged_fn		= flash_merged_request,
+		.elevator_merge_req_fn		= flash_merged_requests,
+		.elevator_dispatch_fn		= flash_dispatch_requests,
+		.elevator_add_req_fn		= flash_add_request,
+		.elevator_queue_empty_fn	= flash_queue_empty,
+		.elevator_completed_req_fn	= flash_completed_request,
+		.elevator_former_req_fn		= elv_rb_former_request,
+		.elevator_latter_req_fn		= elv_rb_latter_request,
+		.elevator_init_fn		= flash_init_queue,
+		.elevator_exit_fn		= flash_exit_queue,
+	},
+
+	.elevator_attrs = flash_attrs,
+	.elevator_name = "flash",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init flash_init(void)
+{
+	elv_register(&iosched_flash);
+
+	return 0;
+}
+
+static void __exit flash_exit(void)
+{
+	elv_unregister(&iosched_flash);
+}
+
+module_init(flash_init);
+module_exit(flash_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Erase block aware IO scheduler for flash");
@@ -17,34 +17,44 @@
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/init.h>
 #include <linux/slab.h>
 
+#include "elv-fifo.h"
+
 enum { ASYNC, SYNC };
 
-/* Tunables */
-static const int sync_read_expire = HZ / 2;	/* max time before a sync read is submitted. */
-static const int sync_write_expire = 2 * HZ;	/* max time before a sync write is submitted. */
+/*
+ * Defaults for new queues, in ms; each queue can be tuned further
+ * through its iosched directory in sysfs.
+ */
+static int sync_read_expire = 500;	/* max time before a sync read is submitted. */
+static int sync_write_expire = 2000;	/* max time before a sync write is submitted. */
+
+static int async_read_expire = 4000;	/* ditto for async, these limits are SOFT! */
+static int async_write_expire = 16000;	/* ditto for async, these limits are SOFT! */
 
-static const int async_read_expire = 4 * HZ;	/* ditto for async, these limits are SOFT! */
-static const int async_write_expire = 16 * HZ;	/* ditto for async, these limits are SOFT! */
+static int writes_starved = 2;		/* max times reads can starve a write */
+static int fifo_batch = 4;		/* # of sequential requests treated as one
+					   by the above parameters. For throughput. */
 
-static const int writes_starved = 2;		/* max times reads can starve a write */
-static const int fifo_batch = 4;		/* # of sequential requests treated as one
-						   by the above parameters. For throughput. */
+module_param(sync_read_expire, int, 0644);
+module_param(sync_write_expire, int, 0644);
+module_param(async_read_expire, int, 0644);
+module_param(async_write_expire, int, 0644);
+module_param(writes_starved, int, 0644);
+module_param(fifo_batch, int, 0644);
 
 /* Elevator data */
 struct sio_data {
-	/* Request queues */
-	struct list_head fifo_list[2][2];
+	/* Request queues, expirations and batching */
+	struct elv_fifo fifo;
 
 	/* Attributes */
-	unsigned int batched;
 	unsigned int starved;
 
 	/* Settings */
-	int fifo_expire[2][2];
-	int fifo_batch;
 	int writes_starved;
 };
 
@@ -52,63 +62,50 @@ static void
 sio_merged_requests(struct request_queue *q, struct request *rq,
 		    struct request *next)
 {
+	struct sio_data *sd = q->elevator->elevator_data;
+
 	/*
-	 * If next expires before rq, assign its expire time to rq
-	 * and move into next position (next will be deleted) in fifo.
+	 * If next expires before rq, rq takes its expire time and
+	 * position in the fifo; next is deleted.
 	 */
-	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
-		if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
-			list_move(&rq->queuelist, &next->queuelist);
-			rq_set_fifo_time(rq, rq_fifo_time(next));
-		}
-	}
+	elv_fifo_merged_requests(&sd->fifo, rq, next);
+}
 
-	/* Delete next request */
-	rq_fifo_clear(next);
+static void
+sio_merged_request(struct request_queue *q, struct request *rq, int type)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+
+	elv_fifo_merged(&sd->fifo);
 }
 
 static void
 sio_add_request(struct request_queue *q, struct request *rq)
 {
 	struct sio_data *sd = q->elevator->elevator_data;
-	const int sync = rq_is_sync(rq);
-	const int data_dir = rq_data_dir(rq);
 
 	/*
 	 * Add request to the proper fifo list and set its
 	 * expire time.
 	 */
-	rq_set_fifo_time(rq, jiffies + sd->fifo_expire[sync][data_dir]);
-	list_add_tail(&rq->queuelist, &sd->fifo_list[sync][data_dir]);
+	elv_fifo_add(&sd->fifo, rq);
 }
 
-static int
-sio_queue_empty(struct request_queue *q)
+static void
+sio_completed_request(struct request_queue *q, struct request *rq)
 {
 	struct sio_data *sd = q->elevator->elevator_data;
 
-	/* Check if fifo lists are empty */
-	return list_empty(&sd->fifo_list[SYNC][READ]) && list_empty(&sd->fifo_list[SYNC][WRITE]) &&
-	       list_empty(&sd->fifo_list[ASYNC][READ]) && list_empty(&sd->fifo_list[ASYNC][WRITE]);
+	elv_fifo_completed(&sd->fifo, rq);
 }
 
-static struct request *
-sio_expired_request(struct sio_data *sd, int sync, int data_dir)
+static int
+sio_queue_empty(struct request_queue *q)
 {
-	struct list_head *list = &sd->fifo_list[sync][data_dir];
-	struct request *rq;
-
-	if (list_empty(list))
-		return NULL;
-
-	/* Retrieve request */
-	rq = rq_entry_fifo(list->next);
-
-	/* Request has expired */
-	if (time_after(jiffies, rq_fifo_time(rq)))
-		return rq;
+	struct sio_data *sd = q->elevator->elevator_data;
 
-	return NULL;
+	/* Check if fifo lists are empty */
+	return elv_fifo_empty(&sd->fifo);
 }
 
 static struct request *
@@ -121,17 +118,17 @@ sio_choose_expired_request(struct sio_data *sd)
 	 * Asynchronous requests have priority over synchronous.
 	 * Write requests have priority over read.
 	 */
-	rq = sio_expired_request(sd, ASYNC, WRITE);
+	rq = elv_fifo_expired(&sd->fifo, ASYNC, WRITE);
 	if (rq)
 		return rq;
-	rq = sio_expired_request(sd, ASYNC, READ);
+	rq = elv_fifo_expired(&sd->fifo, ASYNC, READ);
 	if (rq)
 		return rq;
 
-	rq = sio_expired_request(sd, SYNC, WRITE);
+	rq = elv_fifo_expired(&sd->fifo, SYNC, WRITE);
 	if (rq)
 		return rq;
-	rq = sio_expired_request(sd, SYNC, READ);
+	rq = elv_fifo_expired(&sd->fifo, SYNC, READ);
 	if (rq)
 		return rq;
 
@@ -142,8 +139,8 @@ sio_choose_expired_request(struct sio_data *sd)
 static struct request *
 sio_choose_request(struct sio_data *sd, int data_dir)
 {
-	struct list_head *sync = sd->fifo_list[SYNC];
-	struct list_head *async = sd->fifo_list[ASYNC];
+	struct list_head *sync = sd->fifo.fifo_list[SYNC];
+	struct list_head *async = sd->fifo.fifo_list[ASYNC];
 
 	/*
 	 * Retrieve request from available fifo list.
@@ -166,20 +163,16 @@ sio_choose_request(struct sio_data *sd, int data_dir)
 static inline void
 sio_dispatch_request(struct sio_data *sd, struct request *rq)
 {
+	if (rq_data_dir(rq))
+		sd->starved = 0;
+	else
+		sd->starved++;
 
 	/*
 	 * Remove the request from the fifo list
 	 * and dispatch it.
 	 */
-	rq_fifo_clear(rq);
-	elv_dispatch_add_tail(rq->q, rq);
-
-	sd->batched++;
-
-	if (rq_data_dir(rq))
-		sd->starved = 0;
-	else
-		sd->starved++;
+	elv_fifo_dispatch(&sd->fifo, rq);
 }
 
 static int
@@ -193,10 +186,8 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	 * Retrieve any expired request after a batch of
 	 * sequential requests.
 	 */
-	if (sd->batched > sd->fifo_batch) {
-		sd->batched = 0;
+	if (elv_fifo_batch_done(&sd->fifo))
 		rq = sio_choose_expired_request(sd);
-	}
 
 	/* Retrieve request */
 	if (!rq) {
@@ -221,7 +212,7 @@ sio_former_request(struct request_queue *q, struct request *rq)
 	const int sync = rq_is_sync(rq);
 	const int data_dir = rq_data_dir(rq);
 
-	if (rq->queuelist.prev == &sd->fifo_list[sync][data_dir])
+	if (rq->queuelist.prev == &sd->fifo.fifo_list[sync][data_dir])
 		return NULL;
 
 	/* Return former request */
@@ -235,7 +226,7 @@ sio_latter_request(struct request_queue *q, struct request *rq)
 	const int sync = rq_is_sync(rq);
 	const int data_dir = rq_data_dir(rq);
 
-	if (rq->queuelist.next == &sd->fifo_list[sync][data_dir])
+	if (rq->queuelist.next == &sd->fifo.fifo_list[sync][data_dir])
 		return NULL;
 
 	/* Return latter request */
@@ -245,6 +236,10 @@ sio_latter_request(struct request_queue *q, struct request *rq)
 static void *
 sio_init_queue(struct request_queue *q)
 {
+	const int expire[2][2] = {
+		[ASYNC] = { async_read_expire, async_write_expire },
+		[SYNC] = { sync_read_expire, sync_write_expire },
+	};
 	struct sio_data *sd;
 
 	/* Allocate structure */
@@ -252,19 +247,10 @@ sio_init_queue(struct request_queue *q)
 	if (!sd)
 		return NULL;
 
-	/* Initialize fifo lists */
-	INIT_LIST_HEAD(&sd->fifo_list[SYNC][READ]);
-	INIT_LIST_HEAD(&sd->fifo_list[SYNC][WRITE]);
-	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][READ]);
-	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][WRITE]);
-
-	/* Initialize data */
-	sd->batched = 0;
-	sd->fifo_expire[SYNC][READ] = sync_read_expire;
-	sd->fifo_expire[SYNC][WRITE] = sync_write_expire;
-	sd->fifo_expire[ASYNC][READ] = async_read_expire;
-	sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
-	sd->fifo_batch = fifo_batch;
+	/* Initialize fifo lists and data */
+	elv_fifo_init(&sd->fifo, expire, fifo_batch);
+	sd->starved = 0;
+	sd->writes_starved = writes_starved;
 
 	return sd;
 }
@@ -274,10 +260,7 @@ sio_exit_queue(struct elevator_queue *e)
 {
 	struct sio_data *sd = e->elevator_data;
 
-	BUG_ON(!list_empty(&sd->fifo_list[SYNC][READ]));
-	BUG_ON(!list_empty(&sd->fifo_list[SYNC][WRITE]));
-	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][READ]));
-	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][WRITE]));
+	elv_fifo_exit(&sd->fifo);
 
 	/* Free structure */
 	kfree(sd);
@@ -287,21 +270,6 @@ sio_exit_queue(struct elevator_queue *e)
  * sysfs code
  */
 
-static ssize_t
-sio_var_show(int var, char *page)
-{
-	return sprintf(page, "%d\n", var);
-}
-
-static ssize_t
-sio_var_store(int *var, const char *page, size_t count)
-{
-	char *p = (char *) page;
-
-	*var = simple_strtol(p, &p, 10);
-	return count;
-}
-
 #define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
 static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
 {									\
@@ -309,13 +277,13 @@ static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
 	int __data = __VAR;						\
 	if (__CONV)							\
 		__data = jiffies_to_msecs(__data);			\
-	return sio_var_show(__data, (page));			\
+	return elv_fifo_var_show(__data, (page));			\
 }
-SHOW_FUNCTION(sio_sync_read_expire_show, sd->fifo_expire[SYNC][READ], 1);
-SHOW_FUNCTION(sio_sync_write_expire_show, sd->fifo_expire[SYNC][WRITE], 1);
-SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo_expire[ASYNC][READ], 1);
-SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo_expire[ASYNC][WRITE], 1);
-SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo_batch, 0);
+SHOW_FUNCTION(sio_sync_read_expire_show, sd->fifo.fifo_expire[SYNC][READ], 1);
+SHOW_FUNCTION(sio_sync_write_expire_show, sd->fifo.fifo_expire[SYNC][WRITE], 1);
+SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo.fifo_expire[ASYNC][READ], 1);
+SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo.fifo_expire[ASYNC][WRITE], 1);
+SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo.fifo_batch, 0);
 SHOW_FUNCTION(sio_writes_starved_show, sd->writes_starved, 0);
 #undef SHOW_FUNCTION
 
@@ -324,7 +292,7 @@ static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)
 {									\
 	struct sio_data *sd = e->elevator_data;			\
 	int __data;							\
-	int ret = sio_var_store(&__data, (page), count);		\
+	int ret = elv_fifo_var_store(&__data, (page), count);		\
 	if (__data < (MIN))						\
 		__data = (MIN);						\
 	else if (__data > (MAX))					\
@@ -335,14 +303,29 @@ static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)
 		*(__PTR) = __data;					\
 	return ret;							\
 }
-STORE_FUNCTION(sio_sync_read_expire_store, &sd->fifo_expire[SYNC][READ], 0, INT_MAX, 1);
-STORE_FUNCTION(sio_sync_write_expire_store, &sd->fifo_expire[SYNC][WRITE], 0, INT_MAX, 1);
-STORE_FUNCTION(sio_async_read_expire_store, &sd->fifo_expire[ASYNC][READ], 0, INT_MAX, 1);
-STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
-STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(sio_sync_read_expire_store, &sd->fifo.fifo_expire[SYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(sio_sync_write_expire_store, &sd->fifo.fifo_expire[SYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(sio_async_read_expire_store, &sd->fifo.fifo_expire[ASYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo.fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo.fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(sio_writes_starved_store, &sd->writes_starved, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+static ssize_t sio_stats_show(struct elevator_queue *e, char *page)
+{
+	struct sio_data *sd = e->elevator_data;
+
+	return elv_fifo_stats_show(&sd->fifo, page);
+}
+
+static ssize_t
+sio_stats_store(struct elevator_queue *e, const char *page, size_t count)
+{
+	struct sio_data *sd = e->elevator_data;
+
+	return elv_fifo_stats_store(&sd->fifo, page, count);
+}
+
 #define DD_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, sio_##name##_show, \
 				      sio_##name##_store)
@@ -354,15 +337,18 @@ static struct elv_fs_entry sio_attrs[] = {
 	DD_ATTR(async_write_expire),
 	DD_ATTR(fifo_batch),
 	DD_ATTR(writes_starved),
+	DD_ATTR(stats),
 	__ATTR_NULL
 };
 
 static struct elevator_type iosched_sio = {
 	.ops = {
+		.elevator_merged_fn		= sio_merged_request,
 		.elevator_merge_req_fn		= sio_merged_requests,
 		.elevator_dispatch_fn		= sio_dispatch_requests,
 		.elevator_add_req_fn		= sio_add_request,
 		.elevator_queue_empty_fn	= sio_queue_empty,
+		.elevator_completed_req_fn	= sio_completed_request,
 		.elevator_former_req_fn		= sio_former_request,
 		.elevator_latter_req_fn		= sio_latter_request,
 		.elevator_init_fn		= sio_init_queue,
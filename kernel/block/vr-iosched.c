@@ -22,6 +22,7 @@
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/compiler.h>
@@ -29,6 +30,8 @@
 
 #include <asm/div64.h>
 
+#include "elv-fifo.h"
+
 enum vr_data_dir {
 ASYNC,
 SYNC,
@@ -39,25 +42,28 @@ FORWARD,
 BACKWARD,
 };
 
-static const int sync_expire = HZ / 2; /* max time before a sync is submitted. */
-static const int async_expire = 5 * HZ; /* ditto for async, these limits are SOFT! */
-static const int fifo_batch = 4;
-static const int rev_penalty = 1; /* penalty for reversing head direction */
+/* defaults for new queues, expirations in ms */
+static int sync_expire = 500; /* max time before a sync is submitted. */
+static int async_expire = 5000; /* ditto for async, these limits are SOFT! */
+static int fifo_batch = 4;
+static int rev_penalty = 1; /* penalty for reversing head direction */
+
+module_param(sync_expire, int, 0644);
+module_param(async_expire, int, 0644);
+module_param(fifo_batch, int, 0644);
+module_param(rev_penalty, int, 0644);
 
 struct vr_data {
 struct rb_root sort_list;
-struct list_head fifo_list[2];
+struct elv_fifo fifo; /* deadlines, batching and statistics */
 
 struct request *next_rq;
 struct request *prev_rq;
 
-unsigned int nbatched;
 sector_t last_sector; /* head position */
 int head_dir;
 
 /* tunables */
-int fifo_expire[2];
-int fifo_batch;
 int rev_penalty;
 };
 
@@ -119,26 +125,9 @@ static void
 vr_add_request(struct request_queue *q, struct request *rq)
 {
 struct vr_data *vd = vr_get_data(q);
-const int dir = rq_is_sync(rq);
 
 vr_add_rq_rb(vd, rq);
-
-if (vd->fifo_expire[dir]) {
-rq_set_fifo_time(rq, jiffies + vd->fifo_expire[dir]);
-list_add_tail(&rq->queuelist, &vd->fifo_list[dir]);
-}
-}
-
-/*
-* remove rq from rbtree and fifo.
-*/
-static void
-vr_remove_request(struct request_queue *q, struct request *rq)
-{
-struct vr_data *vd = vr_get_data(q);
-
-rq_fifo_clear(rq);
-vr_del_rq_rb(vd, rq);
+elv_fifo_add(&vd->fifo, rq);
 }
 
 static int
@@ -167,24 +156,21 @@ if (type == ELEVATOR_FRONT_MERGE) {
 vr_del_rq_rb(vd, req);
 vr_add_rq_rb(vd, req);
 }
+elv_fifo_merged(&vd->fifo);
 }
 
 static void
 vr_merged_requests(struct request_queue *q, struct request *rq,
 struct request *next)
 {
+struct vr_data *vd = vr_get_data(q);
+
 /*
 * if next expires before rq, assign its expire time to rq
 * and move into next position (next will be deleted) in fifo
 */
-if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
-if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
-list_move(&rq->queuelist, &next->queuelist);
-rq_set_fifo_time(rq, rq_fifo_time(next));
-}
-}
-
-vr_remove_request(q, next);
+elv_fifo_merged_requests(&vd->fifo, rq, next);
+vr_del_rq_rb(vd, next);
 }
 
 /*
@@ -193,8 +179,6 @@ vr_remove_request(q, next);
 static void
 vr_move_request(struct vr_data *vd, struct request *rq)
 {
-struct request_queue *q = rq->q;
-
 if (blk_rq_pos(rq) > vd->last_sector)
 vd->head_dir = FORWARD;
 else
@@ -206,46 +190,8 @@ vd->prev_rq = elv_rb_former_request(NULL, rq);
 
 BUG_ON(vd->next_rq && vd->next_rq == vd->prev_rq);
 
-vr_remove_request(q, rq);
-elv_dispatch_add_tail(q, rq);
-vd->nbatched++;
-}
-
-/*
-* get the first expired request in direction ddir
-*/
-static struct request *
-vr_expired_request(struct vr_data *vd, int ddir)
-{
-struct request *rq;
-
-if (list_empty(&vd->fifo_list[ddir]))
-return NULL;
-
-rq = rq_entry_fifo(vd->fifo_list[ddir].next);
-if (time_after(jiffies, rq_fifo_time(rq)))
-return rq;
-
-return NULL;
-}
-
-/*
-* Returns the oldest expired request
-*/
-static struct request *
-vr_check_fifo(struct vr_data *vd)
-{
-struct request *rq_sync = vr_expired_request(vd, SYNC);
-struct request *rq_async = vr_expired_request(vd, ASYNC);
-
-if (rq_async && rq_sync) {
-if (time_after(rq_fifo_time(rq_async), rq_fifo_time(rq_sync)))
-return rq_sync;
-}
-else if (rq_sync)
-return rq_sync;
-
-return rq_async;
+vr_del_rq_rb(vd, rq);
+elv_fifo_dispatch(&vd->fifo, rq);
 }
 
 /*
@@ -289,10 +235,8 @@ struct vr_data *vd = vr_get_data(q);
 struct request *rq = NULL;
 
 /* Check for and issue expired requests */
-if (vd->nbatched > vd->fifo_batch) {
-vd->nbatched = 0;
-rq = vr_check_fifo(vd);
-}
+if (elv_fifo_batch_done(&vd->fifo))
+rq = elv_fifo_oldest_expired(&vd->fifo);
 
 if (!rq) {
 rq = vr_choose_request(vd);
@@ -312,11 +256,18 @@ struct vr_data *vd = vr_get_data(q);
 return RB_EMPTY_ROOT(&vd->sort_list);
 }
 
+static void
+vr_completed_request(struct request_queue *q, struct request *rq)
+{
+elv_fifo_completed(&vr_get_data(q)->fifo, rq);
+}
+
 static void
 vr_exit_queue(struct elevator_queue *e)
 {
 struct vr_data *vd = e->elevator_data;
 BUG_ON(!RB_EMPTY_ROOT(&vd->sort_list));
+elv_fifo_exit(&vd->fifo);
 kfree(vd);
 }
 
@@ -325,18 +276,18 @@ kfree(vd);
 */
 static void *vr_init_queue(struct request_queue *q)
 {
+const int expire[2][2] = {
+[ASYNC] = { async_expire, async_expire },
+[SYNC] = { sync_expire, sync_expire },
+};
 struct vr_data *vd;
 
 vd = kmalloc_node(sizeof(*vd), GFP_KERNEL | __GFP_ZERO, q->node);
 if (!vd)
 return NULL;
 
-INIT_LIST_HEAD(&vd->fifo_list[SYNC]);
-INIT_LIST_HEAD(&vd->fifo_list[ASYNC]);
+elv_fifo_init(&vd->fifo, expire, fifo_batch);
 vd->sort_list = RB_ROOT;
-vd->fifo_expire[SYNC] = sync_expire;
-vd->fifo_expire[ASYNC] = async_expire;
-vd->fifo_batch = fifo_batch;
 vd->rev_penalty = rev_penalty;
 return vd;
 }
@@ -345,19 +296,6 @@ return vd;
 * sysfs parts below
 */
 
-static ssize_t
-vr_var_show(int var, char *page)
-{
-return sprintf(page, "%d\n", var);
-}
-
-static ssize_t
-vr_var_store(int *var, const char *page, size_t count)
-{
-*var = simple_strtol(page, NULL, 10);
-return count;
-}
-
 #define SHOW_FUNCTION(__FUNC, __VAR, __CONV) \
 static ssize_t __FUNC(struct elevator_queue *e, char *page) \
 { \
@@ -365,11 +303,11 @@ struct vr_data *vd = e->elevator_data; \
 int __data = __VAR; \
 if (__CONV) \
 __data = jiffies_to_msecs(__data); \
-return vr_var_show(__data, (page)); \
+return elv_fifo_var_show(__data, (page)); \
 }
-SHOW_FUNCTION(vr_sync_expire_show, vd->fifo_expire[SYNC], 1);
-SHOW_FUNCTION(vr_async_expire_show, vd->fifo_expire[ASYNC], 1);
-SHOW_FUNCTION(vr_fifo_batch_show, vd->fifo_batch, 0);
+SHOW_FUNCTION(vr_sync_expire_show, vd->fifo.fifo_expire[SYNC][READ], 1);
+SHOW_FUNCTION(vr_async_expire_show, vd->fifo.fifo_expire[ASYNC][READ], 1);
+SHOW_FUNCTION(vr_fifo_batch_show, vd->fifo.fifo_batch, 0);
 SHOW_FUNCTION(vr_rev_penalty_show, vd->rev_penalty, 0);
 #undef SHOW_FUNCTION
 
@@ -378,7 +316,7 @@ static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)
 { \
 struct vr_data *vd = e->elevator_data; \
 int __data; \
-int ret = vr_var_store(&__data, (page), count); \
+int ret = elv_fifo_var_store(&__data, (page), count); \
 if (__data < (MIN)) \
 __data = (MIN); \
 else if (__data > (MAX)) \
@@ -389,12 +327,42 @@ else \
 *(__PTR) = __data; \
 return ret; \
 }
-STORE_FUNCTION(vr_sync_expire_store, &vd->fifo_expire[SYNC], 0, INT_MAX, 1);
-STORE_FUNCTION(vr_async_expire_store, &vd->fifo_expire[ASYNC], 0, INT_MAX, 1);
-STORE_FUNCTION(vr_fifo_batch_store, &vd->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(vr_fifo_batch_store, &vd->fifo.fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(vr_rev_penalty_store, &vd->rev_penalty, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+/* reads and writes of a sync class share one expiry */
+#define EXPIRE_STORE_FUNCTION(__FUNC, __SYNC) \
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count) \
+{ \
+struct vr_data *vd = e->elevator_data; \
+int __data; \
+int ret = elv_fifo_var_store(&__data, (page), count); \
+if (__data < 0) \
+__data = 0; \
+__data = msecs_to_jiffies(__data); \
+vd->fifo.fifo_expire[__SYNC][READ] = __data; \
+vd->fifo.fifo_expire[__SYNC][WRITE] = __data; \
+return ret; \
+}
+EXPIRE_STORE_FUNCTION(vr_sync_expire_store, SYNC);
+EXPIRE_STORE_FUNCTION(vr_async_expire_store, ASYNC);
+#undef EXPIRE_STORE_FUNCTION
+
+static ssize_t
+vr_stats_show(struct elevator_queue *e, char *page)
+{
+struct vr_data *vd = e->elevator_data;
+return elv_fifo_stats_show(&vd->fifo, page);
+}
+
+static ssize_t
+vr_stats_store(struct elevator_queue *e, const char *page, size_t count)
+{
+struct vr_data *vd = e->elevator_data;
+return elv_fifo_stats_store(&vd->fifo, page, count);
+}
+
 #define DD_ATTR(name) \
 __ATTR(name, S_IRUGO|S_IWUSR, vr_##name##_show, \
 vr_##name##_store)
@@ -404,6 +372,7 @@ DD_ATTR(sync_expire),
 DD_ATTR(async_expire),
 DD_ATTR(fifo_batch),
 DD_ATTR(rev_penalty),
+DD_ATTR(stats),
 __ATTR_NULL
 };
 
@@ -415,6 +384,7 @@ static struct elevator_type iosched_vr = {
 .elevator_dispatch_fn = vr_dispatch_requests,
 .elevator_add_req_fn = vr_add_request,
 .elevator_queue_empty_fn = vr_queue_empty,
+.elevator_completed_req_fn = vr_completed_request,
 .elevator_former_req_fn = elv_rb_former_request,
 .elevator_latter_req_fn = elv_rb_latter_request,
 .elevator_init_fn = vr_init_queue,
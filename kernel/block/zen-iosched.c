@@ -11,25 +11,27 @@
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/slab.h>
 #include <linux/init.h>
 
+#include "elv-fifo.h"
+
 enum zen_data_dir { ASYNC, SYNC };
 
-static const int sync_expire  = HZ / 4;    /* max time before a sync is submitted. */
-static const int async_expire = 2 * HZ;    /* ditto for async, these limits are SOFT! */
-static const int fifo_batch = 1;
+/* defaults for new queues, in ms */
+static int sync_expire  = 250;    /* max time before a sync is submitted. */
+static int async_expire = 2000;   /* ditto for async, these limits are SOFT! */
+static int fifo_batch = 1;
+
+module_param(sync_expire, int, 0644);
+module_param(async_expire, int, 0644);
+module_param(fifo_batch, int, 0644);
 
 struct zen_data {
 	/* Runtime Data */
-	/* Requests are only present on fifo_list */
-	struct list_head fifo_list[2];
-
-        unsigned int batching;          /* number of sequential requests made */
-
-	/* tunables */
-	int fifo_expire[2];
-	int fifo_batch;
+	/* Requests are only present on the fifo lists */
+	struct elv_fifo fifo;
 };
 
 static inline struct zen_data *
@@ -37,8 +39,6 @@ zen_get_data(struct request_queue *q) {
 	return q->elevator->elevator_data;
 }
 
-static void zen_dispatch(struct zen_data *, struct request *);
-
 static void
 zen_merged_requests(struct request_queue *q, struct request *req,
                     struct request *next)
@@ -47,91 +47,44 @@ zen_merged_requests(struct request_queue *q, struct request *req,
 	 * if next expires before rq, assign its expire time to arq
 	 * and move into next position (next will be deleted) in fifo
 	 */
-	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
-		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
-			list_move(&req->queuelist, &next->queuelist);
-			rq_set_fifo_time(req, rq_fifo_time(next));
-		}
-	}
-
-	/* next request is gone */
-	rq_fifo_clear(next);
+	elv_fifo_merged_requests(&zen_get_data(q)->fifo, req, next);
 }
 
-static void zen_add_request(struct request_queue *q, struct request *rq)
+static void
+zen_merged_request(struct request_queue *q, struct request *req, int type)
 {
-	struct zen_data *zdata = zen_get_data(q);
-	const int dir = rq_data_dir(rq);
-
-	if (zdata->fifo_expire[dir]) {
-		rq_set_fifo_time(rq, jiffies + zdata->fifo_expire[dir]);
-		list_add_tail(&rq->queuelist, &zdata->fifo_list[dir]);
-	}
+	elv_fifo_merged(&zen_get_data(q)->fifo);
 }
 
-static void zen_dispatch(struct zen_data *zdata, struct request *rq)
+static void zen_add_request(struct request_queue *q, struct request *rq)
 {
-	/* Remove request from list and dispatch it */
-	rq_fifo_clear(rq);
-	elv_dispatch_add_tail(rq->q, rq);
-
-	/* Increment # of sequential requests */
-	zdata->batching++;
+	elv_fifo_add(&zen_get_data(q)->fifo, rq);
 }
 
-/*
- * get the first expired request in direction ddir
- */
-static struct request *
-zen_expired_request(struct zen_data *zdata, int ddir)
+static void zen_completed_request(struct request_queue *q, struct request *rq)
 {
-        struct request *rq;
-
-        if (list_empty(&zdata->fifo_list[ddir]))
-                return NULL;
-
-        rq = rq_entry_fifo(zdata->fifo_list[ddir].next);
-        if (time_after(jiffies, rq_fifo_time(rq)))
-                return rq;
-
-        return NULL;
+	elv_fifo_completed(&zen_get_data(q)->fifo, rq);
 }
 
-/*
- * zen_check_fifo returns 0 if there are no expired requests on the fifo,
- * otherwise it returns the next expired request
- */
-static struct request *
-zen_check_fifo(struct zen_data *zdata)
+static int zen_queue_empty(struct request_queue *q)
 {
-        struct request *rq_sync = zen_expired_request(zdata, SYNC);
-        struct request *rq_async = zen_expired_request(zdata, ASYNC);
-
-        if (rq_async && rq_sync) {
-        	if (time_after(rq_fifo_time(rq_async), rq_fifo_time(rq_sync)))
-                	return rq_sync;
-        } else if (rq_sync) {
-                return rq_sync;
-	} else if (rq_async) {
-		return rq_async;
-	}
-
-        return 0;
+	return elv_fifo_empty(&zen_get_data(q)->fifo);
 }
 
 static struct request *
 zen_choose_request(struct zen_data *zdata)
 {
+        struct request *rq;
+
         /*
          * Retrieve request from available fifo list.
          * Synchronous requests have priority over asynchronous.
          */
-        if (!list_empty(&zdata->fifo_list[SYNC]))
-                return rq_entry_fifo(zdata->fifo_list[SYNC].next);
-        if (!list_empty(&zdata->fifo_list[ASYNC]))
-                return rq_entry_fifo(zdata->fifo_list[ASYNC].next);
+        rq = elv_fifo_oldest(&zdata->fifo, SYNC);
+        if (rq)
+                return rq;
 
-        return NULL;
+        return elv_fifo_oldest(&zdata->fifo, ASYNC);
 }
 
 static int zen_dispatch_requests(struct request_queue *q, int force)
@@ -140,10 +93,8 @@ static int zen_dispatch_requests(struct request_queue *q, int force)
 	struct request *rq = NULL;
 
 	/* Check for and issue expired requests */
-	if (zdata->batching > zdata->fifo_batch) {
-		zdata->batching = 0;
-		rq = zen_check_fifo(zdata);
-	}
+	if (elv_fifo_batch_done(&zdata->fifo))
+		rq = elv_fifo_oldest_expired(&zdata->fifo);
 
 	if (!rq) {
 		rq = zen_choose_request(zdata);
@@ -151,23 +102,24 @@ static int zen_dispatch_requests(struct request_queue *q, int force)
 			return 0;
 	}
 
-	zen_dispatch(zdata, rq);
+	/* Remove request from list and dispatch it */
+	elv_fifo_dispatch(&zdata->fifo, rq);
 
 	return 1;
 }
 
 static void *zen_init_queue(struct request_queue *q)
 {
+	const int expire[2][2] = {
+		[ASYNC] = { async_expire, async_expire },
+		[SYNC] = { sync_expire, sync_expire },
+	};
 	struct zen_data *zdata;
 
 	zdata = kmalloc_node(sizeof(*zdata), GFP_KERNEL, q->node);
 	if (!zdata)
 		return NULL;
-	INIT_LIST_HEAD(&zdata->fifo_list[SYNC]);
-	INIT_LIST_HEAD(&zdata->fifo_list[ASYNC]);
-	zdata->fifo_expire[SYNC] = sync_expire;
-	zdata->fifo_expire[ASYNC] = async_expire;
-	zdata->fifo_batch = fifo_batch;
+	elv_fifo_init(&zdata->fifo, expire, fifo_batch);
 	return zdata;
 }
 
@@ -175,24 +127,11 @@ static void zen_exit_queue(struct elevator_queue *e)
 {
 	struct zen_data *zdata = e->elevator_data;
 
-	BUG_ON(!list_empty(&zdata->fifo_list[SYNC]));
-	BUG_ON(!list_empty(&zdata->fifo_list[ASYNC]));
+	elv_fifo_exit(&zdata->fifo);
 	kfree(zdata);
 }
 
 /* Sysfs */
-static ssize_t
-zen_var_show(int var, char *page)
-{
-	return sprintf(page, "%d\n", var);
-}
-
-static ssize_t
-zen_var_store(int *var, const char *page, size_t count)
-{
-	*var = simple_strtol(page, NULL, 10);
-	return count;
-}
 
 #define SHOW_FUNCTION(__FUNC, __VAR, __CONV) \
 static ssize_t __FUNC(struct elevator_queue *e, char *page) \
@@ -201,11 +140,11 @@ static ssize_t __FUNC(struct elevator_queue *e, char *page) \
 	int __data = __VAR; \
 	if (__CONV) \
 		__data = jiffies_to_msecs(__data); \
-		return zen_var_show(__data, (page)); \
+	return elv_fifo_var_show(__data, (page)); \
 }
-SHOW_FUNCTION(zen_sync_expire_show, zdata->fifo_expire[SYNC], 1);
-SHOW_FUNCTION(zen_async_expire_show, zdata->fifo_expire[ASYNC], 1);
-SHOW_FUNCTION(zen_fifo_batch_show, zdata->fifo_batch, 0);
+SHOW_FUNCTION(zen_sync_expire_show, zdata->fifo.fifo_expire[SYNC][READ], 1);
+SHOW_FUNCTION(zen_async_expire_show, zdata->fifo.fifo_expire[ASYNC][READ], 1);
+SHOW_FUNCTION(zen_fifo_batch_show, zdata->fifo.fifo_batch, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV) \
@@ -213,7 +152,7 @@ static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)
 { \
 	struct zen_data *zdata = e->elevator_data; \
 	int __data; \
-	int ret = zen_var_store(&__data, (page), count); \
+	int ret = elv_fifo_var_store(&__data, (page), count); \
 	if (__data < (MIN)) \
 		__data = (MIN); \
 	else if (__data > (MAX)) \
@@ -224,11 +163,42 @@ static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)
 		*(__PTR) = __data; \
 	return ret; \
 }
-STORE_FUNCTION(zen_sync_expire_store, &zdata->fifo_expire[SYNC], 0, INT_MAX, 1);
-STORE_FUNCTION(zen_async_expire_store, &zdata->fifo_expire[ASYNC], 0, INT_MAX, 1);
-STORE_FUNCTION(zen_fifo_batch_store, &zdata->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(zen_fifo_batch_store, &zdata->fifo.fifo_batch, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+/* reads and writes of a sync class share one expiry */
+#define EXPIRE_STORE_FUNCTION(__FUNC, __SYNC) \
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count) \
+{ \
+	struct zen_data *zdata = e->elevator_data; \
+	int __data; \
+	int ret = elv_fifo_var_store(&__data, (page), count); \
+	if (__data < 0) \
+		__data = 0; \
+	__data = msecs_to_jiffies(__data); \
+	zdata->fifo.fifo_expire[__SYNC][READ] = __data; \
+	zdata->fifo.fifo_expire[__SYNC][WRITE] = __data; \
+	return ret; \
+}
+EXPIRE_STORE_FUNCTION(zen_sync_expire_store, SYNC);
+EXPIRE_STORE_FUNCTION(zen_async_expire_store, ASYNC);
+#undef EXPIRE_STORE_FUNCTION
+
+static ssize_t zen_stats_show(struct elevator_queue *e, char *page)
+{
+	struct zen_data *zdata = e->elevator_data;
+
+	return elv_fifo_stats_show(&zdata->fifo, page);
+}
+
+static ssize_t
+zen_stats_store(struct elevator_queue *e, const char *page, size_t count)
+{
+	struct zen_data *zdata = e->elevator_data;
+
+	return elv_fifo_stats_store(&zdata->fifo, page, count);
+}
+
 #define DD_ATTR(name) \
         __ATTR(name, S_IRUGO|S_IWUSR, zen_##name##_show, \
                                       zen_##name##_store)
@@ -237,14 +207,18 @@ static struct elv_fs_entry zen_attrs[] = {
         DD_ATTR(sync_expire),
         DD_ATTR(async_expire),
         DD_ATTR(fifo_batch),
+        DD_ATTR(stats),
         __ATTR_NULL
 };
 
 static struct elevator_type iosched_zen = {
 	.ops = {
+		.elevator_merged_fn		= zen_merged_request,
 		.elevator_merge_req_fn		= zen_merged_requests,
 		.elevator_dispatch_fn		= zen_dispatch_requests,
 		.elevator_add_req_fn		= zen_add_request,
+		.elevator_queue_empty_fn	= zen_queue_empty,
+		.elevator_completed_req_fn	= zen_completed_request,
 		.elevator_former_req_fn         = elv_rb_former_request,
 		.elevator_latter_req_fn         = elv_rb_latter_request,
 		.elevator_init_fn		= zen_init_queue,
@@ -16,6 +16,9 @@
 #include <linux/pm_runtime.h>
 #include <linux/regulator/consumer.h>
 #include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <plat/ste_dma40.h>
 
@@ -52,6 +55,12 @@
 /* Attempts before giving up to trying to get pages that are aligned */
 #define MAX_LCLA_ALLOC_ATTEMPTS 256
 
+/* Completed descriptors each channel keeps for reuse */
+#define D40_DESC_CACHE_SIZE 16
+
+/* Completions handed to clients per tasklet run before yielding */
+#define D40_TASKLET_BUDGET 32
+
 /* Bit markings for allocation map */
 #define D40_ALLOC_FREE		(1 << 31)
 #define D40_ALLOC_PHY		(1 << 30)
@@ -124,15 +133,17 @@ static u32 d40_backup_regs_chan[] = {
  * struct d40_lli_pool - Structure for keeping LLIs in memory
  *
  * @base: Pointer to memory area when the pre_alloc_lli's are not large
- * enough, IE bigger than the most common case, 1 dst and 1 src. NULL if
- * pre_alloc_lli is used.
- * @size: The size in bytes of the memory at base or the size of pre_alloc_lli.
+ * enough, IE bigger than the most common case, 1 dst and 1 src. Kept
+ * when the descriptor is recycled, even if pre_alloc_lli is used.
+ * @size: The size in bytes of the LLIs in use, at base or pre_alloc_lli.
+ * @alloc: The size in bytes of the memory at base.
  * @pre_alloc_lli: Pre allocated area for the most common case of transfers,
  * one buffer to one buffer.
  */
 struct d40_lli_pool {
 	void	*base;
 	int	 size;
+	int	 alloc;
 	/* Space for dst and src, plus an extra for padding */
 	u8	 pre_alloc_lli[3 * sizeof(struct d40_phy_lli)];
 };
@@ -234,6 +245,8 @@ struct d40_base;
  * @tasklet: Tasklet that gets scheduled from interrupt context to complete a
  * transfer and call client callback.
  * @client: Cliented owned descriptor list.
+ * @free: Descriptors kept for reuse, with their LLI memory.
+ * @free_cnt: Number of descriptors in the free list.
  * @active: Active descriptor.
  * @done: Completed jobs
  * @queue: Queued jobs.
@@ -249,6 +262,13 @@ struct d40_base;
  * @runtime_direction: runtime configured direction.
  * @src_dev_addr: device source address for the channel transfer.
  * @dst_dev_addr: device destination address for the channel transfer.
+ * @coalesce_max: Number of completions collected before the tasklet runs,
+ * zero if every completion schedules it.
+ * @coalesce_delay: Longest time a completion waits for the others.
+ * @coalesce_timer: Runs the tasklet when coalesce_delay has passed.
+ * @stat_irqs: Interrupts handled for this channel.
+ * @stat_tasklets: Tasklet runs.
+ * @stat_done: Jobs, or cyclic periods, handed back to the client.
  *
  * This struct can either "be" a logical or a physical channel.
  */
@@ -263,6 +283,8 @@ struct d40_chan {
 	struct dma_chan			 chan;
 	struct tasklet_struct		 tasklet;
 	struct list_head		 client;
+	struct list_head		 free;
+	int				 free_cnt;
 	struct list_head		 active;
 	struct list_head		 done;
 	struct list_head		 queue;
@@ -280,6 +302,14 @@ struct d40_chan {
 	enum dma_data_direction		runtime_direction;
 	dma_addr_t			 src_dev_addr;
 	dma_addr_t			 dst_dev_addr;
+	/* Completion coalescing */
+	unsigned int			 coalesce_max;
+	ktime_t				 coalesce_delay;
+	struct hrtimer			 coalesce_timer;
+	/* Statistics */
+	unsigned long			 stat_irqs;
+	unsigned long			 stat_tasklets;
+	unsigned long			 stat_done;
 };
 
 /**
@@ -327,6 +357,7 @@ struct d40_chan {
  * later.
  * @reg_val_backup_chan: Backup data for standard channel parameter registers.
  * @initialized: true if the dma has been initialized
+ * @stat_irqs: Number of times the interrupt handler has run.
  */
 struct d40_base {
 	spinlock_t			 interrupt_lock;
@@ -364,6 +395,7 @@ struct d40_base {
 					  [ARRAY_SIZE(d40_backup_regs_v3)];
 	u32				 *reg_val_backup_chan;
 	bool				  initialized;
+	unsigned long			  stat_irqs;
 };
 
 /**
@@ -422,15 +454,28 @@ static int d40_pool_lli_alloc(struct d40_desc *d40d,
 	if (lli_len == 1) {
 		base = d40d->lli_pool.pre_alloc_lli;
 		d40d->lli_pool.size = sizeof(d40d->lli_pool.pre_alloc_lli);
-		d40d->lli_pool.base = NULL;
 	} else {
 		d40d->lli_pool.size = ALIGN(lli_len * 2 * align, align);
 
-		base = kmalloc(d40d->lli_pool.size + align, GFP_NOWAIT);
-		d40d->lli_pool.base = base;
+		/*
+		 * A recycled descriptor still has the memory of its earlier
+		 * jobs. Grow it in powers of two so that a channel soon
+		 * stops allocating for the sg lengths its client uses.
+		 */
+		if (d40d->lli_pool.size + align > d40d->lli_pool.alloc) {
+			int alloc = ALIGN(roundup_pow_of_two(lli_len) * 2 *
+					  align, align) + align;
+
+			kfree(d40d->lli_pool.base);
+			d40d->lli_pool.base = kmalloc(alloc, GFP_NOWAIT);
+			if (d40d->lli_pool.base == NULL) {
+				d40d->lli_pool.alloc = 0;
+				return -ENOMEM;
+			}
+			d40d->lli_pool.alloc = alloc;
+		}
 
-		if (d40d->lli_pool.base == NULL)
-			return -ENOMEM;
+		base = d40d->lli_pool.base;
 	}
 
 	if (is_log) {
@@ -453,6 +498,7 @@ static void d40_pool_lli_free(struct d40_desc *d40d)
 	kfree(d40d->lli_pool.base);
 	d40d->lli_pool.base = NULL;
 	d40d->lli_pool.size = 0;
+	d40d->lli_pool.alloc = 0;
 	d40d->lli_log.src = NULL;
 	d40d->lli_log.dst = NULL;
 	d40d->lli_phy.src = NULL;
@@ -496,7 +542,7 @@ static int d40_lcla_free_all(struct d40_chan *d40c,
 	int i;
 	int ret = -EINVAL;
 
-	if (chan_is_physical(d40c))
+	if (chan_is_physical(d40c) || d40d->lcla_alloc == 0)
 		return 0;
 
 	spin_lock_irqsave(&d40c->base->lcla_pool.lock, flags);
@@ -525,6 +571,17 @@ static void d40_desc_remove(struct d40_desc *d40d)
 	list_del(&d40d->node);
 }
 
+/* Clear a descriptor for a new job, but keep its LLI memory */
+static void d40_desc_reset(struct d40_desc *d40d)
+{
+	void *base = d40d->lli_pool.base;
+	int alloc = d40d->lli_pool.alloc;
+
+	memset(d40d, 0, sizeof(struct d40_desc));
+	d40d->lli_pool.base = base;
+	d40d->lli_pool.alloc = alloc;
+}
+
 static struct d40_desc *d40_desc_get(struct d40_chan *d40c)
 {
 	struct d40_desc *desc = NULL;
@@ -535,16 +592,22 @@ static struct d40_desc *d40_desc_get(struct d40_chan *d40c)
 
 		list_for_each_entry_safe(d, _d, &d40c->client, node) {
 			if (async_tx_test_ack(&d->txd)) {
-				d40_pool_lli_free(d);
 				d40_desc_remove(d);
 				desc = d;
-				memset(desc, 0, sizeof(struct d40_desc));
 				break;
 			}
 		}
 	}
 
-	if (!desc)
+	if (!desc && !list_empty(&d40c->free)) {
+		desc = list_first_entry(&d40c->free, struct d40_desc, node);
+		d40_desc_remove(desc);
+		d40c->free_cnt--;
+	}
+
+	if (desc)
+		d40_desc_reset(desc);
+	else
 		desc = kmem_cache_zalloc(d40c->base->desc_slab, GFP_NOWAIT);
 
 	if (desc)
@@ -557,9 +620,31 @@ static void d40_desc_free(struct d40_chan *d40c, struct d40_desc *d40d)
 {
 
 	d40_lcla_free_all(d40c, d40d);
+
+	/* Most recently used first, its LLIs are likely still cached */
+	if (d40c->free_cnt < D40_DESC_CACHE_SIZE) {
+		list_add(&d40d->node, &d40c->free);
+		d40c->free_cnt++;
+		return;
+	}
+
+	d40_pool_lli_free(d40d);
 	kmem_cache_free(d40c->base->desc_slab, d40d);
 }
 
+static void d40_desc_cache_drain(struct d40_chan *d40c)
+{
+	struct d40_desc *d;
+	struct d40_desc *_d;
+
+	list_for_each_entry_safe(d, _d, &d40c->free, node) {
+		d40_desc_remove(d);
+		d40_pool_lli_free(d);
+		kmem_cache_free(d40c->base->desc_slab, d);
+	}
+	d40c->free_cnt = 0;
+}
+
 static void d40_desc_submit(struct d40_chan *d40c, struct d40_desc *desc)
 {
 	list_add_tail(&desc->node, &d40c->active);
@@ -1318,6 +1403,37 @@ static struct d40_desc *d40_queue_start(struct d40_chan *d40c)
 	return d40d;
 }
 
+static enum hrtimer_restart d40_coalesce_timeout(struct hrtimer *timer)
+{
+	struct d40_chan *d40c = container_of(timer, struct d40_chan,
+					     coalesce_timer);
+
+	tasklet_schedule(&d40c->tasklet);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * called from interrupt context. With coalescing the tasklet waits until
+ * enough completions are pending or the first of them has waited long
+ * enough.
+ */
+static void d40_tasklet_schedule(struct d40_chan *d40c)
+{
+	if (d40c->coalesce_max) {
+		if (d40c->pending_tx < d40c->coalesce_max) {
+			if (!hrtimer_active(&d40c->coalesce_timer))
+				hrtimer_start(&d40c->coalesce_timer,
+					      d40c->coalesce_delay,
+					      HRTIMER_MODE_REL);
+			return;
+		}
+		hrtimer_try_to_cancel(&d40c->coalesce_timer);
+	}
+
+	tasklet_schedule(&d40c->tasklet);
+}
+
 /* called from interrupt context */
 static void dma_tc_handle(struct d40_chan *d40c)
 {
@@ -1326,7 +1442,7 @@ static void dma_tc_handle(struct d40_chan *d40c)
 
 	if (d40c->cdesc) {
 		d40c->pending_tx++;
-		tasklet_schedule(&d40c->tasklet);
+		d40_tasklet_schedule(d40c);
 		return;
 	}
 
@@ -1360,7 +1476,7 @@ redo:
 	d40_desc_done(d40c, d40d);
 
 	d40c->pending_tx++;
-	tasklet_schedule(&d40c->tasklet);
+	d40_tasklet_schedule(d40c);
 
 	/*
 	 * When we have multiple active transfers, there is a chance that we
@@ -1373,6 +1489,11 @@ redo:
 		goto redo;
 }
 
+/*
+ * Hands all done jobs back to the client, up to D40_TASKLET_BUDGET per run.
+ * The lock is dropped around each callback since clients may prepare and
+ * submit new jobs from it.
+ */
 static void dma_tasklet(unsigned long data)
 {
 	struct d40_chan *d40c = (struct d40_chan *) data;
@@ -1380,66 +1501,66 @@ static void dma_tasklet(unsigned long data)
 	unsigned long flags;
 	dma_async_tx_callback callback;
 	void *callback_param;
+	bool do_callback;
+	int budget = D40_TASKLET_BUDGET;
 
 	spin_lock_irqsave(&d40c->lock, flags);
 
-	if (d40c->cdesc)
-		d40d = d40c->cdesc->d40d;
-	else {
-		/* Get first active entry from list */
-		d40d = d40_first_done(d40c);
-		if (d40d == NULL)
-			goto err;
-
-		d40c->completed = d40d->txd.cookie;
-	}
+	d40c->stat_tasklets++;
 
 	/*
 	 * If terminating a channel pending_tx is set to zero.
 	 * This prevents any finished active jobs to return to the client.
 	 */
-	if (d40c->pending_tx == 0) {
-		spin_unlock_irqrestore(&d40c->lock, flags);
-		return;
-	}
+	while (d40c->pending_tx > 0 && budget-- > 0) {
 
-	/* Callback to client */
+		if (d40c->cdesc) {
+			d40d = d40c->cdesc->d40d;
+			callback = d40c->cdesc->period_callback;
+			callback_param = d40c->cdesc->period_callback_param;
+		} else {
+			/* Get first done entry from list */
+			d40d = d40_first_done(d40c);
+			if (d40d == NULL) {
+				/* Rescue manouver if receiving double interrupts */
+				d40c->pending_tx--;
+				continue;
+			}
 
-	if (d40c->cdesc) {
-		callback = d40c->cdesc->period_callback;
-		callback_param = d40c->cdesc->period_callback_param;
-	} else {
-		callback = d40d->txd.callback;
-		callback_param = d40d->txd.callback_param;
-
-		if (async_tx_test_ack(&d40d->txd)) {
-			d40_pool_lli_free(d40d);
-			d40_desc_remove(d40d);
-			d40_desc_free(d40c, d40d);
-		} else if (!d40d->is_in_client_list) {
-			d40_desc_remove(d40d);
-			d40_lcla_free_all(d40c, d40d);
-			list_add_tail(&d40d->node, &d40c->client);
-			d40d->is_in_client_list = true;
+			d40c->completed = d40d->txd.cookie;
+			callback = d40d->txd.callback;
+			callback_param = d40d->txd.callback_param;
 		}
-	}
-
-	d40c->pending_tx--;
 
-	if (d40c->pending_tx)
-		tasklet_schedule(&d40c->tasklet);
+		/* The descriptor may be reused once it is released */
+		do_callback = callback &&
+			      (d40d->txd.flags & DMA_PREP_INTERRUPT);
+
+		if (!d40c->cdesc) {
+			if (async_tx_test_ack(&d40d->txd)) {
+				d40_desc_remove(d40d);
+				d40_desc_free(d40c, d40d);
+			} else if (!d40d->is_in_client_list) {
+				d40_desc_remove(d40d);
+				d40_lcla_free_all(d40c, d40d);
+				list_add_tail(&d40d->node, &d40c->client);
+				d40d->is_in_client_list = true;
+			}
+		}
 
-	spin_unlock_irqrestore(&d40c->lock, flags);
+		d40c->pending_tx--;
+		d40c->stat_done++;
 
-	if (callback && (d40d->txd.flags & DMA_PREP_INTERRUPT))
-		callback(callback_param);
+		if (do_callback) {
+			spin_unlock_irqrestore(&d40c->lock, flags);
+			callback(callback_param);
+			spin_lock_irqsave(&d40c->lock, flags);
+		}
+	}
 
-	return;
+	if (d40c->pending_tx)
+		tasklet_schedule(&d40c->tasklet);
 
-err:
-	/* Rescue manouver if receiving double interrupts */
-	if (d40c->pending_tx > 0)
-		d40c->pending_tx--;
 	spin_unlock_irqrestore(&d40c->lock, flags);
 }
 
@@ -1471,6 +1592,8 @@ static irqreturn_t d40_handle_interrupt(int irq, void *data)
 #ifdef CONFIG_STE_DMA40_DEBUG
 	sted40_history_text("IRQ enter");
 #endif
+	base->stat_irqs++;
+
 	/* Read interrupt status of both logical and physical channels */
 	for (i = 0; i < ARRAY_SIZE(il); i++)
 		regs[i] = readl(base->virtbase + il[i].src);
@@ -1505,6 +1628,8 @@ static irqreturn_t d40_handle_interrupt(int irq, void *data)
 
 		spin_lock(&d40c->lock);
 
+		d40c->stat_irqs++;
+
 		if (!il[row].is_error) {
 
 			dma_tc_handle(d40c);
@@ -1845,11 +1970,15 @@ static int d40_free_dma(struct d40_chan *d40c)
 	/* Release client owned descriptors */
 	if (!list_empty(&d40c->client))
 		list_for_each_entry_safe(d, _d, &d40c->client, node) {
-			d40_pool_lli_free(d);
 			d40_desc_remove(d);
 			d40_desc_free(d40c, d);
 		}
 
+	d40_desc_cache_drain(d40c);
+
+	hrtimer_cancel(&d40c->coalesce_timer);
+	d40c->coalesce_max = 0;
+
 	if (phy == NULL) {
 		dev_err(&d40c->chan.dev->device, "[%s] phy == null\n",
 			__func__);
@@ -2367,6 +2496,40 @@ int stedma40_set_dev_addr(struct dma_chan *chan,
 }
 EXPORT_SYMBOL(stedma40_set_dev_addr);
 
+int stedma40_set_coalesce(struct dma_chan *chan,
+			  unsigned int max_pending,
+			  unsigned int timeout_us)
+{
+	struct d40_chan *d40c = container_of(chan, struct d40_chan, chan);
+	unsigned long flags;
+
+	if (d40c->phy_chan == NULL || chan_is_physical(d40c)) {
+		dev_err(&d40c->chan.dev->device,
+			"[%s] Coalescing needs an allocated logical channel\n",
+			__func__);
+		return -EINVAL;
+	}
+
+	if (max_pending && !timeout_us)
+		return -EINVAL;
+
+	spin_lock_irqsave(&d40c->lock, flags);
+
+	d40c->coalesce_max = max_pending;
+	d40c->coalesce_delay = ns_to_ktime((u64)timeout_us * NSEC_PER_USEC);
+
+	spin_unlock_irqrestore(&d40c->lock, flags);
+
+	/* Anything already waiting is completed at once */
+	if (!max_pending) {
+		hrtimer_cancel(&d40c->coalesce_timer);
+		tasklet_schedule(&d40c->tasklet);
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL(stedma40_set_coalesce);
+
 static int d40_prep_slave_sg_log(struct d40_desc *d40d,
 				 struct d40_chan *d40c,
 				 struct scatterlist *sgl,
@@ -2903,6 +3066,7 @@ void stedma40_cyclic_free(struct dma_chan *chan)
 
 	spin_unlock_irqrestore(&d40c->lock, flags);
 
+	d40_pool_lli_free(cdesc->d40d);
 	kfree(cdesc);
 }
 EXPORT_SYMBOL(stedma40_cyclic_free);
@@ -2990,6 +3154,7 @@ out2:
 out:
 	if (d40c->phy_chan)
 		d40_lcla_free_all(d40c, cdesc->d40d);
+	d40_pool_lli_free(cdesc->d40d);
 	kfree(cdesc);
 	spin_unlock_irqrestore(&d40c->lock, flags);
 	return ERR_PTR(err);
@@ -3020,10 +3185,15 @@ static void __init d40_chan_init(struct d40_base *base, struct dma_device *dma,
 		INIT_LIST_HEAD(&d40c->active);
 		INIT_LIST_HEAD(&d40c->queue);
 		INIT_LIST_HEAD(&d40c->client);
+		INIT_LIST_HEAD(&d40c->free);
 
 		tasklet_init(&d40c->tasklet, dma_tasklet,
 			     (unsigned long) d40c);
 
+		hrtimer_init(&d40c->coalesce_timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL);
+		d40c->coalesce_timer.function = d40_coalesce_timeout;
+
 		list_add_tail(&d40c->chan.device_node,
 			      &dma->channels);
 	}
@@ -3588,6 +3758,60 @@ failure:
 	return ret;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static void d40_debugfs_show_chan(struct seq_file *s, struct d40_chan *d40c,
+				  const char *type, int num)
+{
+	/* Channels never set up by d40_chan_init() have no base */
+	if (!d40c->base || (!d40c->phy_chan && !d40c->stat_irqs))
+		return;
+
+	seq_printf(s, "%s %-3d\t%10lu\t%10lu\t%10lu\t%u\n", type, num,
+		   d40c->stat_irqs, d40c->stat_tasklets, d40c->stat_done,
+		   d40c->coalesce_max);
+}
+
+static int d40_debugfs_show(struct seq_file *s, void *data)
+{
+	struct d40_base *base = s->private;
+	int i;
+
+	seq_printf(s, "interrupts: %lu\n\n", base->stat_irqs);
+	seq_printf(s, "CHANNEL:\tIRQS:\t\tTASKLETS:\tDONE:\t\tCOALESCE:\n");
+
+	for (i = 0; i < base->num_phy_chans; i++)
+		d40_debugfs_show_chan(s, &base->phy_chans[i], "phy", i);
+
+	for (i = 0; i < base->num_log_chans + base->plat_data->memcpy_len; i++)
+		d40_debugfs_show_chan(s, &base->log_chans[i], "log", i);
+
+	return 0;
+}
+
+static int d40_debugfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, d40_debugfs_show, inode->i_private);
+}
+
+static const struct file_operations d40_debugfs_operations = {
+	.open		= d40_debugfs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init d40_debugfs_init(struct d40_base *base)
+{
+	/* Interrupts against completed jobs, per channel */
+	(void) debugfs_create_file(D40_NAME, S_IFREG | S_IRUGO, NULL, base,
+				   &d40_debugfs_operations);
+}
+#else
+static inline void d40_debugfs_init(struct d40_base *base)
+{
+}
+#endif
+
 static int __init d40_probe(struct platform_device *pdev)
 {
 	int err;
@@ -3732,6 +3956,8 @@ static int __init d40_probe(struct platform_device *pdev)
 
 	d40_hw_init(base);
 
+	d40_debugfs_init(base);
+
 	spin_lock_irqsave(&base->usage_lock, flags);
 	base->usage--;
 	spin_unlock_irqrestore(&base->usage_lock, flags);
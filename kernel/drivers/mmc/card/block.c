@@ -182,13 +182,6 @@ static const struct block_device_operations mmc_bdops = {
 	.owner			= THIS_MODULE,
 };
 
-struct mmc_blk_request {
-	struct mmc_request	mrq;
-	struct mmc_command	cmd;
-	struct mmc_command	stop;
-	struct mmc_data		data;
-};
-
 static u32 mmc_sd_num_wr_blocks(struct mmc_card *card)
 {
 	int err;
@@ -327,130 +320,230 @@ mmc_blk_set_blksize(struct mmc_blk_data *md, struct mmc_card *card)
 	return 0;
 }
 
-static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
+static inline int mmc_blk_card_removed(struct mmc_card *card)
 {
-	struct mmc_blk_data *md = mq->data;
-	struct mmc_card *card = md->queue.card;
-	struct mmc_blk_request brq;
-	int ret = 1, disable_multi = 0;
-
-#ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
-	if (mmc_bus_needs_resume(card->host)) {
-		mmc_resume_bus(card->host);
-		mmc_blk_set_blksize(md, card);
-	}
+#ifdef _MMC_SAFE_ACCESS_
+	if (card->type == MMC_TYPE_SD && !mmc_is_available)
+		return 1;
 #endif
+	return 0;
+}
 
-	mmc_claim_host(card->host);
+/*
+ * FUA writes are issued as reliable writes, the block layer only asks
+ * for them when mmc_init_queue() found the card supports them.
+ */
+static inline int mmc_blk_reliable(struct mmc_card *card, struct request *req)
+{
+	return (req->cmd_flags & REQ_FUA) && rq_data_dir(req) == WRITE &&
+		mmc_card_mmc(card) && card->ext_csd.rel_sectors;
+}
 
-	do {
-		struct mmc_command cmd;
-		u32 readcmd, writecmd, status = 0;
-
-		memset(&brq, 0, sizeof(struct mmc_blk_request));
-		brq.mrq.cmd = &brq.cmd;
-		brq.mrq.data = &brq.data;
-
-		brq.cmd.arg = blk_rq_pos(req);
-		if (!mmc_card_blockaddr(card))
-			brq.cmd.arg <<= 9;
-		brq.cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
-		brq.data.blksz = 512;
-		brq.stop.opcode = MMC_STOP_TRANSMISSION;
-		brq.stop.arg = 0;
-		brq.stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
-		brq.data.blocks = blk_rq_sectors(req);
+/*
+ * Called by mmc_start_req() once the request is done, before the next
+ * one is started. Anything but a clean and complete transfer makes
+ * mmc_blk_issue_rw_rq() finish the request synchronously.
+ */
+static int mmc_blk_err_check(struct mmc_card *card,
+			     struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_mrq = container_of(areq, struct mmc_queue_req,
+						    mmc_active);
+	struct mmc_blk_request *brq = &mq_mrq->brq;
+	struct request *req = mq_mrq->req;
+
+	if (brq->cmd.error || brq->data.error || brq->stop.error)
+		return 1;
+
+	/* The card must leave programming mode before the next command */
+	if (wait_for_ready_state(card, req))
+		return 1;
+
+	if (brq->data.bytes_xfered != blk_rq_bytes(req))
+		return 1;
+
+	return 0;
+}
+
+static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
+			       struct mmc_card *card,
+			       int disable_multi,
+			       struct mmc_queue *mq)
+{
+	u32 readcmd, writecmd;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+	brq->data.blksz = 512;
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+	brq->data.blocks = blk_rq_sectors(req);
+
+	/*
+	 * The block layer doesn't support all sector count
+	 * restrictions, so we need to be prepared for too big
+	 * requests.
+	 */
+	if (brq->data.blocks > card->host->max_blk_count)
+		brq->data.blocks = card->host->max_blk_count;
+
+	/*
+	 * After a read error, we redo the request one sector at a time
+	 * in order to accurately determine which sectors can be read
+	 * successfully.
+	 */
+	if (disable_multi && brq->data.blocks > 1)
+		brq->data.blocks = 1;
+
+	if (mmc_blk_reliable(card, req)) {
+		unsigned int rel_sectors = card->ext_csd.rel_sectors;
 
 		/*
-		 * The block layer doesn't support all sector count
-		 * restrictions, so we need to be prepared for too big
-		 * requests.
+		 * Legacy reliable writes are either a single block or
+		 * one aligned REL_WR_SEC_C unit.
 		 */
-		if (brq.data.blocks > card->host->max_blk_count)
-			brq.data.blocks = card->host->max_blk_count;
+		if (!(card->ext_csd.rel_param & EXT_CSD_WR_REL_PARAM_EN)) {
+			if (!IS_ALIGNED(blk_rq_pos(req), rel_sectors) ||
+			    brq->data.blocks < rel_sectors)
+				brq->data.blocks = 1;
+			else
+				brq->data.blocks = rel_sectors;
+		}
+
+		brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+		brq->sbc.arg = brq->data.blocks | (1 << 31);
+		brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+	}
 
+	if (brq->sbc.opcode) {
 		/*
-		 * After a read error, we redo the request one sector at a time
-		 * in order to accurately determine which sectors can be read
-		 * successfully.
+		 * The block count is predefined, STOP_TRANSMISSION is only
+		 * sent by mmc_blk_wait_for_req() to recover from errors.
 		 */
-		if (disable_multi && brq.data.blocks > 1)
-			brq.data.blocks = 1;
+		brq->mrq.stop = NULL;
+		readcmd = MMC_READ_MULTIPLE_BLOCK;
+		writecmd = MMC_WRITE_MULTIPLE_BLOCK;
+	} else if (brq->data.blocks > 1) {
+		/* SPI multiblock writes terminate using a special
+		 * token, not a STOP_TRANSMISSION request.
+		 */
+		if (!mmc_host_is_spi(card->host)
+				|| rq_data_dir(req) == READ)
+			brq->mrq.stop = &brq->stop;
+		readcmd = MMC_READ_MULTIPLE_BLOCK;
+		writecmd = MMC_WRITE_MULTIPLE_BLOCK;
+	} else {
+		brq->mrq.stop = NULL;
+		readcmd = MMC_READ_SINGLE_BLOCK;
+		writecmd = MMC_WRITE_BLOCK;
+	}
+	if (rq_data_dir(req) == READ) {
+		brq->cmd.opcode = readcmd;
+		brq->data.flags |= MMC_DATA_READ;
+	} else {
+		brq->cmd.opcode = writecmd;
+		brq->data.flags |= MMC_DATA_WRITE;
+	}
 
-		if (brq.data.blocks > 1) {
-			/* SPI multiblock writes terminate using a special
-			 * token, not a STOP_TRANSMISSION request.
-			 */
-			if (!mmc_host_is_spi(card->host)
-					|| rq_data_dir(req) == READ)
-				brq.mrq.stop = &brq.stop;
-			readcmd = MMC_READ_MULTIPLE_BLOCK;
-			writecmd = MMC_WRITE_MULTIPLE_BLOCK;
-		} else {
-			brq.mrq.stop = NULL;
-			readcmd = MMC_READ_SINGLE_BLOCK;
-			writecmd = MMC_WRITE_BLOCK;
-		}
-		if (rq_data_dir(req) == READ) {
-			brq.cmd.opcode = readcmd;
-			brq.data.flags |= MMC_DATA_READ;
-		} else {
-			brq.cmd.opcode = writecmd;
-			brq.data.flags |= MMC_DATA_WRITE;
-		}
+	mmc_set_data_timeout(&brq->data, card);
 
-#ifdef _MMC_SAFE_ACCESS_
-		if (card->type == MMC_TYPE_SD)
-			if (!mmc_is_available)
-				goto cmd_sdremove;
-#endif
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
 
-		mmc_set_data_timeout(&brq.data, card);
+	/*
+	 * Adjust the sg list so it is the same size as the
+	 * request.
+	 */
+	if (brq->data.blocks != blk_rq_sectors(req)) {
+		int i, data_size = brq->data.blocks << 9;
+		struct scatterlist *sg;
+
+		for_each_sg(brq->data.sg, sg, brq->data.sg_len, i) {
+			data_size -= sg->length;
+			if (data_size <= 0) {
+				sg->length += data_size;
+				i++;
+				break;
+			}
+		}
+		brq->data.sg_len = i;
+	}
 
-		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_err_check;
 
-		/*
-		 * Adjust the sg list so it is the same size as the
-		 * request.
-		 */
-		if (brq.data.blocks != blk_rq_sectors(req)) {
-			int i, data_size = brq.data.blocks << 9;
-			struct scatterlist *sg;
-
-			for_each_sg(brq.data.sg, sg, brq.data.sg_len, i) {
-				data_size -= sg->length;
-				if (data_size <= 0) {
-					sg->length += data_size;
-					i++;
-					break;
-				}
-			}
-			brq.data.sg_len = i;
+	mmc_queue_bounce_pre(mqrq);
+}
+
+static void mmc_blk_wait_for_req(struct mmc_card *card,
+				 struct mmc_blk_request *brq)
+{
+	if (brq->sbc.opcode) {
+		card->rel_writes++;
+		if (mmc_wait_for_cmd(card->host, &brq->sbc, 0)) {
+			brq->cmd.error = brq->sbc.error;
+			return;
 		}
+	}
 
-#ifdef _MMC_SAFE_ACCESS_
-		if (card->type == MMC_TYPE_SD)
-			if (!mmc_is_available)
-				goto cmd_sdremove;
-#endif
+	mmc_wait_for_req(card->host, &brq->mrq);
 
+	/*
+	 * The host knows nothing of CMD23, so after an error nobody has
+	 * ended the transfer and the card may still be waiting for data.
+	 */
+	if (brq->sbc.opcode && (brq->cmd.error || brq->data.error))
+		mmc_wait_for_cmd(card->host, &brq->stop, 0);
+}
 
-		mmc_queue_bounce_pre(mq);
+/*
+ * Issue a request one chunk at a time and wait for each. This is used
+ * for reliable writes, and to finish a request that failed or was only
+ * partly transferred, in which case @issued says its first chunk has
+ * already been through mmc_start_req().
+ */
+static int mmc_blk_finish_rw_rq(struct mmc_queue *mq,
+				struct mmc_queue_req *mq_rq, int issued)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_blk_request *brq = &mq_rq->brq;
+	struct request *req = mq_rq->req;
+	int ret = 1, disable_multi = 0;
+
+	do {
+		struct mmc_command cmd;
+		u32 status = 0;
 
-		mmc_wait_for_req(card->host, &brq.mrq);
+		if (!issued) {
+			if (mmc_blk_card_removed(card))
+				goto cmd_sdremove;
 
-		mmc_queue_bounce_post(mq);
+			mmc_blk_rw_rq_prep(mq_rq, card, disable_multi, mq);
+			mmc_blk_wait_for_req(card, brq);
+		}
+		issued = 0;
+
+		mmc_queue_bounce_post(mq_rq);
 
 /* debug code */
 #ifdef MOVI_DEBUG
 		if (card->type == MMC_TYPE_MMC) {
 
-			gaCmdLog[gnCmdLogIdx].cmd = brq.cmd.opcode;
-			gaCmdLog[gnCmdLogIdx].arg = brq.cmd.arg;
-			gaCmdLog[gnCmdLogIdx].cnt = brq.data.blocks;
-			gaCmdLog[gnCmdLogIdx].rsp = brq.cmd.resp[0];
-			gaCmdLog[gnCmdLogIdx].stoprsp = brq.stop.resp[0];
+			gaCmdLog[gnCmdLogIdx].cmd = brq->cmd.opcode;
+			gaCmdLog[gnCmdLogIdx].arg = brq->cmd.arg;
+			gaCmdLog[gnCmdLogIdx].cnt = brq->data.blocks;
+			gaCmdLog[gnCmdLogIdx].rsp = brq->cmd.resp[0];
+			gaCmdLog[gnCmdLogIdx].stoprsp = brq->stop.resp[0];
 			gnCmdLogIdx++;
 
 			if (gnCmdLogIdx >= 5)
@@ -462,8 +555,8 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 		 * until later as we need to wait for the card to leave
 		 * programming mode even when things go wrong.
 		 */
-		if (!brq.cmd.error && !brq.stop.error &&
-			brq.data.error == -EAGAIN) {
+		if (!brq->cmd.error && !brq->stop.error &&
+			brq->data.error == -EAGAIN) {
 			printk(KERN_WARNING "%s: retrying transfer\n",
 					req->rq_disk->disk_name);
 			if (wait_for_ready_state(card, req))
@@ -471,8 +564,8 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 			continue;
 		}
 
-		if (brq.cmd.error || brq.data.error || brq.stop.error) {
-			if (brq.data.blocks > 1 && rq_data_dir(req) == READ) {
+		if (brq->cmd.error || brq->data.error || brq->stop.error) {
+			if (brq->data.blocks > 1 && rq_data_dir(req) == READ) {
 				/* Redo read one sector at a time */
 				printk(KERN_WARNING "%s: retrying using single "
 				       "block read\n", req->rq_disk->disk_name);
@@ -485,7 +578,7 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 		}
 
 #ifdef MOVI_DEBUG
-		if (brq.cmd.error) {
+		if (brq->cmd.error) {
 			if (card->type == MMC_TYPE_MMC) {
 
 				status = get_card_status(card, req, &status, 0);
@@ -571,11 +664,11 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 			}
 		}
 #endif
-		if (brq.cmd.error) {
+		if (brq->cmd.error) {
 			printk(KERN_ERR "%s: error %d sending read/write "
 			       "command, response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.cmd.error,
-			       brq.cmd.resp[0], status);
+			       req->rq_disk->disk_name, brq->cmd.error,
+			       brq->cmd.resp[0], status);
 			if(R1_CURRENT_STATE(status) == 6 || R1_CURRENT_STATE(status) == 5)
 			{
 				struct mmc_command cmd;
@@ -589,26 +682,26 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 			}
 		}
 
-		if (brq.data.error) {
-			if (brq.data.error == -ETIMEDOUT && brq.mrq.stop)
+		if (brq->data.error) {
+			if (brq->data.error == -ETIMEDOUT && brq->mrq.stop)
 				/* 'Stop' response contains card status */
-				status = brq.mrq.stop->resp[0];
+				status = brq->mrq.stop->resp[0];
 			printk(KERN_ERR "%s: error %d transferring data,"
 			       " sector %u, nr %u, card status %#x\n",
-			       req->rq_disk->disk_name, brq.data.error,
+			       req->rq_disk->disk_name, brq->data.error,
 			       (unsigned)blk_rq_pos(req),
 			       (unsigned)blk_rq_sectors(req), status);
 		}
 
-		if (brq.stop.error) {
+		if (brq->stop.error) {
 			printk(KERN_ERR "%s: error %d sending stop command, "
 			       "response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.stop.error,
-			       brq.stop.resp[0], status);
+			       req->rq_disk->disk_name, brq->stop.error,
+			       brq->stop.resp[0], status);
 		}
 
 #ifdef _MMC_SAFE_ACCESS_
-		if (brq.cmd.error || brq.data.error || brq.stop.error) {
+		if (brq->cmd.error || brq->data.error || brq->stop.error) {
 			if (card->type == MMC_TYPE_SD) {
 				if (mmc_is_available)
 					status = get_card_status(card,
@@ -622,7 +715,7 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 		if (wait_for_ready_state(card, req))
 			goto cmd_err;
 
-		if (brq.cmd.error || brq.stop.error || brq.data.error) {
+		if (brq->cmd.error || brq->stop.error || brq->data.error) {
 			if (rq_data_dir(req) == READ) {
 				/*
 				 * After an error, we redo I/O one sector at a
@@ -631,7 +724,7 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 				 */
 				spin_lock_irq(&md->lock);
 				ret = __blk_end_request(req,
-					-EIO, brq.data.blksz);
+					-EIO, brq->data.blksz);
 				spin_unlock_irq(&md->lock);
 				continue;
 			}
@@ -642,19 +735,16 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 		 * A block was successfully transferred.
 		 */
 		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
+		ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
 		spin_unlock_irq(&md->lock);
 	} while (ret);
 
-	mmc_release_host(card->host);
-
 	return 1;
 
 cmd_sdremove:
 	spin_lock_irq(&md->lock);
 	__blk_end_request_all(req, -EIO);
 	spin_unlock_irq(&md->lock);
-	mmc_release_host(card->host);
 	return 0;
 
  cmd_err:
@@ -677,12 +767,10 @@ cmd_sdremove:
 		}
 	} else {
 		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
+		ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
 		spin_unlock_irq(&md->lock);
 	}
 
-	mmc_release_host(card->host);
-
 	spin_lock_irq(&md->lock);
 	while (ret)
 		ret = __blk_end_request(req, -EIO, blk_rq_cur_bytes(req));
@@ -691,6 +779,119 @@ cmd_sdremove:
 	return 0;
 }
 
+static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_queue_req *mq_rq;
+	struct mmc_async_req *areq;
+	int ret, err;
+
+	if (rqc && mmc_blk_card_removed(card)) {
+		spin_lock_irq(&md->lock);
+		__blk_end_request_all(rqc, -EIO);
+		spin_unlock_irq(&md->lock);
+		mq->mqrq_cur->req = NULL;
+		rqc = NULL;
+	}
+
+	/* CMD23 has to go right before the write, so it is not pipelined */
+	if (rqc && mmc_blk_reliable(card, rqc)) {
+		if (card->host->areq)
+			mmc_blk_issue_rw_rq(mq, NULL);
+
+		ret = mmc_blk_finish_rw_rq(mq, mq->mqrq_cur, 0);
+		mq->mqrq_cur->req = NULL;
+		return ret;
+	}
+
+	/*
+	 * Map and prepare rqc while the previous request, if any, is
+	 * still transferring. mmc_start_req() then waits for the latter
+	 * and starts rqc right away.
+	 */
+	if (rqc) {
+		mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+		areq = &mq->mqrq_cur->mmc_active;
+	} else
+		areq = NULL;
+
+	areq = mmc_start_req(card->host, areq, &err);
+	if (!areq)
+		return 1;
+
+	mq_rq = container_of(areq, struct mmc_queue_req, mmc_active);
+
+	if (!err) {
+		mmc_queue_bounce_post(mq_rq);
+
+		spin_lock_irq(&md->lock);
+		__blk_end_request_all(mq_rq->req, 0);
+		spin_unlock_irq(&md->lock);
+		return 1;
+	}
+
+	/*
+	 * rqc has not been started, the failed request must be sorted
+	 * out on its own first.
+	 */
+	ret = mmc_blk_finish_rw_rq(mq, mq_rq, 1);
+
+	if (rqc)
+		mmc_start_req(card->host, &mq->mqrq_cur->mmc_active, NULL);
+
+	return ret;
+}
+
+static int mmc_blk_issue_flush(struct mmc_queue *mq, struct request *req)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	int err;
+
+	/* Everything before the flush must have reached the card */
+	if (card->host->areq)
+		mmc_blk_issue_rw_rq(mq, NULL);
+
+	err = mmc_flush_cache(card);
+
+	spin_lock_irq(&md->lock);
+	__blk_end_request_all(req, err ? -EIO : 0);
+	spin_unlock_irq(&md->lock);
+
+	mq->mqrq_cur->req = NULL;
+
+	return err ? 0 : 1;
+}
+
+static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	int ret;
+
+	/* The host stays claimed for as long as a request is in flight */
+	if (!card->host->areq) {
+#ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
+		if (mmc_bus_needs_resume(card->host)) {
+			mmc_resume_bus(card->host);
+			mmc_blk_set_blksize(md, card);
+		}
+#endif
+		mmc_claim_host(card->host);
+	}
+
+	if (req && mmc_req_is_flush(req))
+		ret = mmc_blk_issue_flush(mq, req);
+	else
+		ret = mmc_blk_issue_rw_rq(mq, req);
+
+	if (!card->host->areq)
+		mmc_release_host(card->host);
+
+	return ret;
+}
+
 static inline int mmc_blk_readonly(struct mmc_card *card)
 {
 	return mmc_card_readonly(card) ||
@@ -759,6 +960,15 @@ static struct mmc_blk_data *mmc_blk_alloc(struct mmc_card *card)
 
 	blk_queue_logical_block_size(md->queue.queue, 512);
 
+	/*
+	 * Let the elevator and filesystems know how the card programs
+	 * and erases; the flash scheduler batches writes by erase block.
+	 */
+	if (card->write_size)
+		blk_queue_io_min(md->queue.queue, card->write_size << 9);
+	if (card->erase_size)
+		blk_queue_io_opt(md->queue.queue, card->erase_size << 9);
+
 	if (!mmc_card_sd(card) && mmc_card_blockaddr(card)) {
 		/*
 		 * The EXT_CSD sector count is in number or 512 byte
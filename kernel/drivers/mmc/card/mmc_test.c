@@ -16,6 +16,10 @@
 #include <linux/slab.h>
 
 #include <linux/scatterlist.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+
+#include <asm/div64.h>
 
 #define RESULT_OK		0
 #define RESULT_FAIL		1
@@ -25,6 +29,36 @@
 #define BUFFER_ORDER		2
 #define BUFFER_SIZE		(PAGE_SIZE << BUFFER_ORDER)
 
+#define AREA_MAX_SIZE		(512 * 1024)	/* largest single transfer */
+#define AREA_SEQ_SIZE		(4 * 1024 * 1024)	/* per sequential run */
+#define AREA_RND_SIZE		4096
+#define AREA_RND_COUNT		256
+
+/*
+ * Pages and scatterlist used by the performance tests, which transfer
+ * far more than BUFFER_SIZE. The data itself is never checked.
+ */
+struct mmc_test_area {
+	unsigned long	max_sz;		/* largest transfer, in bytes */
+	unsigned long	seq_sz;		/* bytes moved per sequential run */
+	unsigned int	dev_addr;	/* first sector used */
+	unsigned int	rnd_sectors;	/* sectors random I/O spreads over */
+	unsigned int	page_cnt;
+	struct page	**pages;
+	struct scatterlist *sg;
+};
+
+/*
+ * Time taken by the requests of one performance run
+ */
+struct mmc_test_perf {
+	unsigned int	count;
+	u64		bytes;
+	u64		ns;
+	u64		min_ns;
+	u64		max_ns;
+};
+
 struct mmc_test_card {
 	struct mmc_card	*card;
 
@@ -33,6 +67,7 @@ struct mmc_test_card {
 #ifdef CONFIG_HIGHMEM
 	struct page	*highmem;
 #endif
+	struct mmc_test_area area;
 };
 
 /*******************************************************************/
@@ -447,6 +482,215 @@ static int mmc_test_transfer(struct mmc_test_card *test,
 	return 0;
 }
 
+/*
+ * Card size in sectors
+ */
+static unsigned int mmc_test_capacity(struct mmc_card *card)
+{
+	if (!mmc_card_sd(card) && mmc_card_blockaddr(card))
+		return card->ext_csd.sectors;
+	else
+		return card->csd.capacity << (card->csd.read_blkbits - 9);
+}
+
+static int mmc_test_area_cleanup(struct mmc_test_card *test)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned int i;
+
+	if (t->pages) {
+		for (i = 0;i < t->page_cnt;i++) {
+			if (t->pages[i])
+				__free_page(t->pages[i]);
+		}
+	}
+	kfree(t->pages);
+	kfree(t->sg);
+	memset(t, 0, sizeof(struct mmc_test_area));
+
+	return 0;
+}
+
+/*
+ * Allocate the performance test area. It sits in the upper half of
+ * the card, aligned to the largest transfer.
+ */
+static int mmc_test_area_prepare(struct mmc_test_card *test)
+{
+	struct mmc_test_area *t = &test->area;
+	struct mmc_host *host = test->card->host;
+	unsigned int capacity, i;
+	unsigned long sz;
+	int ret;
+
+	sz = AREA_MAX_SIZE;
+	sz = min_t(unsigned long, sz, host->max_req_size);
+	sz = min_t(unsigned long, sz, host->max_blk_count * 512);
+	sz = min_t(unsigned long, sz, host->max_segs * PAGE_SIZE);
+	sz &= PAGE_MASK;
+
+	/* Left empty, the tests then report themselves unsupported */
+	capacity = mmc_test_capacity(test->card);
+	if (!sz || host->max_seg_size < PAGE_SIZE || capacity < (sz >> 8))
+		return 0;
+
+	t->dev_addr = capacity / 2;
+	t->dev_addr -= t->dev_addr % (sz >> 9);
+
+	t->max_sz = sz;
+	t->seq_sz = min_t(unsigned long, AREA_SEQ_SIZE,
+			  (unsigned long)(capacity - t->dev_addr) << 9);
+	t->seq_sz -= t->seq_sz % sz;
+	t->rnd_sectors = capacity - t->dev_addr;
+
+	t->page_cnt = sz >> PAGE_SHIFT;
+	t->pages = kcalloc(t->page_cnt, sizeof(struct page *), GFP_KERNEL);
+	t->sg = kmalloc((sz >> 9) * sizeof(struct scatterlist), GFP_KERNEL);
+	if (!t->pages || !t->sg)
+		goto out_nomem;
+
+	for (i = 0;i < t->page_cnt;i++) {
+		t->pages[i] = alloc_page(GFP_KERNEL);
+		if (!t->pages[i])
+			goto out_nomem;
+	}
+
+	ret = mmc_test_set_blksize(test, 512);
+	if (ret)
+		goto out_free;
+
+	return 0;
+
+out_nomem:
+	ret = -ENOMEM;
+out_free:
+	/* A failed prepare stage is not followed by cleanup */
+	mmc_test_area_cleanup(test);
+	return ret;
+}
+
+/*
+ * Map the first @sz bytes of the test area in segments of @seg_sz
+ * bytes, which must divide PAGE_SIZE.
+ */
+static int mmc_test_area_map(struct mmc_test_card *test, unsigned long sz,
+	unsigned int seg_sz, unsigned int *sg_len)
+{
+	struct mmc_test_area *t = &test->area;
+	struct mmc_host *host = test->card->host;
+	unsigned int nents, i;
+	unsigned long offs;
+
+	nents = DIV_ROUND_UP(sz, seg_sz);
+	if (nents > host->max_segs || seg_sz > host->max_seg_size)
+		return RESULT_UNSUP_HOST;
+
+	sg_init_table(t->sg, nents);
+	for (i = 0;i < nents;i++) {
+		offs = (unsigned long)i * seg_sz;
+		sg_set_page(&t->sg[i], t->pages[offs >> PAGE_SHIFT],
+			min_t(unsigned long, seg_sz, sz - offs),
+			offs & ~PAGE_MASK);
+	}
+
+	*sg_len = nents;
+
+	return 0;
+}
+
+/*
+ * Do one timed transfer of @sz bytes from the test area
+ */
+static int mmc_test_area_io(struct mmc_test_card *test, unsigned long sz,
+	unsigned int dev_addr, unsigned int seg_sz, int write,
+	struct mmc_test_perf *perf)
+{
+	unsigned int sg_len;
+	ktime_t start;
+	u64 ns;
+	int ret;
+
+	ret = mmc_test_area_map(test, sz, seg_sz, &sg_len);
+	if (ret)
+		return ret;
+
+	start = ktime_get();
+	ret = mmc_test_simple_transfer(test, test->area.sg, sg_len, dev_addr,
+		sz >> 9, 512, write);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret)
+		return ret;
+
+	if (!perf->count || ns < perf->min_ns)
+		perf->min_ns = ns;
+	if (ns > perf->max_ns)
+		perf->max_ns = ns;
+	perf->count++;
+	perf->bytes += sz;
+	perf->ns += ns;
+
+	return 0;
+}
+
+static unsigned int mmc_test_ns_to_us(u64 ns)
+{
+	do_div(ns, NSEC_PER_USEC);
+	return ns;
+}
+
+static void mmc_test_print_perf(struct mmc_test_card *test,
+	const char *what, unsigned long sz, unsigned int seg_sz,
+	struct mmc_test_perf *perf)
+{
+	unsigned int us, avg_us, rate;
+	u64 bytes;
+
+	if (!perf->count)
+		return;
+
+	us = max(mmc_test_ns_to_us(perf->ns), 1u);
+	avg_us = us / perf->count;
+
+	/* bytes per millisecond is kB/s */
+	bytes = perf->bytes * 1000;
+	do_div(bytes, us);
+	rate = bytes;
+
+	printk(KERN_INFO "%s: %s %u x %lu bytes (%u byte segments): "
+		"%u kB/s, %u us avg, %u us min, %u us max\n",
+		mmc_hostname(test->card->host), what, perf->count, sz,
+		seg_sz, rate, avg_us, mmc_test_ns_to_us(perf->min_ns),
+		mmc_test_ns_to_us(perf->max_ns));
+}
+
+/*
+ * Move seq_sz bytes through consecutive transfers of @sz bytes
+ */
+static int mmc_test_area_seq(struct mmc_test_card *test, unsigned long sz,
+	unsigned int seg_sz, int write)
+{
+	struct mmc_test_area *t = &test->area;
+	struct mmc_test_perf perf;
+	unsigned int dev_addr = t->dev_addr;
+	unsigned long done;
+	int ret;
+
+	memset(&perf, 0, sizeof(struct mmc_test_perf));
+
+	for (done = 0;done + sz <= t->seq_sz;done += sz) {
+		ret = mmc_test_area_io(test, sz, dev_addr, seg_sz, write,
+			&perf);
+		if (ret)
+			return ret;
+		dev_addr += sz >> 9;
+	}
+
+	mmc_test_print_perf(test, write ? "Wrote" : "Read", sz, seg_sz,
+		&perf);
+
+	return 0;
+}
+
 /*******************************************************************/
 /*  Tests                                                          */
 /*******************************************************************/
@@ -885,6 +1129,116 @@ static int mmc_test_multi_read_high(struct mmc_test_card *test)
 
 #endif /* CONFIG_HIGHMEM */
 
+/*
+ * Sequential transfers of every power of two size up to the largest
+ */
+static int mmc_test_seq_perf(struct mmc_test_card *test, int write)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned long sz;
+	int ret;
+
+	if (!t->max_sz)
+		return RESULT_UNSUP_HOST;
+
+	for (sz = 512;;sz = min(sz << 1, t->max_sz)) {
+		ret = mmc_test_area_seq(test, sz,
+			min_t(unsigned long, sz, PAGE_SIZE), write);
+		if (ret)
+			return ret;
+		if (sz == t->max_sz)
+			break;
+	}
+
+	return 0;
+}
+
+static int mmc_test_seq_write_perf(struct mmc_test_card *test)
+{
+	return mmc_test_seq_perf(test, 1);
+}
+
+static int mmc_test_seq_read_perf(struct mmc_test_card *test)
+{
+	return mmc_test_seq_perf(test, 0);
+}
+
+/*
+ * Small transfers at random aligned addresses in the upper half
+ */
+static int mmc_test_rnd_perf(struct mmc_test_card *test, int write)
+{
+	struct mmc_test_area *t = &test->area;
+	struct mmc_test_perf perf;
+	unsigned int slots, dev_addr, i;
+	int ret;
+
+	if (t->max_sz < AREA_RND_SIZE)
+		return RESULT_UNSUP_HOST;
+
+	memset(&perf, 0, sizeof(struct mmc_test_perf));
+
+	slots = t->rnd_sectors / (AREA_RND_SIZE >> 9);
+	for (i = 0;i < AREA_RND_COUNT;i++) {
+		dev_addr = t->dev_addr +
+			(random32() % slots) * (AREA_RND_SIZE >> 9);
+		ret = mmc_test_area_io(test, AREA_RND_SIZE, dev_addr,
+			min_t(unsigned long, AREA_RND_SIZE, PAGE_SIZE),
+			write, &perf);
+		if (ret)
+			return ret;
+	}
+
+	mmc_test_print_perf(test, write ? "Randomly wrote" : "Randomly read",
+		AREA_RND_SIZE, min_t(unsigned long, AREA_RND_SIZE, PAGE_SIZE),
+		&perf);
+
+	return 0;
+}
+
+static int mmc_test_rnd_write_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rnd_perf(test, 1);
+}
+
+static int mmc_test_rnd_read_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rnd_perf(test, 0);
+}
+
+/*
+ * The same transfers split into 512 byte and page sized segments, to
+ * show the cost of mapping and chaining many segments.
+ */
+static int mmc_test_sg_perf(struct mmc_test_card *test, int write)
+{
+	struct mmc_test_area *t = &test->area;
+	struct mmc_host *host = test->card->host;
+	unsigned long sz;
+	int ret;
+
+	sz = min_t(unsigned long, t->max_sz, host->max_segs * 512);
+	sz &= PAGE_MASK;
+	if (!sz)
+		return RESULT_UNSUP_HOST;
+
+	ret = mmc_test_area_seq(test, sz, 512, write);
+	if (ret)
+		return ret;
+
+	return mmc_test_area_seq(test, sz, PAGE_SIZE, write);
+}
+
+static int mmc_test_sg_write_perf(struct mmc_test_card *test)
+{
+	return mmc_test_sg_perf(test, 1);
+}
+
+static int mmc_test_sg_read_perf(struct mmc_test_card *test)
+{
+	return mmc_test_sg_perf(test, 0);
+}
+
 static const struct mmc_test_case mmc_test_cases[] = {
 	{
 		.name = "Basic write (no data verification)",
@@ -1032,6 +1386,48 @@ static const struct mmc_test_case mmc_test_cases[] = {
 
 #endif /* CONFIG_HIGHMEM */
 
+	{
+		.name = "Sequential write performance",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_seq_write_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Sequential read performance",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_seq_read_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Random write performance",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_rnd_write_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Random read performance",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_rnd_read_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Scatter-gather write performance",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_sg_write_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Scatter-gather read performance",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_sg_read_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
 };
 
 static DEFINE_MUTEX(mmc_test_lock);
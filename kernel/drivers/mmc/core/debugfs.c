@@ -15,6 +15,7 @@
 
 #include <linux/mmc/card.h>
 #include <linux/mmc/host.h>
+#include <linux/mmc/mmc.h>
 
 #include "core.h"
 #include "mmc_ops.h"
@@ -247,6 +248,34 @@ static const struct file_operations mmc_dbg_ext_csd_fops = {
 	.release	= mmc_ext_csd_release,
 };
 
+static int mmc_cache_show(struct seq_file *s, void *data)
+{
+	struct mmc_card *card = s->private;
+
+	seq_printf(s, "size:\t\t%u KB\n", card->ext_csd.cache_size);
+	seq_printf(s, "enabled:\t%d\n", card->ext_csd.cache_ctrl);
+	seq_printf(s, "flushes:\t%lu\n", card->cache_flushes);
+	seq_printf(s, "flush time:\t%lu ms\n", card->cache_flush_ms);
+	seq_printf(s, "rel sectors:\t%u%s\n", card->ext_csd.rel_sectors,
+		   card->ext_csd.rel_param & EXT_CSD_WR_REL_PARAM_EN ?
+		   " (enhanced)" : "");
+	seq_printf(s, "rel writes:\t%lu\n", card->rel_writes);
+
+	return 0;
+}
+
+static int mmc_cache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_cache_show, inode->i_private);
+}
+
+static const struct file_operations mmc_dbg_cache_fops = {
+	.open		= mmc_cache_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void mmc_add_card_debugfs(struct mmc_card *card)
 {
 	struct mmc_host	*host = card->host;
@@ -279,6 +308,11 @@ void mmc_add_card_debugfs(struct mmc_card *card)
 					&mmc_dbg_ext_csd_fops))
 			goto err;
 
+	if (mmc_card_mmc(card))
+		if (!debugfs_create_file("cache", S_IRUSR, root, card,
+					&mmc_dbg_cache_fops))
+			goto err;
+
 	return;
 
 err:
@@ -589,13 +589,23 @@ static inline void mmci_disable_dma(struct mmci_host *host)
 	host->dma_enable = false;
 }
 
-static void mmci_dma_data_end(struct mmci_host *host)
+/*
+ * Data prepared by mmci_pre_request() stays mapped until
+ * mmci_post_request(), while the next request may already run.
+ */
+static void mmci_dma_unmap(struct mmci_host *host, struct mmc_data *data)
 {
-	struct mmc_data *data = host->data;
+	if (data->host_cookie)
+		return;
 
 	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
 		     (data->flags & MMC_DATA_WRITE)
 		     ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+}
+
+static void mmci_dma_data_end(struct mmci_host *host)
+{
+	mmci_dma_unmap(host, host->data);
 	host->dma_on_current_xfer = false;
 }
 
@@ -609,9 +619,7 @@ static void mmci_dma_terminate(struct mmci_host *host)
 		chan = host->dma_rx_channel;
 	else
 		chan = host->dma_tx_channel;
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-		     (data->flags & MMC_DATA_WRITE)
-		     ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	mmci_dma_unmap(host, data);
 	chan->device->device_control(chan, DMA_TERMINATE_ALL, 0);
 	host->dma_on_current_xfer = false;
 }
@@ -656,7 +664,14 @@ static void mmci_dma_callback(void *arg)
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
-static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
+/*
+ * Map the sg list and build the DMA descriptor for a data transfer.
+ * This does not touch the controller, so it may run for the next
+ * request while the current one is still transferring.
+ */
+static int mmci_dma_prep_data(struct mmci_host *host, struct mmc_data *data,
+			      struct dma_chan **dma_chan,
+			      struct dma_async_tx_descriptor **dma_desc)
 {
 	struct variant_data *variant = host->variant;
 	struct dma_slave_config conf = {
@@ -667,7 +682,6 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 		.src_maxburst = variant->fifohalfsize >> 2, /* # of words */
 		.dst_maxburst = variant->fifohalfsize >> 2, /* # of words */
 	};
-	struct mmc_data *data = host->data;
 	struct dma_chan *chan;
 	struct dma_device *device;
 	struct dma_async_tx_descriptor *desc;
@@ -675,8 +689,6 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 	int maxburst_mult = 0;
 	struct scatterlist *sg;
 	int nr_sg, i;
-	dma_cookie_t cookie;
-	unsigned int irqmask0;
 
 	if (data->flags & MMC_DATA_READ) {
 		conf.direction = DMA_FROM_DEVICE;
@@ -691,7 +703,7 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 		return -EINVAL;
 
 	/* If less than or equal to the fifo size, don't bother with DMA */
-	if (host->size <= variant->fifosize)
+	if (data->blksz * data->blocks <= variant->fifosize)
 		return -EINVAL;
 
 	/*
@@ -740,13 +752,50 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 	desc = device->device_prep_slave_sg(chan, data->sg, nr_sg,
 					    conf.direction,
 					    DMA_CTRL_ACK | DMA_PREP_INTERRUPT);
-	if (!desc)
-		goto unmap_exit;
+	if (!desc) {
+		dma_unmap_sg(device->dev, data->sg, data->sg_len,
+			     conf.direction);
+		return -ENOMEM;
+	}
 
 	/* Setup dma callback function. */
 	desc->callback = mmci_dma_callback;
 	desc->callback_param = host;
 
+	*dma_chan = chan;
+	*dma_desc = desc;
+	return 0;
+}
+
+static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
+{
+	struct variant_data *variant = host->variant;
+	struct mmci_host_next *next = &host->next_data;
+	struct mmc_data *data = host->data;
+	struct dma_chan *chan;
+	struct dma_async_tx_descriptor *desc;
+	dma_cookie_t cookie;
+	unsigned int irqmask0;
+	int ret;
+
+	if (data->host_cookie && data->host_cookie == next->cookie &&
+	    next->dma_desc) {
+		/* Prepared by mmci_pre_request() */
+		chan = next->dma_chan;
+		desc = next->dma_desc;
+		next->dma_chan = NULL;
+		next->dma_desc = NULL;
+	} else {
+		if (data->host_cookie) {
+			/* Stale preparation, redo it */
+			data->host_cookie = 0;
+			mmci_dma_unmap(host, data);
+		}
+		ret = mmci_dma_prep_data(host, data, &chan, &desc);
+		if (ret)
+			return ret;
+	}
+
 	/* Okay, go for it. */
 	dev_vdbg(mmc_dev(host->mmc),
 		 "Submit MMCI DMA job, sglen %d blksz %04x blks %04x flags %08x\n",
@@ -758,7 +807,7 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 		goto unmap_exit;
 
 	host->dma_on_current_xfer = true;
-	device->device_issue_pending(chan);
+	chan->device->device_issue_pending(chan);
 
 	datactrl |= variant->dmareg_enable | MCI_DPSM_DMAENABLE;
 
@@ -777,10 +826,64 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 	return 0;
 
 unmap_exit:
-	device->device_control(chan, DMA_TERMINATE_ALL, 0);
-	dma_unmap_sg(device->dev, data->sg, data->sg_len, conf.direction);
+	chan->device->device_control(chan, DMA_TERMINATE_ALL, 0);
+	/* PIO takes over, the sg list must not stay mapped */
+	data->host_cookie = 0;
+	mmci_dma_unmap(host, data);
 	return -ENOMEM;
 }
+
+static void mmci_pre_request(struct mmc_host *mmc, struct mmc_request *mrq,
+			     bool is_first_req)
+{
+	struct mmci_host *host = mmc_priv(mmc);
+	struct mmci_host_next *next = &host->next_data;
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !host->dma_enable || data->host_cookie)
+		return;
+
+	/* Only one request is prepared ahead */
+	if (next->dma_desc)
+		return;
+
+	if (mmci_dma_prep_data(host, data, &next->dma_chan, &next->dma_desc))
+		return;
+
+	data->host_cookie = ++next->cookie < 0 ? 1 : next->cookie;
+}
+
+static void mmci_post_request(struct mmc_host *mmc, struct mmc_request *mrq,
+			      int err)
+{
+	struct mmci_host *host = mmc_priv(mmc);
+	struct mmci_host_next *next = &host->next_data;
+	struct mmc_data *data = mrq->data;
+	struct dma_chan *chan;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	if (data->flags & MMC_DATA_READ)
+		chan = host->dma_rx_channel;
+	else
+		chan = host->dma_tx_channel;
+
+	/*
+	 * Prepared but never issued. The DMA driver can only release the
+	 * descriptor once it is queued, so queue it and terminate at once.
+	 */
+	if (err && data->host_cookie == next->cookie && next->dma_desc) {
+		chan = next->dma_chan;
+		next->dma_desc->tx_submit(next->dma_desc);
+		chan->device->device_control(chan, DMA_TERMINATE_ALL, 0);
+		next->dma_chan = NULL;
+		next->dma_desc = NULL;
+	}
+
+	data->host_cookie = 0;
+	mmci_dma_unmap(host, data);
+}
 #else
 /* Blank functions if the DMA engine is not available */
 static inline void mmci_setup_dma(struct mmci_host *host)
@@ -804,6 +907,9 @@ static inline int mmci_dma_start_data(struct mmci_host *host,
 {
 	return -ENOSYS;
 }
+
+#define mmci_pre_request NULL
+#define mmci_post_request NULL
 #endif
 
 static void mmci_dataend_timeout(struct work_struct *work)
@@ -1823,6 +1929,8 @@ static void mmci_abort_request(struct mmc_host *mmc)
 }
 
 static const struct mmc_host_ops mmci_ops = {
+	.pre_req	= mmci_pre_request,
+	.post_req	= mmci_post_request,
 	.request	= mmci_request,
 	.set_ios	= mmci_set_ios,
 	.get_ro		= mmci_get_ro,
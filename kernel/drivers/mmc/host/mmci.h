@@ -164,6 +164,13 @@ struct variant_data;
 struct dma_chan;
 struct dma_async_tx_descriptor;
 
+/* DMA job prepared by mmci_pre_request() for the next request */
+struct mmci_host_next {
+	struct dma_async_tx_descriptor	*dma_desc;
+	struct dma_chan			*dma_chan;
+	s32				cookie;
+};
+
 struct mmci_host {
 	phys_addr_t		phybase;
 	void __iomem		*base;
@@ -219,6 +226,7 @@ struct mmci_host {
 #ifdef CONFIG_DMA_ENGINE
 	struct dma_chan		*dma_rx_channel;
 	struct dma_chan		*dma_tx_channel;
+	struct mmci_host_next	next_data;
 #endif
 
 #ifdef CONFIG_DEBUG_FS
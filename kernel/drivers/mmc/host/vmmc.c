@@ -0,0 +1,647 @@
+/*
+ *  linux/drivers/mmc/host/vmmc.c - RAM backed virtual MMC host
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * A host with an eMMC card behind it that lives in vmalloc'd memory.
+ * It needs no hardware, so mmc_test and the block driver can be run
+ * and timed on any machine. Commands cost a fixed latency, data moves
+ * at the slower of the bus and the media rate, partly written erase
+ * blocks pay a read-modify-write penalty and the EXT_CSD volatile
+ * cache absorbs writes until it is flushed. Every request completes
+ * from an hrtimer once its modelled time has passed, the way a DMA
+ * interrupt would.
+ */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/platform_device.h>
+#include <linux/hrtimer.h>
+#include <linux/vmalloc.h>
+#include <linux/scatterlist.h>
+#include <linux/spinlock.h>
+
+#include <linux/mmc/host.h>
+#include <linux/mmc/mmc.h>
+
+#include <asm/div64.h>
+
+#define DRIVER_NAME "vmmc"
+
+static unsigned int size_mb = 64;
+module_param(size_mb, uint, 0444);
+MODULE_PARM_DESC(size_mb, "Card size in MiB, 1 to 1024");
+
+static unsigned int erase_block_kb = 512;
+module_param(erase_block_kb, uint, 0444);
+MODULE_PARM_DESC(erase_block_kb, "Erase block size in KiB, multiple of 512");
+
+static unsigned int cache_kb = 256;
+module_param(cache_kb, uint, 0444);
+MODULE_PARM_DESC(cache_kb, "Volatile cache size in KiB, 0 for none");
+
+static unsigned int cmd_latency_us = 20;
+module_param(cmd_latency_us, uint, 0644);
+MODULE_PARM_DESC(cmd_latency_us, "Time taken by every command");
+
+static unsigned int read_kbps = 40000;
+module_param(read_kbps, uint, 0644);
+MODULE_PARM_DESC(read_kbps, "Media read rate in KiB/s");
+
+static unsigned int write_kbps = 15000;
+module_param(write_kbps, uint, 0644);
+MODULE_PARM_DESC(write_kbps, "Media write rate in KiB/s");
+
+static unsigned int rmw_latency_us = 2000;
+module_param(rmw_latency_us, uint, 0644);
+MODULE_PARM_DESC(rmw_latency_us, "Penalty for each partly written erase block");
+
+static unsigned int erase_latency_us = 500;
+module_param(erase_latency_us, uint, 0644);
+MODULE_PARM_DESC(erase_latency_us, "Time taken to erase one erase block");
+
+/* Card states, as reported in R1 */
+#define VMMC_IDLE	0
+#define VMMC_READY	1
+#define VMMC_IDENT	2
+#define VMMC_STBY	3
+#define VMMC_TRAN	4
+#define VMMC_SLP	10
+
+/* Busy done, 2.7-3.6V, byte addressed */
+#define VMMC_OCR	0x80ff8000
+
+struct vmmc_host {
+	struct mmc_host		*mmc;
+	spinlock_t		lock;
+	struct mmc_request	*mrq;
+	struct hrtimer		timer;
+
+	u8			*ram;
+	unsigned long		size;		/* in bytes */
+	unsigned long		erase_size;	/* in bytes */
+	u32			raw_cid[4];
+	u32			raw_csd[4];
+	u8			ext_csd[512];
+
+	unsigned int		state;
+	u16			rca;
+	unsigned int		sbc_blocks;	/* set by CMD23 */
+	bool			sbc_reliable;
+	unsigned long		erase_start;
+	unsigned long		erase_end;
+	unsigned long		dirty;		/* bytes held in the cache */
+};
+
+#define vmmc_r1(h)	(((h)->state << 9) | R1_READY_FOR_DATA)
+
+/*
+ * The reverse of UNSTUFF_BITS() in core/mmc.c, resp[0] holds the
+ * most significant word of the 128 bit register.
+ */
+static void vmmc_stuff_bits(u32 *resp, int start, int size, u32 val)
+{
+	const int off = 3 - (start / 32);
+	const int shft = start & 31;
+	u64 v = (u64)(val & (u32)((1ULL << size) - 1)) << shft;
+
+	resp[off] |= (u32)v;
+	if (shft + size > 32)
+		resp[off - 1] |= (u32)(v >> 32);
+}
+
+static void vmmc_init_regs(struct vmmc_host *host)
+{
+	u32 *cid = host->raw_cid, *csd = host->raw_csd;
+	u8 *ext_csd = host->ext_csd;
+	unsigned long sectors = host->size >> 9;
+	static const char name[] = "VMMC  ";
+	int i;
+
+	vmmc_stuff_bits(cid, 120, 8, 0xfe);		/* manfid */
+	vmmc_stuff_bits(cid, 104, 16, 0x564d);		/* oemid */
+	for (i = 0; i < 6; i++)
+		vmmc_stuff_bits(cid, 96 - i * 8, 8, name[i]);
+	vmmc_stuff_bits(cid, 16, 32, 0x1);		/* serial */
+	vmmc_stuff_bits(cid, 8, 8, 0x1d);		/* jan 2010 */
+
+	vmmc_stuff_bits(csd, 126, 2, 2);		/* CSD v1.2 */
+	vmmc_stuff_bits(csd, 122, 4, 4);		/* MMC v4 */
+	vmmc_stuff_bits(csd, 112, 8, 0x09);		/* TAAC */
+	vmmc_stuff_bits(csd, 96, 8, 0x32);		/* 26MHz */
+	vmmc_stuff_bits(csd, 84, 12, 0x8f5);		/* CCC */
+	vmmc_stuff_bits(csd, 80, 4, 9);			/* READ_BL_LEN */
+	/* capacity = (C_SIZE + 1) << (C_SIZE_MULT + 2) blocks */
+	vmmc_stuff_bits(csd, 62, 12, (sectors >> 9) - 1);
+	vmmc_stuff_bits(csd, 47, 3, 7);
+	vmmc_stuff_bits(csd, 42, 5, 31);		/* ERASE_GRP_SIZE */
+	vmmc_stuff_bits(csd, 37, 5, 31);		/* ERASE_GRP_MULT */
+	vmmc_stuff_bits(csd, 26, 3, 2);			/* R2W_FACTOR */
+	vmmc_stuff_bits(csd, 22, 4, 9);			/* WRITE_BL_LEN */
+
+	ext_csd[EXT_CSD_REV] = 6;
+	ext_csd[EXT_CSD_STRUCTURE] = 2;
+	ext_csd[EXT_CSD_CARD_TYPE] = EXT_CSD_CARD_TYPE_26 |
+				     EXT_CSD_CARD_TYPE_52;
+	for (i = 0; i < 4; i++)
+		ext_csd[EXT_CSD_SEC_CNT + i] = sectors >> (i * 8);
+	ext_csd[EXT_CSD_S_A_TIMEOUT] = 0x11;
+	ext_csd[EXT_CSD_HC_ERASE_GRP_SIZE] = erase_block_kb / 512;
+	ext_csd[EXT_CSD_ACC_SIZE] = 4;			/* 4KiB pages */
+	ext_csd[EXT_CSD_REL_WR_SEC_C] = 1;
+	ext_csd[EXT_CSD_WR_REL_PARAM] = EXT_CSD_WR_REL_PARAM_EN;
+	for (i = 0; i < 4; i++)
+		ext_csd[EXT_CSD_CACHE_SIZE + i] = cache_kb >> (i * 8);
+}
+
+/*
+ * Time to move @bytes: the slower of the bus, as set up through
+ * set_ios, and the media at @kbps. A zero @kbps only counts the bus.
+ */
+static u64 vmmc_xfer_ns(struct vmmc_host *host, unsigned int bytes,
+			unsigned int kbps)
+{
+	struct mmc_ios *ios = &host->mmc->ios;
+	unsigned int bits;
+	u64 bus_ns, media_ns = 0;
+
+	switch (ios->bus_width) {
+	case MMC_BUS_WIDTH_8:
+		bits = 8;
+		break;
+	case MMC_BUS_WIDTH_4:
+		bits = 4;
+		break;
+	default:
+		bits = 1;
+	}
+	if (ios->ddr)
+		bits *= 2;
+
+	bus_ns = (u64)bytes * 8 * NSEC_PER_SEC;
+	do_div(bus_ns, max(ios->clock, 1u) * bits);
+
+	if (kbps) {
+		media_ns = (u64)bytes * NSEC_PER_SEC;
+		do_div(media_ns, kbps * 1024);
+	}
+
+	return max(bus_ns, media_ns);
+}
+
+static u64 vmmc_flush_ns(struct vmmc_host *host)
+{
+	u64 ns = vmmc_xfer_ns(host, host->dirty, write_kbps);
+
+	host->dirty = 0;
+	return ns;
+}
+
+static u64 vmmc_write_ns(struct vmmc_host *host, unsigned long offs,
+			 unsigned int bytes, bool reliable)
+{
+	unsigned long eb = host->erase_size;
+	unsigned int partial = 0;
+	u64 ns = 0;
+
+	/* Cached writes cost bus time, the media is paid at flush */
+	if ((host->ext_csd[EXT_CSD_CACHE_CTRL] & 1) && !reliable &&
+	    bytes <= cache_kb * 1024) {
+		if (host->dirty + bytes > cache_kb * 1024)
+			ns = vmmc_flush_ns(host);
+		host->dirty += bytes;
+		return ns + vmmc_xfer_ns(host, bytes, 0);
+	}
+
+	if (offs % eb)
+		partial++;
+	if ((offs + bytes) % eb &&
+	    (!(offs % eb) || (offs + bytes) / eb != offs / eb))
+		partial++;
+
+	ns = vmmc_xfer_ns(host, bytes, write_kbps);
+	return ns + (u64)partial * rmw_latency_us * NSEC_PER_USEC;
+}
+
+static u64 vmmc_switch(struct vmmc_host *host, struct mmc_command *cmd)
+{
+	u8 index = (cmd->arg >> 16) & 0xff;
+	u8 value = (cmd->arg >> 8) & 0xff;
+	u64 ns = 0;
+
+	if (((cmd->arg >> 24) & 3) != MMC_SWITCH_MODE_WRITE_BYTE) {
+		cmd->resp[0] |= R1_SWITCH_ERROR;
+		return 0;
+	}
+
+	switch (index) {
+	case EXT_CSD_FLUSH_CACHE:
+		ns = vmmc_flush_ns(host);
+		break;
+	case EXT_CSD_CACHE_CTRL:
+		if (!cache_kb) {
+			cmd->resp[0] |= R1_SWITCH_ERROR;
+			return 0;
+		}
+		if (!(value & 1))
+			ns = vmmc_flush_ns(host);
+		host->ext_csd[index] = value & 1;
+		break;
+	case EXT_CSD_ERASE_GROUP_DEF:
+	case EXT_CSD_BUS_WIDTH:
+	case EXT_CSD_HS_TIMING:
+		host->ext_csd[index] = value;
+		break;
+	default:
+		cmd->resp[0] |= R1_SWITCH_ERROR;
+	}
+
+	return ns;
+}
+
+static u64 vmmc_rw(struct vmmc_host *host, struct mmc_command *cmd,
+		   struct mmc_data *data, unsigned int blocks, bool write)
+{
+	unsigned long offs = cmd->arg;
+	unsigned int len;
+	u64 ns;
+
+	len = min(blocks, data->blocks) * data->blksz;
+	if (offs + len > host->size || offs + len < offs) {
+		cmd->resp[0] |= R1_OUT_OF_RANGE;
+		data->error = -ETIMEDOUT;
+		return 0;
+	}
+
+	if (write) {
+		sg_copy_to_buffer(data->sg, data->sg_len, host->ram + offs, len);
+		ns = vmmc_write_ns(host, offs, len, host->sbc_reliable);
+	} else {
+		sg_copy_from_buffer(data->sg, data->sg_len, host->ram + offs,
+				    len);
+		ns = vmmc_xfer_ns(host, len, read_kbps);
+	}
+	data->bytes_xfered = len;
+
+	return ns;
+}
+
+static u64 vmmc_erase(struct vmmc_host *host, struct mmc_command *cmd)
+{
+	unsigned long eb = host->erase_size;
+	unsigned long first = host->erase_start / eb;
+	unsigned long last = host->erase_end / eb;
+
+	if (first > last || (last + 1) * eb > host->size) {
+		cmd->resp[0] |= R1_ERASE_SEQ_ERROR;
+		return 0;
+	}
+
+	memset(host->ram + first * eb, 0, (last - first + 1) * eb);
+
+	return (u64)(last - first + 1) * erase_latency_us * NSEC_PER_USEC;
+}
+
+/*
+ * Execute one command on the card. Fills in the response and returns
+ * the time the card takes for its data or busy phase.
+ */
+static u64 vmmc_do_cmd(struct vmmc_host *host, struct mmc_command *cmd,
+		       struct mmc_data *data)
+{
+	unsigned int blocks = 0;	/* blocks the card will transfer */
+	u64 ns = 0;
+
+	switch (cmd->opcode) {
+	case MMC_GO_IDLE_STATE:
+		host->state = VMMC_IDLE;
+		host->sbc_blocks = 0;
+		host->ext_csd[EXT_CSD_CACHE_CTRL] = 0;
+		host->dirty = 0;
+		return 0;
+
+	case MMC_SEND_OP_COND:
+		cmd->resp[0] = VMMC_OCR;
+		if (cmd->arg && host->state == VMMC_IDLE)
+			host->state = VMMC_READY;
+		return 0;
+
+	case MMC_ALL_SEND_CID:
+		if (host->state != VMMC_READY)
+			goto no_response;
+		memcpy(cmd->resp, host->raw_cid, sizeof(host->raw_cid));
+		host->state = VMMC_IDENT;
+		return 0;
+
+	case MMC_SET_RELATIVE_ADDR:
+		host->rca = cmd->arg >> 16;
+		cmd->resp[0] = vmmc_r1(host);
+		host->state = VMMC_STBY;
+		return 0;
+
+	case MMC_SEND_CSD:
+	case MMC_SEND_CID:
+		if ((cmd->arg >> 16) != host->rca)
+			goto no_response;
+		if (cmd->opcode == MMC_SEND_CSD)
+			memcpy(cmd->resp, host->raw_csd, sizeof(host->raw_csd));
+		else
+			memcpy(cmd->resp, host->raw_cid, sizeof(host->raw_cid));
+		return 0;
+
+	case MMC_SELECT_CARD:
+		if ((cmd->arg >> 16) != host->rca) {
+			/* Deselected, no response */
+			host->state = VMMC_STBY;
+			return 0;
+		}
+		cmd->resp[0] = vmmc_r1(host);
+		host->state = VMMC_TRAN;
+		return 0;
+
+	case MMC_SLEEP_AWAKE:
+		/* CMD5 is also the SDIO IO_SEND_OP_COND, which we ignore */
+		if (mmc_cmd_type(cmd) == MMC_CMD_BCR)
+			goto no_response;
+		cmd->resp[0] = vmmc_r1(host);
+		host->state = (cmd->arg & (1 << 15)) ? VMMC_SLP : VMMC_STBY;
+		return 0;
+
+	case MMC_SWITCH:
+		cmd->resp[0] = vmmc_r1(host);
+		ns = vmmc_switch(host, cmd);
+		break;
+
+	case MMC_SEND_EXT_CSD:
+		/* Without data this is the SD SEND_IF_COND */
+		if (!data)
+			goto no_response;
+		cmd->resp[0] = vmmc_r1(host);
+		blocks = 1;
+		sg_copy_from_buffer(data->sg, data->sg_len, host->ext_csd,
+				    sizeof(host->ext_csd));
+		data->bytes_xfered = min_t(unsigned int, sizeof(host->ext_csd),
+					   data->blocks * data->blksz);
+		ns = vmmc_xfer_ns(host, sizeof(host->ext_csd), 0);
+		break;
+
+	case MMC_SEND_STATUS:
+	case MMC_SET_BLOCKLEN:
+		cmd->resp[0] = vmmc_r1(host);
+		break;
+
+	case MMC_STOP_TRANSMISSION:
+		cmd->resp[0] = vmmc_r1(host);
+		host->sbc_blocks = 0;
+		break;
+
+	case MMC_SET_BLOCK_COUNT:
+		cmd->resp[0] = vmmc_r1(host);
+		host->sbc_blocks = cmd->arg & 0xffff;
+		host->sbc_reliable = !!(cmd->arg & (1 << 31));
+		return 0;
+
+	case MMC_READ_SINGLE_BLOCK:
+	case MMC_READ_MULTIPLE_BLOCK:
+	case MMC_WRITE_BLOCK:
+	case MMC_WRITE_MULTIPLE_BLOCK:
+		if (!data || host->state != VMMC_TRAN)
+			goto no_response;
+		cmd->resp[0] = vmmc_r1(host);
+		if (cmd->opcode == MMC_READ_SINGLE_BLOCK ||
+		    cmd->opcode == MMC_WRITE_BLOCK)
+			blocks = 1;
+		else if (host->sbc_blocks)
+			blocks = host->sbc_blocks;
+		else
+			blocks = data->blocks;
+		ns = vmmc_rw(host, cmd, data, blocks,
+			     cmd->opcode == MMC_WRITE_BLOCK ||
+			     cmd->opcode == MMC_WRITE_MULTIPLE_BLOCK);
+		host->sbc_blocks = 0;
+		host->sbc_reliable = 0;
+		break;
+
+	case MMC_ERASE_GROUP_START:
+		cmd->resp[0] = vmmc_r1(host);
+		host->erase_start = cmd->arg;
+		return 0;
+
+	case MMC_ERASE_GROUP_END:
+		cmd->resp[0] = vmmc_r1(host);
+		host->erase_end = cmd->arg;
+		return 0;
+
+	case MMC_ERASE:
+		cmd->resp[0] = vmmc_r1(host);
+		ns = vmmc_erase(host, cmd);
+		break;
+
+	default:
+		goto no_response;
+	}
+
+	/* The card stops short of what the host asked for */
+	if (data && !data->error && data->blocks > blocks)
+		data->error = -ETIMEDOUT;
+
+	return ns;
+
+no_response:
+	cmd->error = -ETIMEDOUT;
+	return 0;
+}
+
+static enum hrtimer_restart vmmc_timer(struct hrtimer *timer)
+{
+	struct vmmc_host *host = container_of(timer, struct vmmc_host, timer);
+	struct mmc_request *mrq;
+	unsigned long flags;
+
+	spin_lock_irqsave(&host->lock, flags);
+	mrq = host->mrq;
+	host->mrq = NULL;
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	if (mrq)
+		mmc_request_done(host->mmc, mrq);
+
+	return HRTIMER_NORESTART;
+}
+
+static void vmmc_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct vmmc_host *host = mmc_priv(mmc);
+	unsigned long flags;
+	u64 ns;
+
+	spin_lock_irqsave(&host->lock, flags);
+
+	WARN_ON(host->mrq != NULL);
+	host->mrq = mrq;
+
+	ns = (u64)cmd_latency_us * NSEC_PER_USEC;
+	ns += vmmc_do_cmd(host, mrq->cmd, mrq->data);
+	if (mrq->data && mrq->stop) {
+		ns += (u64)cmd_latency_us * NSEC_PER_USEC;
+		ns += vmmc_do_cmd(host, mrq->stop, NULL);
+	}
+
+	hrtimer_start(&host->timer, ns_to_ktime(ns), HRTIMER_MODE_REL);
+
+	spin_unlock_irqrestore(&host->lock, flags);
+}
+
+static void vmmc_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
+{
+	/* The bus settings are read from mmc->ios when timing transfers */
+}
+
+static int vmmc_get_ro(struct mmc_host *mmc)
+{
+	return 0;
+}
+
+static int vmmc_get_cd(struct mmc_host *mmc)
+{
+	return 1;
+}
+
+static void vmmc_dump_regs(struct mmc_host *mmc)
+{
+	struct vmmc_host *host = mmc_priv(mmc);
+
+	dev_info(mmc_dev(mmc), "state %u, rca %u, cache dirty %lu bytes\n",
+		 host->state, host->rca, host->dirty);
+}
+
+static const struct mmc_host_ops vmmc_ops = {
+	.request	= vmmc_request,
+	.set_ios	= vmmc_set_ios,
+	.get_ro		= vmmc_get_ro,
+	.get_cd		= vmmc_get_cd,
+	.dump_regs	= vmmc_dump_regs,
+};
+
+static int __devinit vmmc_probe(struct platform_device *pdev)
+{
+	struct mmc_host *mmc;
+	struct vmmc_host *host;
+	int ret;
+
+	if (!size_mb || size_mb > 1024 || !erase_block_kb ||
+	    erase_block_kb % 512 || erase_block_kb > size_mb * 1024) {
+		dev_err(&pdev->dev, "invalid card geometry\n");
+		return -EINVAL;
+	}
+
+	mmc = mmc_alloc_host(sizeof(struct vmmc_host), &pdev->dev);
+	if (!mmc)
+		return -ENOMEM;
+
+	host = mmc_priv(mmc);
+	host->mmc = mmc;
+	host->size = (unsigned long)size_mb << 20;
+	host->erase_size = erase_block_kb * 1024;
+	spin_lock_init(&host->lock);
+	hrtimer_init(&host->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	host->timer.function = vmmc_timer;
+
+	host->ram = vmalloc(host->size);
+	if (!host->ram) {
+		ret = -ENOMEM;
+		goto free_host;
+	}
+	memset(host->ram, 0, host->size);
+
+	vmmc_init_regs(host);
+
+	mmc->ops = &vmmc_ops;
+	mmc->f_min = 400000;
+	mmc->f_max = 52000000;
+	mmc->ocr_avail = MMC_VDD_32_33 | MMC_VDD_33_34;
+	mmc->caps = MMC_CAP_4_BIT_DATA | MMC_CAP_8_BIT_DATA |
+		    MMC_CAP_MMC_HIGHSPEED | MMC_CAP_NONREMOVABLE |
+		    MMC_CAP_WAIT_WHILE_BUSY;
+
+	mmc->max_segs = 128;
+	mmc->max_blk_size = 512;
+	mmc->max_blk_count = 1024;
+	mmc->max_req_size = mmc->max_blk_count * mmc->max_blk_size;
+	mmc->max_seg_size = mmc->max_req_size;
+
+	ret = mmc_add_host(mmc);
+	if (ret)
+		goto free_ram;
+
+	platform_set_drvdata(pdev, mmc);
+
+	dev_info(&pdev->dev, "%u MiB card, %u KiB erase blocks, "
+		 "%u KiB cache\n", size_mb, erase_block_kb, cache_kb);
+
+	return 0;
+
+free_ram:
+	vfree(host->ram);
+free_host:
+	mmc_free_host(mmc);
+	return ret;
+}
+
+static int __devexit vmmc_remove(struct platform_device *pdev)
+{
+	struct mmc_host *mmc = platform_get_drvdata(pdev);
+	struct vmmc_host *host = mmc_priv(mmc);
+
+	platform_set_drvdata(pdev, NULL);
+
+	mmc_remove_host(mmc);
+	hrtimer_cancel(&host->timer);
+	vfree(host->ram);
+	mmc_free_host(mmc);
+
+	return 0;
+}
+
+static struct platform_driver vmmc_driver = {
+	.probe		= vmmc_probe,
+	.remove		= __devexit_p(vmmc_remove),
+	.driver		= {
+		.name	= DRIVER_NAME,
+		.owner	= THIS_MODULE,
+	},
+};
+
+static struct platform_device *vmmc_device;
+
+static int __init vmmc_init(void)
+{
+	int ret;
+
+	ret = platform_driver_register(&vmmc_driver);
+	if (ret)
+		return ret;
+
+	vmmc_device = platform_device_register_simple(DRIVER_NAME, -1,
+						      NULL, 0);
+	if (IS_ERR(vmmc_device)) {
+		platform_driver_unregister(&vmmc_driver);
+		return PTR_ERR(vmmc_device);
+	}
+
+	return 0;
+}
+
+static void __exit vmmc_exit(void)
+{
+	platform_device_unregister(vmmc_device);
+	platform_driver_unregister(&vmmc_driver);
+}
+
+module_init(vmmc_init);
+module_exit(vmmc_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("RAM backed virtual MMC host");
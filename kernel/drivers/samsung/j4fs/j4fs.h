@@ -442,6 +442,7 @@ extern int j4fs_readpage_unlock(struct file *f, struct page *page);
 extern int j4fs_readpage_nolock(struct file *f, struct page *page);
 extern int j4fs_file_write(struct file *f, const char *buf, size_t n,loff_t *pos);
 extern int j4fs_hold_space(int size);
+extern void j4fs_index_invalidate(void);
 
 extern void msleep(unsigned int msecs);
 
@@ -20,6 +20,7 @@
 #include <linux/buffer_head.h>
 #include <linux/mpage.h>
 #include <linux/slab.h>
+#include <linux/hash.h>
 #include "j4fs.h"
 
 #if defined(J4FS_USE_XSR)
@@ -74,6 +75,165 @@ void j4fs_GrossUnlock(void)
 	up(&device_info.grossLock);
 }
 
+/*
+ * In-memory index of the j4fs_header chain
+ *
+ * Every latest valid j4fs_header (the last valid one for each inode number) is kept in memory with the offset it was read from,
+ * hashed by filename and by inode number, and listed in chain order for readdir. The index is built at j4fs_fill_super() and
+ * dropped by FlashDevWrite(), so fsd_write(), fsd_unlink(), fsd_reclaim() and file creation all leave it stale; it is then
+ * rebuilt by the next user with one walk of the chain. Lookups cost no flash read while the partition is not written.
+ * All of it is protected by the gross lock.
+ */
+#define J4FS_INDEX_HASH_BITS	5
+#define J4FS_INDEX_HASH_SIZE	(1 << J4FS_INDEX_HASH_BITS)
+
+struct j4fs_index_entry {
+	struct hlist_node name_hash;
+	struct hlist_node id_hash;
+	struct list_head list;			// chain order of the latest headers
+	DWORD offset;					// offset of the j4fs_header in flash
+	struct j4fs_inode header;
+};
+
+static struct hlist_head j4fs_index_name[J4FS_INDEX_HASH_SIZE];
+static struct hlist_head j4fs_index_id[J4FS_INDEX_HASH_SIZE];
+static LIST_HEAD(j4fs_index_list);
+static int j4fs_index_valid;
+
+static inline struct hlist_head *j4fs_index_name_head(const char *name)
+{
+	return &j4fs_index_name[full_name_hash(name, strlen(name)) & (J4FS_INDEX_HASH_SIZE - 1)];
+}
+
+static inline struct hlist_head *j4fs_index_id_head(DWORD id)
+{
+	return &j4fs_index_id[hash_32(id, J4FS_INDEX_HASH_BITS)];
+}
+
+void j4fs_index_invalidate(void)
+{
+	j4fs_index_valid=0;
+}
+
+static void j4fs_index_free(void)
+{
+	struct j4fs_index_entry *entry, *next;
+
+	list_for_each_entry_safe(entry, next, &j4fs_index_list, list) {
+		list_del(&entry->list);
+		kfree(entry);
+	}
+
+	memset(j4fs_index_name, 0, sizeof(j4fs_index_name));
+	memset(j4fs_index_id, 0, sizeof(j4fs_index_id));
+	j4fs_index_valid=0;
+}
+
+static struct j4fs_index_entry *j4fs_index_find_id(DWORD id)
+{
+	struct j4fs_index_entry *entry;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(entry, node, j4fs_index_id_head(id), id_hash) {
+		if(entry->header.i_id==id) return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Walk the j4fs_header chain once and index the latest valid header of each inode number.
+ * Gross lock held.
+ */
+static int j4fs_index_build(void)
+{
+	struct j4fs_index_entry *entry;
+	struct j4fs_inode *raw_inode;
+	unsigned int cur_link;
+	int nErr, ret=-EIO;
+	BYTE *buf;
+
+	j4fs_index_free();
+
+	buf=kmalloc(J4FS_BASIC_UNIT_SIZE,GFP_NOFS);
+	if(!buf) return -ENOMEM;
+
+	cur_link=device_info.j4fs_offset;
+	while(cur_link!=0xffffffff)
+	{
+		// check the partition range
+		j4fs_check_partition_range(cur_link);
+
+		nErr = FlashDevRead(&device_info, cur_link, J4FS_BASIC_UNIT_SIZE, buf);
+		if (nErr != 0) {
+			T(J4FS_TRACE_ALWAYS,("%s %d: error(nErr=0x%x)\n",__FUNCTION__,__LINE__,nErr));
+			goto error1;
+		}
+
+		raw_inode = (struct j4fs_inode *)buf;
+
+		//This j4fs_header cannot be interpreted. It means there are no files in this partition(this can happen and this is a normal case) or
+		//this j4fs partition is crashed(this should not happen).
+		if(raw_inode->i_type!=J4FS_FILE_TYPE)
+		{
+			// There are no files in this partition or this first j4fs_header is crashed. So, this case should not happen and/or should be repaired.
+			if(cur_link==device_info.j4fs_offset) {
+				j4fs_panic("There are no files in this partition or this first j4fs_header is crashed. So, this case should not happen and/or should be repaired.");
+				goto error1;
+			}
+
+			// This j4fs partition is crashed by some abnormal cause. This should not happen and should be repaired.
+			j4fs_panic("this j4fs partition is crashed by some abnormal cause.  This should not happen and should be repaired.");
+			goto error1;
+		}
+
+		// check whether this file was deleted
+		if ((raw_inode->i_flags&0x1)==((raw_inode->i_flags&0x2)>>1)) {
+			// a later header of the same inode number supersedes the earlier one
+			entry=j4fs_index_find_id(raw_inode->i_id);
+			if(entry) {
+				hlist_del(&entry->name_hash);
+				list_del(&entry->list);
+			} else {
+				entry=kmalloc(sizeof(*entry),GFP_NOFS);
+				if(!entry) {
+					ret=-ENOMEM;
+					goto error1;
+				}
+				hlist_add_head(&entry->id_hash, j4fs_index_id_head(raw_inode->i_id));
+			}
+
+			entry->offset=cur_link;
+			memcpy(&entry->header, raw_inode, sizeof(entry->header));
+			entry->header.i_filename[J4FS_NAME_LEN-1]=0;
+			hlist_add_head(&entry->name_hash, j4fs_index_name_head(entry->header.i_filename));
+			list_add_tail(&entry->list, &j4fs_index_list);
+		}
+
+		cur_link=raw_inode->i_link;
+	}
+
+	kfree(buf);
+	j4fs_index_valid=1;
+	return 0;
+
+error1:
+	kfree(buf);
+	j4fs_index_free();
+	return ret;
+}
+
+/*
+ * Gross lock held.
+ */
+static int j4fs_index_get(void)
+{
+	if(j4fs_index_valid) return 0;
+
+	T(J4FS_TRACE_FS,("%s %d: rebuilding index\n",__FUNCTION__,__LINE__));
+	return j4fs_index_build();
+}
+
 int j4fs_readpage(struct file *f, struct page *page)
 {
 	T(J4FS_TRACE_FS_READ,("%s %d\n",__FUNCTION__,__LINE__));
@@ -451,83 +611,41 @@ int j4fs_file_write(struct file *f, const char *buf, size_t n, loff_t *pos)
 
 struct j4fs_inode *j4fs_get_inode(struct super_block *sb, ino_t ino)
 {
-	unsigned int cur_link, latest_matching_offset=0xffffffff;
-	struct j4fs_inode *raw_inode;
-	int nErr;
-	BYTE *buf;
+	struct j4fs_index_entry *entry;
+	struct j4fs_inode *raw_inode=NULL;
 
 	T(J4FS_TRACE_FS,("%s %d\n",__FUNCTION__,__LINE__));
 
-	buf=kmalloc(J4FS_BASIC_UNIT_SIZE,GFP_NOFS);
-
 	if(j4fs_panic==1) {
 		T(J4FS_TRACE_ALWAYS,("%s %d: j4fs panic\n",__FUNCTION__,__LINE__));
-		goto error1;
+		return NULL;
 	}
 
 	if (ino != J4FS_ROOT_INO && ino < J4FS_FIRST_INO) goto Einval;
 
-	if(ino==J4FS_ROOT_INO) goto error1;
-
-	// read j4fs_header in flash which inode number is ino
-	cur_link=device_info.j4fs_offset;
-	while(cur_link!=0xffffffff)
-	{
-		// check the partition range
-		j4fs_check_partition_range(cur_link);
+	if(ino==J4FS_ROOT_INO) return NULL;
 
-		nErr = FlashDevRead(&device_info, cur_link, J4FS_BASIC_UNIT_SIZE, buf);
-		if (nErr != 0) {
-			T(J4FS_TRACE_ALWAYS,("%s %d: error(nErr=0x%x)\n",__FUNCTION__,__LINE__,nErr));
-	   		goto error1;
-		}
-
-		raw_inode = (struct j4fs_inode *)buf;
-
-		//This j4fs_header cannot be interpreted. It means there are no files in this partition(this can happen and this is a normal case) or
-		//this j4fs partition is crashed(this should not happen).
-		if(raw_inode->i_type!=J4FS_FILE_TYPE)
-		{
-			// There are no files in this partition or this first j4fs_header is crashed. So, this case should not happen and/or should be repaired.
-			if(cur_link==device_info.j4fs_offset) {
-				j4fs_panic("There are no files in this partition or this first j4fs_header is crashed. So, this case should not happen and/or should be repaired.");
-				goto error1;
-			}
-
-			// This j4fs partition is crashed by some abnormal cause. This should not happen and should be repaired.
-			j4fs_panic("this j4fs partition is crashed by some abnormal cause.  This should not happen and should be repaired.");
-			goto error1;
-		}
+	j4fs_GrossLock();
 
-		// check whether this file was deleted
-		if ((raw_inode->i_flags&0x1)==((raw_inode->i_flags&0x2)>>1)) {
-			if(raw_inode->i_id==ino) latest_matching_offset=cur_link;
-		}
+	if(j4fs_index_get()) {
+		j4fs_GrossUnlock();
+		return NULL;
+	}
 
-		cur_link=raw_inode->i_link;
+	// latest j4fs_header in flash which inode number is ino
+	entry=j4fs_index_find_id(ino);
+	if(entry) {
+		raw_inode=kmalloc(sizeof(*raw_inode),GFP_NOFS);
+		if(raw_inode) memcpy(raw_inode, &entry->header, sizeof(*raw_inode));
 	}
 
-	if(latest_matching_offset!=0xffffffff)
-	{
-		nErr = FlashDevRead(&device_info, latest_matching_offset, J4FS_BASIC_UNIT_SIZE, buf);
-		if (nErr != 0) {
-			T(J4FS_TRACE_ALWAYS,("%s %d: error(nErr=0x%x)\n",__FUNCTION__,__LINE__,nErr));
-	   		goto error1;
-		}
+	j4fs_GrossUnlock();
 
-		raw_inode = (struct j4fs_inode *)buf;
-		return raw_inode;
-	}
+	if(entry) return raw_inode;
 
 Einval:
 	T(J4FS_TRACE_ALWAYS,("%s %d: error(bad inode number: %lu)\n",__FUNCTION__,__LINE__,(unsigned long) ino));
-	kfree(buf);
 	return ERR_PTR(-EINVAL);
-
-error1:
-	kfree(buf);
-	return NULL;
-
 }
 
 void j4fs_read_inode (struct inode * inode)
@@ -610,12 +728,9 @@ bad_inode:
 // TODO : Consider 'dir'
 ino_t j4fs_inode_by_name(struct inode * dir, struct dentry *dentry)
 {
-	unsigned int cur_link;
-	struct j4fs_inode_info *ei = J4FS_I(dir);
-	struct j4fs_inode *raw_inode;
-	ino_t ino;
-	int nErr;
-	BYTE *buf;
+	struct j4fs_index_entry *entry;
+	struct hlist_node *node;
+	ino_t ino=0;
 
 	if(j4fs_panic==1) {
 		T(J4FS_TRACE_ALWAYS,("%s %d: j4fs panic\n",__FUNCTION__,__LINE__));
@@ -624,67 +739,29 @@ ino_t j4fs_inode_by_name(struct inode * dir, struct dentry *dentry)
 
 	T(J4FS_TRACE_FS,("%s %d\n",__FUNCTION__,__LINE__));
 
-	buf=kmalloc(J4FS_BASIC_UNIT_SIZE,GFP_NOFS);
-
-	cur_link=ei->i_link;
-	while(cur_link!=0xffffffff)
-	{
-		// check the partition range
-		j4fs_check_partition_range(cur_link);
-
-		nErr = FlashDevRead(&device_info, cur_link, J4FS_BASIC_UNIT_SIZE, buf);
-		if (nErr != 0) {
-			T(J4FS_TRACE_ALWAYS,("%s %d: error(nErr=0x%x)\n",__FUNCTION__,__LINE__,nErr));
-	   		goto error1;
-		}
-
-		raw_inode = (struct j4fs_inode *) buf;
-
-		//This j4fs_header cannot be interpreted. It means there are no files in this partition(this can happen and this is a normal case) or
-		//this j4fs partition is crashed(this should not happen).
-		if(raw_inode->i_type!=J4FS_FILE_TYPE)
-		{
-			// There are no files in this partition or this first j4fs_header is crashed. So, this case should not happen and/or should be repaired.
-			if(cur_link==ei->i_link) {
-				j4fs_panic("There are no files in this partition or this first j4fs_header is crashed. So, this case should not happen and/or should be repaired.");
-				goto error1;
-			}
+	j4fs_GrossLock();
 
-			// This j4fs partition is crashed by some abnormal cause. This should not happen and should be repaired.
-			j4fs_panic("this j4fs partition is crashed by some abnormal cause.  This should not happen and should be repaired.");
-			goto error1;
-		}
+	if(j4fs_index_get()) goto error1;
 
-		// check whether this file was deleted
-		if ((raw_inode->i_flags&0x1)==((raw_inode->i_flags&0x2)>>1)) {
-			if(!strcmp(raw_inode->i_filename, dentry->d_name.name))
-			{
-				ino = raw_inode->i_id;
-				kfree(buf);
-				return ino;
-			}
+	hlist_for_each_entry(entry, node, j4fs_index_name_head(dentry->d_name.name), name_hash) {
+		if(!strcmp(entry->header.i_filename, dentry->d_name.name)) {
+			ino = entry->header.i_id;
+			break;
 		}
-
-		cur_link=raw_inode->i_link;
 	}
 
 error1:
-	kfree(buf);
+	j4fs_GrossUnlock();
 
-	return 0;
+	return ino;
 
 }
 
 int j4fs_readdir (struct file * filp, void * dirent, filldir_t filldir)
 {
-	unsigned int curoffs, offset, cur_link;
-	struct inode *inode = filp->f_dentry->d_inode;
-	struct j4fs_inode_info *ei = J4FS_I(inode);
-	struct j4fs_inode *raw_inode;
-	int i,j, nErr;
-	BYTE *buf;
-	DWORD valid_offset[128][2];
-	int count=0;
+	unsigned int curoffs, offset;
+	struct j4fs_index_entry *entry;
+	int nErr;
 
 	if(j4fs_panic==1) {
 		T(J4FS_TRACE_ALWAYS,("%s %d: j4fs panic\n",__FUNCTION__,__LINE__));
@@ -693,8 +770,6 @@ int j4fs_readdir (struct file * filp, void * dirent, filldir_t filldir)
 
 	T(J4FS_TRACE_FS,("%s %d\n",__FUNCTION__,__LINE__));
 
-	buf=kmalloc(J4FS_BASIC_UNIT_SIZE,GFP_NOFS);
-
 	j4fs_GrossLock();
 
 	offset = filp->f_pos;
@@ -719,88 +794,32 @@ int j4fs_readdir (struct file * filp, void * dirent, filldir_t filldir)
 		filp->f_pos++;
 	}
 
-	curoffs = 1;
-
-	cur_link=ei->i_link;
-	while(cur_link!=0xffffffff)
-	{
-		// check the partition range
-		j4fs_check_partition_range(cur_link);
-
-		nErr = FlashDevRead(&device_info, cur_link, J4FS_BASIC_UNIT_SIZE, buf);
-		if (nErr != 0) {
-			T(J4FS_TRACE_ALWAYS,("%s %d: error(nErr=0x%x)\n",__FUNCTION__,__LINE__,nErr));
-	   		goto error1;
-		}
-
-		raw_inode = (struct j4fs_inode *) buf;
-
-		//This j4fs_header cannot be interpreted. It means there are no files in this partition(this can happen and this is a normal case) or
-		//this j4fs partition is crashed(this should not happen).
-		if(raw_inode->i_type!=J4FS_FILE_TYPE)
-		{
-			// There are no files in this partition or this first j4fs_header is crashed. So, this case should not happen and/or should be repaired.
-			if(cur_link==ei->i_link) {
-				j4fs_panic("There are no files in this partition or this first j4fs_header is crashed. So, this case should not happen and/or should be repaired.");
-				goto error1;
-			}
-
-			// This j4fs partition is crashed by some abnormal cause. This should not happen and should be repaired.
-			j4fs_panic("this j4fs partition is crashed by some abnormal cause.  This should not happen and should be repaired.");
-			goto error1;
-		}
+	if(j4fs_index_get()) goto error1;
 
-		// check whether this file was deleted
-		if ((raw_inode->i_flags&0x1)==((raw_inode->i_flags&0x2)>>1)) {
-			valid_offset[count][0]=raw_inode->i_id;
-			valid_offset[count][1]=cur_link;
-			count++;
-		}
-		cur_link=raw_inode->i_link;
-	}
+	curoffs = 1;
 
-	// TODO: we exclude last object header because last object header can't decide invalidation of old files. Is it right ???
 	// Add files(latest valid object) to directory entry
-	for(i=0;i<count;i++)
+	list_for_each_entry(entry, &j4fs_index_list, list)
 	{
-		for(j=i+1;j<count;j++)
+		curoffs++;
+		if(curoffs >= offset)
 		{
-			// If inode number is same, valid_offset[i] is invalid
-			if(valid_offset[i][0]==valid_offset[j][0]) break;
-		}
+			nErr=filldir(dirent, entry->header.i_filename, strlen(entry->header.i_filename), offset, entry->header.i_id, DT_REG);
 
-		// Add latest valid object to directory entry
-		if(j==count)
-		{
-			curoffs++;
-			if(curoffs >= offset)
+			if(nErr <0) {
+				T(J4FS_TRACE_ALWAYS,("%s %d: error(nErr=0x%08x,filename=%s, file length=%d)\n",__FUNCTION__,__LINE__,nErr,entry->header.i_filename, strlen(entry->header.i_filename)));
+				goto error1;
+			}
+			else
 			{
-				nErr = FlashDevRead(&device_info, valid_offset[i][1], J4FS_BASIC_UNIT_SIZE, buf);
-				if (nErr != 0) {
-					T(J4FS_TRACE_ALWAYS,("%s %d: error(nErr=0x%x)\n",__FUNCTION__,__LINE__,nErr));
-			   		goto error1;
-				}
-
-				raw_inode = (struct j4fs_inode *) buf;
-
-				nErr=filldir(dirent, raw_inode->i_filename, strlen(raw_inode->i_filename), offset, raw_inode->i_id, DT_REG);
-
-				if(nErr <0) {
-					T(J4FS_TRACE_ALWAYS,("%s %d: error(nErr=0x%08x,filename=%s, file length=%d)\n",__FUNCTION__,__LINE__,nErr,raw_inode->i_filename, strlen(raw_inode->i_filename)));
-					goto error1;
-				}
-				else
-				{
-					T(J4FS_TRACE_FS,("%s %d: success(filename=%s, file length=%d)\n",__FUNCTION__,__LINE__,raw_inode->i_filename, strlen(raw_inode->i_filename)));
-					offset++;
-					filp->f_pos++;
-				}
+				T(J4FS_TRACE_FS,("%s %d: success(filename=%s, file length=%d)\n",__FUNCTION__,__LINE__,entry->header.i_filename, strlen(entry->header.i_filename)));
+				offset++;
+				filp->f_pos++;
 			}
 		}
 	}
 
 error1:
-	kfree(buf);
 	j4fs_GrossUnlock();
 	return 0;
 }
@@ -895,6 +914,9 @@ struct inode *j4fs_new_inode(struct inode *dir, struct dentry *dentry, int mode)
 
 	ei = J4FS_I(inode);
 
+	// the chain walk and header writes below must not race fsd_write() or an index rebuild
+	j4fs_GrossLock();
+
 	if(is_invalid_j4fs_rw_start())
 	{
 		T(J4FS_TRACE_ALWAYS,("%s %d: Error! j4fs_rw_start is invalid(j4fs_rw_start=0x%08x, j4fs_end=0x%08x, ro_j4fs_header_count=0x%08x)\n",
@@ -1070,10 +1092,12 @@ struct inode *j4fs_new_inode(struct inode *dir, struct dentry *dentry, int mode)
 		}
 	}
 
+	j4fs_GrossUnlock();
 	kfree(buf);
 	return inode;
 
 error1:
+	j4fs_GrossUnlock();
 	kfree(buf);
 #ifdef J4FS_TRANSACTION_LOGGING
 	kfree(transaction);
@@ -1312,6 +1336,15 @@ int j4fs_fill_super(struct super_block *sb, void *data, int silent)
    		goto failed;
 	}
 
+	// index the j4fs_header chain once, lookups and readdir use it from now on.
+	// On failure the next lookup retries, as the chain walk used to fail there.
+	j4fs_GrossLock();
+	ret=j4fs_index_build();
+	j4fs_GrossUnlock();
+
+	if (ret)
+		T(J4FS_TRACE_ALWAYS,("%s %d: Error(ret=%d)\n",__FUNCTION__,__LINE__,ret));
+
 	return 0;
 
 failed:
@@ -1472,6 +1505,7 @@ void __exit exit_j4fs_fs(void)
 
 	unregister_filesystem(&j4fs_fs_type);
 	destroy_inodecache();
+	j4fs_index_free();
 }
 
 module_init(init_j4fs_fs)
@@ -128,6 +128,9 @@ int FlashDevWrite(j4fs_device_info *dev_ptr, DWORD offset, DWORD length, BYTE *b
 #endif
 // J4FS for moviNAND merged from ROSSI
 
+	// any write may change the j4fs_header chain
+	j4fs_index_invalidate();
+
 #if defined(J4FS_USE_XSR)
 	ret = STL_Write(nVol, part_id, offset/512, length/512, buffer);
 	if (ret != STL_SUCCESS) {
@@ -27,6 +27,7 @@
 #include <linux/nsproxy.h>
 #include <linux/poll.h>
 #include <linux/debugfs.h>
+#include <linux/ktime.h>
 #include <linux/rbtree.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
@@ -35,6 +36,7 @@
 #include <linux/vmalloc.h>
 
 #include "binder.h"
+#include "binder_trace.h"
 
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
@@ -43,6 +45,10 @@ static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
 
+static LIST_HEAD(binder_lru);
+static DEFINE_SPINLOCK(binder_lru_lock);
+static int binder_lru_count;
+
 static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
@@ -154,6 +160,37 @@ struct binder_stats {
 
 static struct binder_stats binder_stats;
 
+/*
+ * Latency histograms, in power-of-two microsecond buckets: bucket 0 counts
+ * samples under 1us, bucket n samples in [2^(n-1), 2^n) us and the last
+ * bucket everything slower. Updated under binder_lock.
+ */
+#define BINDER_LAT_BUCKETS 24
+
+enum binder_lat_type {
+	BINDER_LAT_WAKEUP,	/* send to pickup by a target thread */
+	BINDER_LAT_REPLY,	/* pickup to reply sent by the target */
+	BINDER_LAT_ALLOC,	/* target buffer allocation */
+	BINDER_LAT_COUNT
+};
+
+static const char * const binder_lat_strings[] = {
+	"wakeup",
+	"reply",
+	"alloc"
+};
+
+struct binder_lat_hist {
+	u32 count;
+	u32 max_us;
+	u64 total_us;
+	u32 bucket[BINDER_LAT_BUCKETS];
+};
+
+struct binder_latency {
+	struct binder_lat_hist hist[BINDER_LAT_COUNT];
+};
+
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
 	binder_stats.obj_deleted[type]++;
@@ -232,6 +269,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	struct binder_latency *latency; /* allocated on first sample */
 };
 
 struct binder_ref_death {
@@ -258,12 +296,16 @@ struct binder_ref {
 
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* free entry by size or allocated */
+					/* entry by address */
+		struct list_head cache_entry; /* cached entry by size class */
+	};
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
-	unsigned debug_id:29;
+	unsigned cached:1;
+	unsigned debug_id:28;
 
 	struct binder_transaction *transaction;
 
@@ -273,6 +315,30 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+/*
+ * Small buffers are recycled through per-process free lists, one per
+ * power-of-two size class from BINDER_CACHE_MIN_SIZE up. A cached buffer
+ * keeps its place in proc->buffers and its pages, so reusing it costs
+ * neither a tree walk nor a page table update. Requests of up to the
+ * largest class size are rounded up to a class size, so a buffer always
+ * goes back to a class at least as large as the one it was taken for.
+ */
+#define BINDER_CACHE_MIN_SIZE	64
+#define BINDER_CACHE_CLASSES	6
+#define BINDER_CACHE_MAX_SIZE	(BINDER_CACHE_MIN_SIZE << (BINDER_CACHE_CLASSES - 1))
+#define BINDER_CACHE_DEPTH	8
+
+/*
+ * Pages backing proc->buffer stay mapped after the buffers using them
+ * are freed. Such pages sit on binder_lru until they are either used
+ * again or released by the binder shrinker.
+ */
+struct binder_lru_page {
+	struct list_head lru;	/* on binder_lru, under binder_lru_lock */
+	struct page *page_ptr;	/* under proc->alloc_lock */
+	struct binder_proc *proc;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -294,17 +360,29 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	/*
+	 * The buffer allocator state below is protected by alloc_lock
+	 * rather than binder_lock, so transactions can allocate and fill
+	 * buffers in this process without holding the global lock.
+	 * Lock order is binder_lock -> alloc_lock -> mmap_sem.
+	 */
+	struct mutex alloc_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
+	struct list_head buffer_cache[BINDER_CACHE_CLASSES];
+	int buffer_cache_count[BINDER_CACHE_CLASSES];
 
-	struct page **pages;
+	struct binder_lru_page *pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	int tmp_ref;	/* in-flight transactions, under binder_lock */
+	int is_dead;	/* released, freed once tmp_ref drops to 0 */
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	struct binder_latency latency;
 	struct list_head delivered_death;
 	int max_threads;
 	int requested_threads;
@@ -355,11 +433,42 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	start;		/* when sent, or picked up if synchronous */
 };
 
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
+static void binder_lat_hist_add(struct binder_lat_hist *hist, s64 us)
+{
+	u32 val = us < 0 ? 0 : min_t(s64, us, (u32)~0);
+
+	hist->count++;
+	hist->total_us += val;
+	if (val > hist->max_us)
+		hist->max_us = val;
+	hist->bucket[min_t(int, fls(val), BINDER_LAT_BUCKETS - 1)]++;
+}
+
+/*
+ * binder_record_latency - account a latency sample to 'proc' and, if
+ * given, to 'node', which must belong to 'proc'.
+ */
+static void binder_record_latency(struct binder_proc *proc,
+				  struct binder_node *node,
+				  enum binder_lat_type type, s64 us)
+{
+	binder_lat_hist_add(&proc->latency.hist[type], us);
+	if (node == NULL)
+		return;
+	if (node->latency == NULL) {
+		node->latency = kzalloc(sizeof(*node->latency), GFP_KERNEL);
+		if (node->latency == NULL)
+			return;
+	}
+	binder_lat_hist_add(&node->latency->hist[type], us);
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -607,6 +716,24 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_lru_add(struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	list_add_tail(&page->lru, &binder_lru);
+	binder_lru_count++;
+	spin_unlock(&binder_lru_lock);
+}
+
+static void binder_lru_del(struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	if (!list_empty(&page->lru)) {
+		list_del_init(&page->lru);
+		binder_lru_count--;
+	}
+	spin_unlock(&binder_lru_lock);
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -614,7 +741,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct binder_lru_page *page;
 	struct mm_struct *mm;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
@@ -624,6 +751,32 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	/*
+	 * Freed pages stay mapped on the lru, so neither freeing nor
+	 * reusing them needs mmap_sem.
+	 */
+	if (allocate == 0) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+			page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+			BUG_ON(!page->page_ptr);
+			binder_lru_add(page);
+		}
+		return 0;
+	}
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (!page->page_ptr)
+			break;
+	}
+	if (page_addr >= end) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+			page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+			binder_lru_del(page);
+		}
+		return 0;
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -634,9 +787,6 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		vma = proc->vma;
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
@@ -648,16 +798,19 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		if (page->page_ptr) {
+			binder_lru_del(page);
+			continue;
+		}
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page_ptr;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -667,7 +820,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
@@ -682,21 +835,14 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
 err_alloc_page_failed:
-		;
-	}
+	/* the pages mapped so far are still good, leave them to the lru */
+	binder_update_page_range(proc, 0, start, page_addr, NULL);
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -705,32 +851,195 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * binder_free_lru_page - unmap and free a page taken off binder_lru.
+ * Called with proc->alloc_lock held. Fails if the user mapping could
+ * not be removed without blocking.
+ */
+static int binder_free_lru_page(struct binder_proc *proc,
+				struct binder_lru_page *page)
 {
-	struct rb_node *n = proc->free_buffers.rb_node;
-	struct binder_buffer *buffer;
-	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
-	void *has_page_addr;
-	void *end_page_addr;
-	size_t size;
+	void *page_addr = proc->buffer + (page - proc->pages) * PAGE_SIZE;
+	struct mm_struct *mm = NULL;
 
-	if (proc->vma == NULL) {
-		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
-		       proc->pid);
-		return NULL;
+	if (proc->vma)
+		mm = get_task_mm(proc->tsk);
+
+	if (mm) {
+		if (!down_write_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			return -EBUSY;
+		}
+		if (proc->vma)
+			zap_page_range(proc->vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		up_write(&mm->mmap_sem);
+		mmput(mm);
 	}
 
-	size = ALIGN(data_size, sizeof(void *)) +
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
+	return 0;
+}
+
+static int binder_shrink(struct shrinker *shrink, int nr_to_scan,
+			 gfp_t gfp_mask)
+{
+	struct binder_lru_page *page;
+	struct binder_proc *proc;
+	int ret;
+
+	if (nr_to_scan <= 0)
+		return binder_lru_count;
+
+	spin_lock(&binder_lru_lock);
+	while (nr_to_scan-- > 0 && !list_empty(&binder_lru)) {
+		page = list_first_entry(&binder_lru, struct binder_lru_page,
+					lru);
+		proc = page->proc;
+		if (!mutex_trylock(&proc->alloc_lock)) {
+			list_move_tail(&page->lru, &binder_lru);
+			continue;
+		}
+		list_del_init(&page->lru);
+		binder_lru_count--;
+		spin_unlock(&binder_lru_lock);
+
+		ret = binder_free_lru_page(proc, page);
+
+		spin_lock(&binder_lru_lock);
+		if (ret) {
+			list_add_tail(&page->lru, &binder_lru);
+			binder_lru_count++;
+		}
+		mutex_unlock(&proc->alloc_lock);
+	}
+	ret = binder_lru_count;
+	spin_unlock(&binder_lru_lock);
+
+	return ret;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS
+};
+
+/*
+ * binder_cache_class - the smallest size class that holds 'size' bytes,
+ * or -1 if 'size' is too large to be cached.
+ */
+static int binder_cache_class(size_t size)
+{
+	int class = 0;
+
+	if (size > BINDER_CACHE_MAX_SIZE)
+		return -1;
+	while ((BINDER_CACHE_MIN_SIZE << class) < size)
+		class++;
+	return class;
+}
+
+/*
+ * binder_alloc_size - the number of bytes actually reserved for a buffer
+ * carrying 'data_size' and 'offsets_size' bytes. Used by both alloc and
+ * free so the async space accounting stays balanced.
+ */
+static size_t binder_alloc_size(size_t data_size, size_t offsets_size)
+{
+	size_t size = ALIGN(data_size, sizeof(void *)) +
 		ALIGN(offsets_size, sizeof(void *));
+	int class = binder_cache_class(size);
 
-	if (size < data_size || size < offsets_size) {
-		binder_user_error("binder: %d: got transaction with invalid "
-			"size %zd-%zd\n", proc->pid, data_size, offsets_size);
+	if (class >= 0)
+		return BINDER_CACHE_MIN_SIZE << class;
+	return size;
+}
+
+static struct binder_buffer *binder_cache_get(struct binder_proc *proc,
+					      size_t size)
+{
+	struct binder_buffer *buffer;
+	int class = binder_cache_class(size);
+
+	if (class < 0)
 		return NULL;
+
+	for (; class < BINDER_CACHE_CLASSES; class++) {
+		if (list_empty(&proc->buffer_cache[class]))
+			continue;
+		buffer = list_first_entry(&proc->buffer_cache[class],
+					  struct binder_buffer, cache_entry);
+		list_del(&buffer->cache_entry);
+		proc->buffer_cache_count[class]--;
+		buffer->cached = 0;
+		return buffer;
+	}
+	return NULL;
+}
+
+static int binder_cache_put(struct binder_proc *proc,
+			    struct binder_buffer *buffer, size_t buffer_size)
+{
+	int class;
+
+	if (buffer_size < BINDER_CACHE_MIN_SIZE ||
+	    buffer_size > BINDER_CACHE_MAX_SIZE)
+		return 0;
+
+	/* file under the largest class the buffer can serve */
+	class = binder_cache_class(buffer_size);
+	if ((BINDER_CACHE_MIN_SIZE << class) > buffer_size)
+		class--;
+
+	if (proc->buffer_cache_count[class] >= BINDER_CACHE_DEPTH)
+		return 0;
+
+	buffer->cached = 1;
+	list_add(&buffer->cache_entry, &proc->buffer_cache[class]);
+	proc->buffer_cache_count[class]++;
+	return 1;
+}
+
+static void binder_release_buffer(struct binder_proc *proc,
+				  struct binder_buffer *buffer);
+
+/*
+ * binder_cache_drain - give every cached buffer back to the free tree so
+ * it can be merged with its neighbours.
+ */
+static int binder_cache_drain(struct binder_proc *proc)
+{
+	struct binder_buffer *buffer;
+	int class, drained = 0;
+
+	for (class = 0; class < BINDER_CACHE_CLASSES; class++) {
+		while (!list_empty(&proc->buffer_cache[class])) {
+			buffer = list_first_entry(&proc->buffer_cache[class],
+						  struct binder_buffer,
+						  cache_entry);
+			list_del(&buffer->cache_entry);
+			buffer->cached = 0;
+			binder_release_buffer(proc, buffer);
+			drained++;
+		}
+		proc->buffer_cache_count[class] = 0;
 	}
+	return drained;
+}
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						size_t size, int is_async)
+{
+	struct rb_node *n;
+	struct binder_buffer *buffer;
+	size_t buffer_size;
+	struct rb_node *best_fit;
+	void *has_page_addr;
+	void *end_page_addr;
 
 	if (is_async &&
 	    proc->free_async_space < size + sizeof(struct binder_buffer)) {
@@ -740,6 +1049,17 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	buffer = binder_cache_get(proc, size);
+	if (buffer) {
+		binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+			     "binder: %d: binder_alloc_buf size %zd got "
+			     "cached %p\n", proc->pid, size, buffer);
+		goto found;
+	}
+
+retry:
+	n = proc->free_buffers.rb_node;
+	best_fit = NULL;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
@@ -756,6 +1076,8 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		}
 	}
 	if (best_fit == NULL) {
+		if (binder_cache_drain(proc))
+			goto retry;
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
 		return NULL;
@@ -787,19 +1109,22 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
-	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
 		list_add(&new_buffer->entry, &buffer->entry);
 		new_buffer->free = 1;
+		new_buffer->cached = 0;
 		binder_insert_free_buffer(proc, new_buffer);
 	}
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got "
 		     "%p\n", proc->pid, size, buffer);
+found:
+	binder_insert_allocated_buffer(proc, buffer);
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -811,6 +1136,41 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+/*
+ * binder_alloc_buf - allocate a transaction buffer in 'proc'. Takes
+ * proc->alloc_lock; the caller does not need binder_lock.
+ */
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+	size_t size;
+
+	if (proc->vma == NULL) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
+		       proc->pid);
+		return NULL;
+	}
+
+	size = ALIGN(data_size, sizeof(void *)) +
+		ALIGN(offsets_size, sizeof(void *));
+
+	if (size < data_size || size < offsets_size) {
+		binder_user_error("binder: %d: got transaction with invalid "
+			"size %zd-%zd\n", proc->pid, data_size, offsets_size);
+		return NULL;
+	}
+	size = binder_alloc_size(data_size, offsets_size);
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, size,
+				    is_async);
+	mutex_unlock(&proc->alloc_lock);
+
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -868,21 +1228,56 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+/*
+ * binder_release_buffer - give an unused buffer's pages back and merge it
+ * into the free tree. 'buffer' is in neither the allocated tree nor the
+ * cache.
+ */
+static void binder_release_buffer(struct binder_proc *proc,
+				  struct binder_buffer *buffer)
+{
+	size_t buffer_size = binder_buffer_size(proc, buffer);
+
+	binder_update_page_range(proc, 0,
+		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
+		NULL);
+	buffer->free = 1;
+	if (!list_is_last(&buffer->entry, &proc->buffers)) {
+		struct binder_buffer *next = list_entry(buffer->entry.next,
+						struct binder_buffer, entry);
+		if (next->free) {
+			rb_erase(&next->rb_node, &proc->free_buffers);
+			binder_delete_free_buffer(proc, next);
+		}
+	}
+	if (proc->buffers.next != &buffer->entry) {
+		struct binder_buffer *prev = list_entry(buffer->entry.prev,
+						struct binder_buffer, entry);
+		if (prev->free) {
+			binder_delete_free_buffer(proc, buffer);
+			rb_erase(&prev->rb_node, &proc->free_buffers);
+			buffer = prev;
+		}
+	}
+	binder_insert_free_buffer(proc, buffer);
+}
+
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
 	buffer_size = binder_buffer_size(proc, buffer);
 
-	size = ALIGN(buffer->data_size, sizeof(void *)) +
-		ALIGN(buffer->offsets_size, sizeof(void *));
+	size = binder_alloc_size(buffer->data_size, buffer->offsets_size);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_free_buf %p size %zd buffer"
 		     "_size %zd\n", proc->pid, buffer, size, buffer_size);
 
 	BUG_ON(buffer->free);
+	BUG_ON(buffer->cached);
 	BUG_ON(size > buffer_size);
 	BUG_ON(buffer->transaction != NULL);
 	BUG_ON((void *)buffer < proc->buffer);
@@ -897,30 +1292,33 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
-	binder_update_page_range(proc, 0,
-		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
-		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
-	buffer->free = 1;
-	if (!list_is_last(&buffer->entry, &proc->buffers)) {
-		struct binder_buffer *next = list_entry(buffer->entry.next,
-						struct binder_buffer, entry);
-		if (next->free) {
-			rb_erase(&next->rb_node, &proc->free_buffers);
-			binder_delete_free_buffer(proc, next);
-		}
-	}
-	if (proc->buffers.next != &buffer->entry) {
-		struct binder_buffer *prev = list_entry(buffer->entry.prev,
-						struct binder_buffer, entry);
-		if (prev->free) {
-			binder_delete_free_buffer(proc, buffer);
-			rb_erase(&prev->rb_node, &proc->free_buffers);
-			buffer = prev;
-		}
-	}
-	binder_insert_free_buffer(proc, buffer);
+	if (binder_cache_put(proc, buffer, buffer_size))
+		return;
+	binder_release_buffer(proc, buffer);
+}
+
+/*
+ * binder_free_buf - return a buffer to 'proc'. Takes proc->alloc_lock.
+ */
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
+static void binder_free_proc(struct binder_proc *proc);
+
+/*
+ * A transaction pins its target process while it works on the target's
+ * buffer without binder_lock. Called with binder_lock held.
+ */
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	if (--proc->tmp_ref == 0 && proc->is_dead)
+		binder_free_proc(proc);
 }
 
 static struct binder_node *binder_get_node(struct binder_proc *proc,
@@ -1052,6 +1450,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
 			}
+			kfree(node->latency);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		}
@@ -1381,7 +1780,11 @@ static void binder_transaction(struct binder_proc *proc,
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
+	struct binder_buffer *buffer;
 	size_t *offp, *off_end;
+	const char *copy_error = NULL;
+	ktime_t alloc_start;
+	s64 alloc_us;
 	struct binder_proc *target_proc;
 	struct binder_thread *target_thread = NULL;
 	struct binder_node *target_node = NULL;
@@ -1543,33 +1946,93 @@ static void binder_transaction(struct binder_proc *proc,
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
-	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
+	t->start = ktime_get();
+
+	/*
+	 * Allocating the target buffer and copying the payload into it only
+	 * need target_proc's allocator, so do them without binder_lock.
+	 * target_proc and target_node stay pinned meanwhile; threads are not,
+	 * so the target thread is looked up again once the lock is retaken.
+	 */
+	target_proc->tmp_ref++;
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+	mutex_unlock(&binder_lock);
+
+	alloc_start = ktime_get();
+	buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
-	if (t->buffer == NULL) {
-		return_error = BR_FAILED_REPLY;
+	alloc_us = ktime_us_delta(ktime_get(), alloc_start);
+	if (buffer) {
+		offp = (size_t *)(buffer->data +
+				  ALIGN(tr->data_size, sizeof(void *)));
+		if (copy_from_user(buffer->data, tr->data.ptr.buffer,
+				   tr->data_size))
+			copy_error = "data";
+		else if (copy_from_user(offp, tr->data.ptr.offsets,
+					tr->offsets_size))
+			copy_error = "offsets";
+	}
+
+	mutex_lock(&binder_lock);
+	if (buffer == NULL || target_proc->is_dead) {
+		/* a dead target already dropped the node's local refs */
+		if (!target_proc->is_dead) {
+			if (target_node)
+				binder_dec_node(target_node, 1, 0);
+			return_error = BR_FAILED_REPLY;
+		} else {
+			if (buffer)
+				binder_free_buf(target_proc, buffer);
+			return_error = BR_DEAD_REPLY;
+		}
+		binder_proc_dec_tmpref(target_proc);
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
+	binder_proc_dec_tmpref(target_proc);
+
+	t->buffer = buffer;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
+	trace_binder_transaction_alloc_buf(t->buffer, alloc_us);
+	binder_record_latency(target_proc, target_node, BINDER_LAT_ALLOC,
+			      alloc_us);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
+	if (copy_error) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+			"%s ptr\n", proc->pid, thread->pid, copy_error);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+
+	if (reply) {
+		target_thread = in_reply_to->from;
+		if (target_thread == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_copy_data_failed;
+		}
+	} else if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp;
+
+		target_thread = NULL;
+		for (tmp = thread->transaction_stack; tmp;
+		     tmp = tmp->from_parent)
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+	}
+	t->to_thread = target_thread;
+	if (target_thread) {
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
 	}
+	trace_binder_transaction(reply, t, target_node);
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1717,7 +2180,13 @@ static void binder_transaction(struct binder_proc *proc,
 		}
 	}
 	if (reply) {
+		s64 reply_us = ktime_us_delta(ktime_get(), in_reply_to->start);
+
 		BUG_ON(t->buffer->async_transaction != 0);
+		trace_binder_transaction_reply(t, in_reply_to, reply_us);
+		binder_record_latency(proc, in_reply_to->buffer ?
+				      in_reply_to->buffer->target_node : NULL,
+				      BINDER_LAT_REPLY, reply_us);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1934,20 +2403,26 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->alloc_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
+			/* claim it so a racing BC_FREE_BUFFER fails */
+			buffer->allow_user_free = 0;
+			mutex_unlock(&proc->alloc_lock);
 			binder_debug(BINDER_DEBUG_FREE_BUFFER,
 				     "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
 				     proc->pid, thread->pid, data_ptr, buffer->debug_id,
@@ -1965,7 +2440,11 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
+
+			/* unmapping pages does not need the global lock */
+			mutex_unlock(&binder_lock);
 			binder_free_buf(proc, buffer);
+			mutex_lock(&binder_lock);
 			break;
 		}
 
@@ -2270,6 +2749,8 @@ retry:
 		struct binder_transaction_data tr;
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
+		ktime_t now;
+		s64 wakeup_us;
 
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
@@ -2353,6 +2834,7 @@ retry:
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
+					kfree(node->latency);
 					kfree(node);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
@@ -2448,6 +2930,12 @@ retry:
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		now = ktime_get();
+		wakeup_us = ktime_us_delta(now, t->start);
+		trace_binder_transaction_received(t, wakeup_us);
+		if (cmd == BR_TRANSACTION)
+			binder_record_latency(proc, t->buffer->target_node,
+					      BINDER_LAT_WAKEUP, wakeup_us);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2464,6 +2952,7 @@ retry:
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
 			t->to_thread = thread;
+			t->start = now; /* reply latency counts from here */
 			thread->transaction_stack = t;
 		} else {
 			t->buffer->transaction = NULL;
@@ -2782,7 +3271,7 @@ static struct vm_operations_struct binder_vm_ops = {
 
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	int ret;
+	int ret, i;
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
@@ -2834,6 +3323,10 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2874,6 +3367,7 @@ err_bad_arg:
 static int binder_open(struct inode *nodp, struct file *filp)
 {
 	struct binder_proc *proc;
+	int i;
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE, "binder_open: %d:%d\n",
 		     current->group_leader->pid, current->pid);
@@ -2883,6 +3377,9 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	mutex_init(&proc->alloc_lock);
+	for (i = 0; i < BINDER_CACHE_CLASSES; i++)
+		INIT_LIST_HEAD(&proc->buffer_cache[i]);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
@@ -2944,9 +3441,8 @@ static int binder_release(struct inode *nodp, struct file *filp)
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
@@ -2975,6 +3471,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
 		if (hlist_empty(&node->refs)) {
+			kfree(node->latency);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
@@ -3012,8 +3509,31 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
 
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d threads %d, nodes %d (ref %d), "
+		     "refs %d, active transactions %d\n",
+		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
+		     active_transactions);
+
+	/* transactions still filling buffers here free the rest */
+	proc->is_dead = 1;
+	if (proc->tmp_ref == 0)
+		binder_free_proc(proc);
+}
+
+/*
+ * binder_free_proc - free the buffers and the binder_proc itself once it
+ * is released and no transaction has it pinned. Called with binder_lock
+ * held.
+ */
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	buffers = 0;
 	while ((n = rb_first(&proc->allocated_buffers))) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
@@ -3033,10 +3553,12 @@ static void binder_deferred_release(struct binder_proc *proc)
 	binder_stats_deleted(BINDER_STAT_PROC);
 
 	page_count = 0;
+	mutex_lock(&proc->alloc_lock);
 	if (proc->pages) {
 		int i;
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
+			binder_lru_del(&proc->pages[i]);
+			if (proc->pages[i].page_ptr) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
 				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 					     "binder_release: %d: "
@@ -3045,22 +3567,20 @@ static void binder_deferred_release(struct binder_proc *proc)
 					     page_addr);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
-				__free_page(proc->pages[i]);
+				__free_page(proc->pages[i].page_ptr);
 				page_count++;
 			}
 		}
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
+	mutex_unlock(&proc->alloc_lock);
 
 	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
-		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
-		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
 
 	kfree(proc);
 }
@@ -3280,9 +3800,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3383,7 +3905,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 {
 	struct binder_work *w;
 	struct rb_node *n;
-	int count, strong, weak;
+	int count, strong, weak, cached, i;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
@@ -3412,9 +3934,14 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	cached = 0;
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
-	seq_printf(m, "  buffers: %d\n", count);
+	for (i = 0; i < BINDER_CACHE_CLASSES; i++)
+		cached += proc->buffer_cache_count[i];
+	mutex_unlock(&proc->alloc_lock);
+	seq_printf(m, "  buffers: %d cached %d\n", count, cached);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3468,6 +3995,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	seq_printf(m, "lru pages: %d\n", binder_lru_count);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
@@ -3507,6 +4035,61 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	return 0;
 }
 
+static void print_binder_latency(struct seq_file *m, const char *prefix,
+				 struct binder_latency *lat)
+{
+	int i, j;
+
+	for (i = 0; i < BINDER_LAT_COUNT; i++) {
+		struct binder_lat_hist *hist = &lat->hist[i];
+
+		if (!hist->count)
+			continue;
+		seq_printf(m, "%s%s: count %u avg %llu max %u:", prefix,
+			   binder_lat_strings[i], hist->count,
+			   div_u64(hist->total_us, hist->count), hist->max_us);
+		for (j = 0; j < BINDER_LAT_BUCKETS; j++)
+			seq_printf(m, " %u", hist->bucket[j]);
+		seq_puts(m, "\n");
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int do_lock = !binder_debug_no_lock;
+	int i;
+
+	if (do_lock)
+		mutex_lock(&binder_lock);
+
+	seq_puts(m, "binder latency (us), buckets from:");
+	seq_puts(m, " 0");
+	for (i = 1; i < BINDER_LAT_BUCKETS; i++)
+		seq_printf(m, " %u", 1U << (i - 1));
+	seq_puts(m, "\n");
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency(m, "  ", &proc->latency);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n,
+				struct binder_node, rb_node);
+
+			if (node->latency == NULL)
+				continue;
+			seq_printf(m, "  node %d u%p\n", node->debug_id,
+				   node->ptr);
+			print_binder_latency(m, "    ", node->latency);
+		}
+	}
+	if (do_lock)
+		mutex_unlock(&binder_lock);
+	return 0;
+}
+
 static void print_binder_transaction_log_entry(struct seq_file *m,
 					struct binder_transaction_log_entry *e)
 {
@@ -3552,6 +4135,7 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init binder_init(void)
 {
@@ -3566,6 +4150,8 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	if (!ret)
+		register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
@@ -3592,6 +4178,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 	return ret;
 }
@@ -3599,3 +4190,6 @@ static int __init binder_init(void)
 device_initcall(binder_init);
 
 MODULE_LICENSE("GPL v2");
+
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
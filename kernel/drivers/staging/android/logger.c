@@ -25,9 +25,13 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/spinlock.h>
+#include <linux/stddef.h>
+#include <linux/mm.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
+#include <asm/io.h>
 
 #ifdef CONFIG_SAMSUNG_PASS_PLATFORM_LOG_TO_KERNEL
 //{{ pass platform log to kernel - 1/3
@@ -93,17 +97,26 @@ static struct struct_marks_ver_mark marks_ver_mark = {
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Positions are free-running byte counts; the ring offset of a position is
+ * logger_offset(pos). Entries in [head, w_pos) are laid out back to back.
+ * Writers reserve space under the spinlock 'lock', which only covers the
+ * position bookkeeping, and copy their payload in without holding anything.
+ * Entries still being copied are flagged in their header, and c_pos only
+ * moves past an entry once it is complete, so readers can read [head, c_pos)
+ * without taking a lock and detect being lapped by re-checking head.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
+	struct logger_mmap_info	*info;	/* head/tail exported via mmap */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	wait_queue_head_t	commit_wq; /* writers waiting for ring space */
+	spinlock_t		lock;	/* protects w_pos, c_pos and head */
+	size_t			w_pos;	/* reserved up to here */
+	size_t			c_pos;	/* committed up to here */
+	size_t			head;	/* oldest entry, new readers start here */
 	size_t			size;	/* size of the log */
 };
 
@@ -111,17 +124,25 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by its own mutex, which
+ * only serializes readers sharing the same file.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes reads on this file */
+	size_t			r_pos;	/* current read position */
+	bool			batch;	/* read() returns as many as fit */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* pos_before - is position 'a' older than position 'b'? */
+#define pos_before(a, b)	((long) ((a) - (b)) < 0)
+
+/* set in logger_entry.__pad while the payload is still being copied in */
+#define LOGGER_ENTRY_BUSY	0x1
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -146,38 +167,91 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_len - Grabs the length of the payload of the next entry starting
- * from 'off'.
+ * logger_copy_in - copies 'count' bytes from 'buf' into the ring at 'pos'
+ */
+static void logger_copy_in(struct logger_log *log, size_t pos,
+			   const void *buf, size_t count)
+{
+	size_t off = logger_offset(pos);
+	size_t len = min(count, log->size - off);
+
+	memcpy(log->buffer + off, buf, len);
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
+}
+
+/*
+ * logger_copy_out - copies 'count' bytes at 'pos' in the ring into 'buf'
+ */
+static void logger_copy_out(struct logger_log *log, size_t pos,
+			    void *buf, size_t count)
+{
+	size_t off = logger_offset(pos);
+	size_t len = min(count, log->size - off);
+
+	memcpy(buf, log->buffer + off, len);
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+/*
+ * get_entry_len - Grabs the length of the next entry starting at 'pos',
+ * including its header.
  *
- * Caller needs to hold log->mutex.
+ * Outside of log->lock the result may be garbage if a writer laps the
+ * caller; check head afterwards.
  */
-static __u32 get_entry_len(struct logger_log *log, size_t off)
+static __u32 get_entry_len(struct logger_log *log, size_t pos)
 {
 	__u16 val;
 
-	switch (log->size - off) {
-	case 1:
-		memcpy(&val, log->buffer + off, 1);
-		memcpy(((char *) &val) + 1, log->buffer, 1);
-		break;
-	default:
-		memcpy(&val, log->buffer + off, 2);
-	}
+	logger_copy_out(log, pos + offsetof(struct logger_entry, len),
+			&val, sizeof(val));
 
 	return sizeof(struct logger_entry) + val;
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
- *
- * Caller must hold log->mutex.
+ * logger_reader_pos - returns the reader's position, first pulling it
+ * forward to head if a writer has lapped it.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static size_t logger_reader_pos(struct logger_log *log,
+				struct logger_reader *reader)
 {
+	size_t head = ACCESS_ONCE(log->head);
+
+	if (pos_before(reader->r_pos, head))
+		reader->r_pos = head;
+
+	return reader->r_pos;
+}
+
+/*
+ * logger_readable - is there a committed entry at 'pos'?
+ */
+static inline int logger_readable(struct logger_log *log, size_t pos)
+{
+	return pos_before(pos, ACCESS_ONCE(log->c_pos));
+}
+
+/*
+ * logger_lapped - has the entry at 'pos' been (partly) overwritten?
+ * Call after reading from the ring to validate what was read.
+ */
+static inline int logger_lapped(struct logger_log *log, size_t pos)
+{
+	smp_rmb();
+	return pos_before(pos, ACCESS_ONCE(log->head));
+}
+
+/*
+ * do_read_log_to_user - reads exactly 'count' bytes at 'pos' in 'log' into
+ * the user-space buffer 'buf'. Returns 'count' on success.
+ */
+static ssize_t do_read_log_to_user(struct logger_log *log, size_t pos,
+				   char __user *buf, size_t count)
+{
+	size_t off = logger_offset(pos);
 	size_t len;
 
 	/*
@@ -185,8 +259,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -197,8 +271,6 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
@@ -209,7 +281,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or with LOGGER_SET_BATCH_READ
+ * 	  as many whole entries as fit in the buffer
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -219,6 +292,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t r_pos, copied;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -226,9 +300,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		mutex_lock(&reader->mutex);
+		ret = !logger_readable(log, logger_reader_pos(log, reader));
+		mutex_unlock(&reader->mutex);
 		if (!ret)
 			break;
 
@@ -249,147 +323,197 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+
+retry:
+	r_pos = logger_reader_pos(log, reader);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(!logger_readable(log, r_pos))) {
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
-	}
+	copied = 0;
+	do {
+		size_t pos = r_pos + copied;
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+		smp_rmb();
+
+		/* get the size of the next entry */
+		ret = get_entry_len(log, pos);
+		if (logger_lapped(log, pos)) {
+			if (!copied)
+				goto retry;
+			break;
+		}
+		if (count - copied < ret) {
+			if (!copied) {
+				ret = -EINVAL;
+				goto out;
+			}
+			break;
+		}
+
+		/* get exactly one entry from the log */
+		ret = do_read_log_to_user(log, pos, buf + copied, ret);
+		if (ret < 0)
+			goto out;
+		if (logger_lapped(log, pos)) {
+			if (!copied)
+				goto retry;
+			break;
+		}
+		copied += ret;
+	} while (reader->batch && logger_readable(log, r_pos + copied));
+
+	reader->r_pos = r_pos + copied;
+	ret = copied;
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_reserve - reserves 'len' bytes for a new entry and writes its
+ * 'header' with the busy flag set. Returns the position of the entry.
  *
- * Caller must hold log->mutex.
+ * Entries that the reservation overwrites are dropped by pulling head
+ * forward past them; readers still looking at them notice when they
+ * re-check head.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static size_t logger_reserve(struct logger_log *log,
+			     struct logger_entry *header, size_t len)
 {
-	size_t count = 0;
+	size_t pos;
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	spin_lock(&log->lock);
 
-	return off;
-}
+	/*
+	 * Never overwrite entries that are still being copied in. This only
+	 * happens when the whole ring is reserved by writers stuck in page
+	 * faults, so just wait for them.
+	 */
+	while (unlikely(log->w_pos + len - log->c_pos > log->size)) {
+		size_t c_pos = log->c_pos;
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+		spin_unlock(&log->lock);
+		wait_event(log->commit_wq, ACCESS_ONCE(log->c_pos) != c_pos);
+		spin_lock(&log->lock);
 	}
 
-	return 0;
-}
+	while (log->w_pos + len - log->head > log->size)
+		log->head += get_entry_len(log, log->head);
+	log->info->head = log->head;
 
-/*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
- */
-static void fix_up_readers(struct logger_log *log, size_t len)
-{
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	/* readers must see the new head before we overwrite their entries */
+	smp_wmb();
+
+	pos = log->w_pos;
+	log->w_pos += len;
+	logger_copy_in(log, pos, header, sizeof(struct logger_entry));
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	spin_unlock(&log->lock);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	return pos;
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * logger_commit - clears the busy flag of the entry at 'pos' and moves
+ * c_pos past every completed entry. Writers may finish out of order, so
+ * whoever completes the oldest outstanding entry publishes the others.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void logger_commit(struct logger_log *log, size_t pos)
 {
-	size_t len;
+	__u16 pad = 0;
+	size_t c_pos;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	spin_lock(&log->lock);
 
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
+	logger_copy_in(log, pos + offsetof(struct logger_entry, __pad),
+		       &pad, sizeof(pad));
 
-	log->w_off = logger_offset(log->w_off + count);
+	c_pos = log->c_pos;
+	while (c_pos != log->w_pos) {
+		logger_copy_out(log, c_pos + offsetof(struct logger_entry, __pad),
+				&pad, sizeof(pad));
+		if (pad & LOGGER_ENTRY_BUSY)
+			break;
+		c_pos += get_entry_len(log, c_pos);
+	}
+
+	/* the entries must be visible before c_pos covers them */
+	smp_wmb();
+	log->c_pos = c_pos;
+	log->info->tail = c_pos;
 
+	spin_unlock(&log->lock);
+
+	if (waitqueue_active(&log->commit_wq))
+		wake_up(&log->commit_wq);
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log_from_user - writes 'count' bytes from the user-space buffer
+ * 'buf' to the ring at 'pos'
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t pos,
 				      const void __user *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-#ifdef CONFIG_SAMSUNG_PASS_PLATFORM_LOG_TO_KERNEL
-	//{{ pass platform log (!@hello) to kernel - 2/3
-	memset(klog_buf, 0, 1023);
- 
-	if(strncmp(log->buffer  + log->w_off,  "!@", 2) == 0) {
-		if (count < 1023)
-			memcpy(klog_buf,log->buffer  + log->w_off, count);                        
-		else
-			memcpy(klog_buf, log->buffer + log->w_off, 1023);
- 
-		klog_buf[1023] = 0;
-	}
-	//}} pass platform log (!@hello) to kernel - 2/3
-#endif /* CONFIG_SAMSUNG_PASS_PLATFORM_LOG_TO_KERNEL */
+	return count;
+}
 
-	log->w_off = logger_offset(log->w_off + count);
+/*
+ * do_clear_log - zeroes 'count' bytes of the ring at 'pos'
+ */
+static void do_clear_log(struct logger_log *log, size_t pos, size_t count)
+{
+	size_t off = logger_offset(pos);
+	size_t len = min(count, log->size - off);
 
-	return count;
+	memset(log->buffer + off, 0, len);
+	if (count != len)
+		memset(log->buffer, 0, count - len);
+}
+
+#ifdef CONFIG_SAMSUNG_PASS_PLATFORM_LOG_TO_KERNEL
+//{{ pass platform log (!@hello) to kernel - 2/3
+static DEFINE_SPINLOCK(klog_lock);
+
+static void logger_pass_to_kernel(struct logger_log *log, size_t pos,
+				  size_t count)
+{
+	char mark[2];
+
+	if (count < sizeof(mark))
+		return;
+	logger_copy_out(log, pos, mark, sizeof(mark));
+	if (strncmp(mark, "!@", 2) != 0)
+		return;
+
+	spin_lock(&klog_lock);
+	memset(klog_buf, 0, sizeof(klog_buf));
+	logger_copy_out(log, pos, klog_buf, min_t(size_t, count, 1023));
+	printk(KERN_INFO "%s\n", klog_buf);
+	spin_unlock(&klog_lock);
 }
+//}} pass platform log (!@hello) to kernel - 2/3
+#endif /* CONFIG_SAMSUNG_PASS_PLATFORM_LOG_TO_KERNEL */
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
@@ -400,9 +524,9 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t pos, seg_pos = 0, seg_len = 0;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -412,24 +536,16 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = LOGGER_ENTRY_BUSY;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	pos = logger_reserve(log, &header,
+			     sizeof(struct logger_entry) + header.len);
 
-	while (nr_segs-- > 0) {
+	while (nr_segs-- > 0 && ret < header.len) {
 		size_t len;
 		ssize_t nr;
 
@@ -437,10 +553,17 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		seg_pos = pos + sizeof(struct logger_entry) + ret;
+		seg_len = len;
+		nr = do_write_log_from_user(log, seg_pos, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
+			/*
+			 * The space is already reserved and later writers
+			 * may sit behind it, so commit a zero-filled entry.
+			 */
+			do_clear_log(log, seg_pos, header.len - ret);
+			logger_commit(log, pos);
+			wake_up_interruptible(&log->wq);
 			return nr;
 		}
 
@@ -448,17 +571,14 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	logger_commit(log, pos);
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
 #ifdef CONFIG_SAMSUNG_PASS_PLATFORM_LOG_TO_KERNEL
 	//{{ pass platform log (!@hello) to kernel - 3/3
-     	if(strncmp(klog_buf, "!@", 2) == 0)
-	{
-		printk(KERN_INFO "%s\n", klog_buf);
-	}
+	logger_pass_to_kernel(log, seg_pos, seg_len);
 	//}} pass platform log (!@hello) to kernel - 3/3
 #endif /* CONFIG_SAMSUNG_PASS_PLATFORM_LOG_TO_KERNEL */
 
@@ -493,12 +613,9 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_pos = ACCESS_ONCE(log->head);
+		reader->batch = false;
 
 		file->private_data = reader;
 	} else
@@ -516,11 +633,6 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		struct logger_log *log = reader->log;
-
-		mutex_lock(&log->mutex);
- 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
 
 		kfree(reader);
 	}
@@ -551,10 +663,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	if (logger_readable(log, logger_reader_pos(log, reader)))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -563,10 +675,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	size_t r_pos, c_pos;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -577,10 +688,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		r_pos = logger_reader_pos(log, reader);
+		c_pos = ACCESS_ONCE(log->c_pos);
+		ret = pos_before(r_pos, c_pos) ? c_pos - r_pos : 0;
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -588,33 +700,101 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		mutex_lock(&reader->mutex);
+		do {
+			r_pos = logger_reader_pos(log, reader);
+			if (!logger_readable(log, r_pos)) {
+				ret = 0;
+				break;
+			}
+			smp_rmb();
+			ret = get_entry_len(log, r_pos);
+		} while (logger_lapped(log, r_pos));
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers notice they are behind head on their next access */
+		spin_lock(&log->lock);
+		log->head = log->w_pos;
+		log->info->head = log->head;
+		spin_unlock(&log->lock);
+		ret = 0;
+		break;
+	case LOGGER_SET_BATCH_READ:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
+/*
+ * logger_buffer_pfn - the ring is a static array, so when we are built as a
+ * module it lives in module space and is only virtually contiguous. Look
+ * each page up through the page tables rather than trusting virt_to_phys().
+ */
+static unsigned long logger_buffer_pfn(const void *addr)
+{
+#ifdef MODULE
+	return vmalloc_to_pfn(addr);
+#else
+	return virt_to_phys(addr) >> PAGE_SHIFT;
+#endif
+}
+
+/*
+ * logger_mmap - maps the log read-only for readers: the logger_mmap_info
+ * page first, then the ring. Readers follow head/tail themselves and never
+ * touch the driver again until they want to block in poll().
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long off;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+	if (vma->vm_pgoff || size != PAGE_SIZE + log->size)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = remap_pfn_range(vma, vma->vm_start,
+			      page_to_pfn(virt_to_page(log->info)),
+			      PAGE_SIZE, vma->vm_page_prot);
+	if (ret)
+		return ret;
+
+	for (off = 0; off < log->size; off += PAGE_SIZE) {
+		ret = remap_pfn_range(vma, vma->vm_start + PAGE_SIZE + off,
+				      logger_buffer_pfn(log->buffer + off),
+				      PAGE_SIZE, vma->vm_page_prot);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -627,7 +807,7 @@ static const struct file_operations logger_fops = {
  * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -637,9 +817,10 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
+	.commit_wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .commit_wq), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
+	.w_pos = 0, \
+	.c_pos = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -673,10 +854,16 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	log->info = (struct logger_mmap_info *) get_zeroed_page(GFP_KERNEL);
+	if (unlikely(!log->info))
+		return -ENOMEM;
+	log->info->size = log->size;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		free_page((unsigned long) log->info);
 		return ret;
 	}
 
@@ -35,6 +35,19 @@ struct logger_entry {
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
 #define LOGGER_LOG_MAIN		"log_main"	/* everything else */
 
+/*
+ * struct logger_mmap_info - the first page of a log's read-only mapping,
+ * followed by the ring itself. Entries live in [head, tail); the ring offset
+ * of a position is (pos & (size - 1)). An entry read through the mapping is
+ * only valid if head has not moved past its position once it has been copied.
+ */
+struct logger_mmap_info {
+	__u32		head;	/* position of the oldest entry */
+	__u32		tail;	/* committed entries end here */
+	__u32		size;	/* size of the ring */
+	__u32		__pad;
+};
+
 #define LOGGER_ENTRY_MAX_LEN		(4*1024)
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
@@ -45,5 +58,8 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_BATCH_READ		_IO(__LOGGERIO, 5) /* read() returns
+							      all entries
+							      that fit */
 
 #endif /* _LINUX_LOGGER_H */
@@ -12,6 +12,18 @@
  * and kill processes with a oom_adj value of 0 or higher when the free memory
  * drops below 1024 pages.
  *
+ * Thread group leaders are kept in a tree sorted by oom_adj, so the shrinker
+ * only has to look at the tasks in the highest oom_adj bucket(s) instead of
+ * walking the whole task list.
+ *
+ * With /sys/module/lowmemorykiller/parameters/pressure set, the minfree
+ * thresholds are also scaled by reclaim pressure. Every pressure_window_ms
+ * the scanned/reclaimed page counts from vmscan and the time spent stalled
+ * in direct reclaim are sampled. If reclaim is thrashing the thresholds are
+ * raised to thrash_scale percent so cached processes are killed earlier;
+ * while kswapd alone keeps up they are lowered to hold_scale percent. The
+ * thrashing state is only left once pressure drops below pressure_low.
+ *
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
@@ -35,6 +47,9 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/spinlock.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,12 +70,73 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+enum lowmem_pressure_state {
+	LOWMEM_NORMAL,
+	LOWMEM_HOLD,		/* kswapd is keeping up, kill later */
+	LOWMEM_THRASH,		/* reclaim is failing, kill earlier */
+};
+
+static bool lowmem_pressure;
+static uint32_t lowmem_pressure_window_ms = 100;
+static uint32_t lowmem_pressure_high = 90;	/* % of scanned not reclaimed */
+static uint32_t lowmem_pressure_low = 60;
+static uint32_t lowmem_stall_ms = 20;		/* direct reclaim per window */
+static uint32_t lowmem_thrash_scale = 150;	/* % of minfree */
+static uint32_t lowmem_hold_scale = 75;
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static enum lowmem_pressure_state lowmem_state = LOWMEM_NORMAL;
+static struct reclaim_pressure lowmem_last_rp;
+static unsigned long lowmem_last_sample;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+/*
+ * Thread group leaders sorted by signal->oom_adj. Updated from fork, exit,
+ * exec and /proc/<pid>/oom_adj with tasklist_lock held for writing; the
+ * shrinker walks it with tasklist_lock held for reading.
+ */
+static struct rb_root lowmem_adj_tree = RB_ROOT;
+
+void lowmem_adj_tree_add(struct task_struct *task)
+{
+	struct rb_node **link = &lowmem_adj_tree.rb_node;
+	struct rb_node *parent = NULL;
+	int oom_adj = task->signal->oom_adj;
+
+	while (*link) {
+		struct task_struct *t;
+
+		parent = *link;
+		t = rb_entry(parent, struct task_struct, lowmem_node);
+		if (oom_adj < t->signal->oom_adj)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&task->lowmem_node, parent, link);
+	rb_insert_color(&task->lowmem_node, &lowmem_adj_tree);
+}
+
+void lowmem_adj_tree_del(struct task_struct *task)
+{
+	if (RB_EMPTY_NODE(&task->lowmem_node))
+		return;
+	rb_erase(&task->lowmem_node, &lowmem_adj_tree);
+	RB_CLEAR_NODE(&task->lowmem_node);
+}
+
+void lowmem_adj_tree_replace(struct task_struct *old, struct task_struct *new)
+{
+	/* old and new share signal_struct, so the key does not change */
+	rb_replace_node(&old->lowmem_node, &new->lowmem_node, &lowmem_adj_tree);
+	RB_CLEAR_NODE(&old->lowmem_node);
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -79,8 +155,71 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+/*
+ * Fold the reclaim activity since the last sample into lowmem_state.
+ * Windows with too little scanning to judge keep the previous state.
+ */
+static void lowmem_update_pressure(void)
+{
+	struct reclaim_pressure rp;
+	unsigned long scanned, reclaimed, stall_us, pressure;
+	unsigned long kswapd_scanned, direct_scanned;
+
+	if (!time_after_eq(jiffies, lowmem_last_sample +
+			   msecs_to_jiffies(lowmem_pressure_window_ms)))
+		return;
+	if (!spin_trylock(&lowmem_pressure_lock))
+		return;
+
+	get_reclaim_pressure(&rp);
+	kswapd_scanned = rp.kswapd_scanned - lowmem_last_rp.kswapd_scanned;
+	direct_scanned = rp.direct_scanned - lowmem_last_rp.direct_scanned;
+	scanned = kswapd_scanned + direct_scanned;
+	reclaimed = (rp.kswapd_reclaimed - lowmem_last_rp.kswapd_reclaimed) +
+		(rp.direct_reclaimed - lowmem_last_rp.direct_reclaimed);
+	stall_us = rp.stall_us - lowmem_last_rp.stall_us;
+	lowmem_last_rp = rp;
+	lowmem_last_sample = jiffies;
+
+	if (scanned < SWAP_CLUSTER_MAX)
+		goto out;
+	if (reclaimed > scanned)
+		reclaimed = scanned;
+	pressure = (scanned - reclaimed) * 100 / scanned;
+
+	if (pressure >= lowmem_pressure_high ||
+	    stall_us >= lowmem_stall_ms * USEC_PER_MSEC)
+		lowmem_state = LOWMEM_THRASH;
+	else if (pressure < lowmem_pressure_low)
+		lowmem_state = direct_scanned ? LOWMEM_NORMAL : LOWMEM_HOLD;
+	else if (lowmem_state != LOWMEM_THRASH)
+		lowmem_state = LOWMEM_NORMAL;
+
+	lowmem_print(4, "lowmem pressure %lu, stall %luus, kswapd %lu, "
+		     "direct %lu, state %d\n", pressure, stall_us,
+		     kswapd_scanned, direct_scanned, lowmem_state);
+out:
+	spin_unlock(&lowmem_pressure_lock);
+}
+
+static size_t lowmem_minfree_scaled(int i)
+{
+	if (!lowmem_pressure)
+		return lowmem_minfree[i];
+
+	switch (lowmem_state) {
+	case LOWMEM_THRASH:
+		return lowmem_minfree[i] * lowmem_thrash_scale / 100;
+	case LOWMEM_HOLD:
+		return lowmem_minfree[i] * lowmem_hold_scale / 100;
+	default:
+		return lowmem_minfree[i];
+	}
+}
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
+	struct rb_node *n;
 	struct task_struct *p;
 	struct task_struct *selected = NULL;
 	int rem = 0;
@@ -105,13 +244,17 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
+	if (lowmem_pressure && nr_to_scan > 0)
+		lowmem_update_pressure();
+
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
+		size_t minfree = lowmem_minfree_scaled(i);
+
+		if (other_free < minfree && other_file < minfree) {
 			min_adj = lowmem_adj[i];
 			break;
 		}
@@ -136,20 +279,24 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	selected_oom_adj = min_adj;
 
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
+	/*
+	 * Walk down from the highest oom_adj; once past min_adj, or past
+	 * the bucket a victim was found in, nothing better can follow.
+	 */
+	for (n = rb_last(&lowmem_adj_tree); n; n = rb_prev(n)) {
 		struct mm_struct *mm;
-		struct signal_struct *sig;
 		int oom_adj;
 
+		p = rb_entry(n, struct task_struct, lowmem_node);
+		oom_adj = p->signal->oom_adj;
+		if (oom_adj < min_adj)
+			break;
+		if (selected && oom_adj < selected_oom_adj)
+			break;
+
 		task_lock(p);
 		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+		if (!mm) {
 			task_unlock(p);
 			continue;
 		}
@@ -157,13 +304,8 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 		task_unlock(p);
 		if (tasksize <= 0)
 			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
+		if (selected && tasksize <= selected_tasksize)
+			continue;
 		selected = p;
 		selected_tasksize = tasksize;
 		selected_oom_adj = oom_adj;
@@ -211,6 +353,15 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure, lowmem_pressure, bool, S_IRUGO | S_IWUSR);
+module_param_named(pressure_window_ms, lowmem_pressure_window_ms, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_high, lowmem_pressure_high, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_low, lowmem_pressure_low, uint, S_IRUGO | S_IWUSR);
+module_param_named(stall_ms, lowmem_stall_ms, uint, S_IRUGO | S_IWUSR);
+module_param_named(thrash_scale, lowmem_thrash_scale, uint, S_IRUGO | S_IWUSR);
+module_param_named(hold_scale, lowmem_hold_scale, uint, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
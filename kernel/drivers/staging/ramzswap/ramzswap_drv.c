@@ -20,11 +20,13 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/crypto.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
@@ -57,18 +59,19 @@ static void rzs_clear_flag(struct ramzswap *rzs, u32 index,
 	rzs->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page) - 1; pos++) {
+		if (page[pos] != page[pos + 1])
 			return 0;
 	}
 
+	*element = page[pos];
 	return 1;
 }
 
@@ -158,75 +161,257 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
+static void ramzswap_ioctl_get_comp_stats(struct ramzswap *rzs,
+			struct ramzswap_ioctl_comp_stats *s)
+{
+	strlcpy(s->compressor, rzs->compressor, sizeof(s->compressor));
+
+#if defined(CONFIG_RAMZSWAP_STATS)
+	{
+	struct ramzswap_stats *rs = &rzs->stats;
+
+	s->compr_ns = rzs_stat64_read(rzs, &rs->compr_ns);
+	s->decompr_ns = rzs_stat64_read(rzs, &rs->decompr_ns);
+	s->num_compr = rzs_stat64_read(rzs, &rs->num_compr);
+	s->num_decompr = rzs_stat64_read(rzs, &rs->num_decompr);
+
+	if (s->num_compr)
+		s->compr_ns_per_page = div64_u64(s->compr_ns, s->num_compr);
+	if (s->num_decompr)
+		s->decompr_ns_per_page = div64_u64(s->decompr_ns,
+						s->num_decompr);
+	if (rs->pages_stored)
+		s->compr_ratio_pct = div64_u64((u64)rs->compr_size * 100,
+				(u64)rs->pages_stored << PAGE_SHIFT);
+
+	s->pages_same = rs->pages_same;
+	s->pages_dedup = rs->pages_dedup;
+	s->pages_wb = rs->pages_wb;
+	s->num_wb_reads = rzs_stat64_read(rzs, &rs->num_wb_reads);
+	s->num_wb_writes = rzs_stat64_read(rzs, &rs->num_wb_writes);
+	}
+#endif /* CONFIG_RAMZSWAP_STATS */
+}
+
+/*
+ * Look for an already stored object holding the same data as the given
+ * page. Candidates are verified by decompressing them, so a checksum
+ * collision never aliases two different pages. On success, a reference
+ * to the object is taken on behalf of the caller.
+ */
+static struct rzs_dedup_entry *rzs_dedup_find(struct ramzswap *rzs,
+		struct ramzswap_stream *stream, struct page *page, u32 checksum)
+{
+	int ret;
+	unsigned int clen;
+	struct rb_node *node;
+	struct rzs_dedup_entry *entry, *found = NULL;
+	unsigned char *user_mem, *cmem;
+
+	spin_lock(&rzs->dedup_lock);
+
+	node = rzs->dedup_root.rb_node;
+	while (node) {
+		entry = rb_entry(node, struct rzs_dedup_entry, rb);
+		if (checksum < entry->checksum) {
+			node = node->rb_left;
+			continue;
+		}
+		if (checksum > entry->checksum) {
+			node = node->rb_right;
+			continue;
+		}
+
+		clen = PAGE_SIZE;
+		cmem = kmap_atomic(entry->page, KM_USER1) + entry->offset;
+		ret = crypto_comp_decompress(stream->tfm,
+			cmem + sizeof(struct zobj_header),
+			xv_get_object_size(cmem) - sizeof(struct zobj_header),
+			stream->buffer, &clen);
+		kunmap_atomic(cmem, KM_USER1);
+
+		if (ret || clen != PAGE_SIZE)
+			break;
+
+		user_mem = kmap_atomic(page, KM_USER0);
+		if (!memcmp(user_mem, stream->buffer, PAGE_SIZE)) {
+			entry->refcount++;
+			found = entry;
+		}
+		kunmap_atomic(user_mem, KM_USER0);
+		break;
+	}
+
+	spin_unlock(&rzs->dedup_lock);
+
+	return found;
+}
+
+static void rzs_dedup_insert(struct ramzswap *rzs,
+			struct rzs_dedup_entry *new)
+{
+	struct rb_node **link, *parent = NULL;
+	struct rzs_dedup_entry *entry;
+
+	spin_lock(&rzs->dedup_lock);
+
+	link = &rzs->dedup_root.rb_node;
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct rzs_dedup_entry, rb);
+		if (new->checksum < entry->checksum)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	rb_link_node(&new->rb, parent, link);
+	rb_insert_color(&new->rb, &rzs->dedup_root);
+
+	spin_unlock(&rzs->dedup_lock);
+}
+
+/*
+ * Drop a reference to a stored object. Returns 1 if this was the
+ * last one, in which case the entry is freed and the caller must
+ * release the object memory.
+ */
+static int rzs_dedup_put(struct ramzswap *rzs, struct rzs_dedup_entry *entry)
+{
+	spin_lock(&rzs->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&rzs->dedup_lock);
+		return 0;
+	}
+	rb_erase(&entry->rb, &rzs->dedup_root);
+	spin_unlock(&rzs->dedup_lock);
+
+	kfree(entry);
+	return 1;
+}
+
+/*
+ * Allocate 'nr' contiguous pages on the backing device.
+ * Returns the first one, or -ENOSPC.
+ */
+static long rzs_wb_alloc(struct ramzswap *rzs, int nr)
+{
+	unsigned long slot;
+
+	spin_lock(&rzs->wb_lock);
+	slot = bitmap_find_next_zero_area(rzs->wb_bitmap, rzs->wb_nr_pages,
+					0, nr, 0);
+	if (slot + nr > rzs->wb_nr_pages) {
+		spin_unlock(&rzs->wb_lock);
+		return -ENOSPC;
+	}
+	bitmap_set(rzs->wb_bitmap, slot, nr);
+	spin_unlock(&rzs->wb_lock);
+
+	return slot;
+}
+
+static void rzs_wb_free(struct ramzswap *rzs, unsigned long slot, int nr)
+{
+	spin_lock(&rzs->wb_lock);
+	bitmap_clear(rzs->wb_bitmap, slot, nr);
+	spin_unlock(&rzs->wb_lock);
+}
+
+/*
+ * Release the object stored at the given index.
+ * Called with rzs->table_lock held for writing.
+ */
 static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
 	u32 clen;
 	void *obj;
+	struct zobj_header *zheader;
+	struct rzs_dedup_entry *entry;
 
 	struct page *page = rzs->table[index].page;
 	u32 offset = rzs->table[index].offset;
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (rzs_test_flag(rzs, index, RZS_ZERO)) {
-			rzs_clear_flag(rzs, index, RZS_ZERO);
+	rzs_clear_flag(rzs, index, RZS_IDLE);
+	rzs_clear_flag(rzs, index, RZS_WB_PENDING);
+
+	if (rzs_test_flag(rzs, index, RZS_WRITEBACK)) {
+		rzs_wb_free(rzs, rzs->table[index].wb_index, 1);
+		rzs_clear_flag(rzs, index, RZS_WRITEBACK);
+		rzs_stat_dec(&rzs->stats.pages_wb);
+		rzs->table[index].wb_index = 0;
+		return;
+	}
+
+	/*
+	 * No memory is allocated for same filled pages.
+	 * Simply clear the flag and the stored pattern.
+	 */
+	if (rzs_test_flag(rzs, index, RZS_SAME)) {
+		rzs_clear_flag(rzs, index, RZS_SAME);
+		if (rzs->table[index].element)
+			rzs_stat_dec(&rzs->stats.pages_same);
+		else
 			rzs_stat_dec(&rzs->stats.pages_zero);
-		}
+		rzs->table[index].element = 0;
 		return;
 	}
 
+	if (unlikely(!page))
+		return;
+
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
 		__free_page(page);
 		rzs_clear_flag(rzs, index, RZS_UNCOMPRESSED);
 		rzs_stat_dec(&rzs->stats.pages_expand);
+		rzs->stats.compr_size -= clen;
 		goto out;
 	}
 
 	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
+	zheader = obj;
+	entry = zheader->entry;
+	clen = xv_get_object_size(obj) - sizeof(*zheader);
 	kunmap_atomic(obj, KM_USER0);
 
-	xv_free(rzs->mem_pool, page, offset);
+	if (rzs_dedup_put(rzs, entry)) {
+		xv_free(rzs->mem_pool, page, offset);
+		rzs->stats.compr_size -= clen;
+	} else {
+		rzs_stat_dec(&rzs->stats.pages_dedup);
+	}
+
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_dec(&rzs->stats.good_compress);
 
 out:
-	rzs->stats.compr_size -= clen;
 	rzs_stat_dec(&rzs->stats.pages_stored);
 
 	rzs->table[index].page = NULL;
 	rzs->table[index].offset = 0;
 }
 
-static int handle_zero_page(struct bio *bio)
+static void handle_same_page(struct page *page, unsigned long element)
 {
-	void *user_mem;
-	struct page *page = bio->bi_io_vec[0].bv_page;
+	unsigned int pos;
+	unsigned long *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
-
-	flush_dcache_page(page);
-
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return 0;
 }
 
-static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
+static void handle_uncompressed_page(struct ramzswap *rzs, struct page *page,
+				u32 index)
 {
-	u32 index;
-	struct page *page;
 	unsigned char *user_mem, *cmem;
 
-	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
 			rzs->table[index].offset;
@@ -234,12 +419,6 @@ static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
-
-	flush_dcache_page(page);
-
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return 0;
 }
 
 /*
@@ -261,13 +440,77 @@ static int handle_ramzswap_fault(struct ramzswap *rzs, struct bio *bio)
 	return 0;
 }
 
+static void ramzswap_wb_end_io(struct bio *bio, int err)
+{
+	struct bio *orig = bio->bi_private;
+
+	bio_put(bio);
+
+	if (!err)
+		set_bit(BIO_UPTODATE, &orig->bi_flags);
+	bio_endio(orig, err);
+}
+
+/*
+ * Redirect a swap request to the given page of the backing device.
+ * The original bio completes when the backing device I/O does.
+ */
+static int ramzswap_wb_rw(struct ramzswap *rzs, struct bio *orig,
+			unsigned long slot, int rw)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio) {
+		bio_io_error(orig);
+		return 0;
+	}
+
+	bio->bi_bdev = rzs->backing_bdev;
+	bio->bi_sector = slot << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = ramzswap_wb_end_io;
+	bio->bi_private = orig;
+	bio_add_page(bio, orig->bi_io_vec[0].bv_page, PAGE_SIZE, 0);
+
+	submit_bio(rw, bio);
+	return 0;
+}
+
+/*
+ * Get the compression stream of the current CPU. We may migrate
+ * after picking it, in which case the stream mutex keeps it safe.
+ * Streams are used for decompression as well since some backends
+ * (e.g. deflate) keep per-transform state.
+ */
+static struct ramzswap_stream *rzs_stream_get(struct ramzswap *rzs)
+{
+	struct ramzswap_stream *stream;
+
+	stream = per_cpu_ptr(rzs->streams, raw_smp_processor_id());
+	mutex_lock(&stream->lock);
+
+	return stream;
+}
+
+static void rzs_stream_put(struct ramzswap_stream *stream)
+{
+	mutex_unlock(&stream->lock);
+}
+
+/*
+ * Reads only take the table lock shared: they never modify the
+ * table and the compressed object cannot be freed underneath us
+ * while it is held.
+ */
 static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
 	u32 index;
-	size_t clen;
+	u64 start;
+	unsigned int clen;
 	struct page *page;
 	struct zobj_header *zheader;
+	struct ramzswap_stream *stream;
 	unsigned char *user_mem, *cmem;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
@@ -275,16 +518,38 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	if (rzs_test_flag(rzs, index, RZS_ZERO))
-		return handle_zero_page(bio);
+	stream = rzs_stream_get(rzs);
+	read_lock(&rzs->table_lock);
+
+	/* Readers only ever clear this bit, so a racy update is fine */
+	rzs_clear_flag(rzs, index, RZS_IDLE);
+
+	if (rzs_test_flag(rzs, index, RZS_SAME)) {
+		handle_same_page(page, rzs->table[index].element);
+		goto out;
+	}
+
+	if (rzs_test_flag(rzs, index, RZS_WRITEBACK)) {
+		unsigned long slot = rzs->table[index].wb_index;
+
+		read_unlock(&rzs->table_lock);
+		rzs_stream_put(stream);
+		rzs_stat64_inc(rzs, &rzs->stats.num_wb_reads);
+		return ramzswap_wb_rw(rzs, bio, slot, READ);
+	}
 
 	/* Requested page is not present in compressed area */
-	if (!rzs->table[index].page)
+	if (!rzs->table[index].page) {
+		read_unlock(&rzs->table_lock);
+		rzs_stream_put(stream);
 		return handle_ramzswap_fault(rzs, bio);
+	}
 
 	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		return handle_uncompressed_page(rzs, bio);
+	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
+		handle_uncompressed_page(rzs, page, index);
+		goto out;
+	}
 
 	user_mem = kmap_atomic(page, KM_USER0);
 	clen = PAGE_SIZE;
@@ -292,40 +557,55 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
 			rzs->table[index].offset;
 
-	ret = lzo1x_decompress_safe(
+	start = rzs_stat_clock();
+	ret = crypto_comp_decompress(stream->tfm,
 		cmem + sizeof(*zheader),
 		xv_get_object_size(cmem) - sizeof(*zheader),
 		user_mem, &clen);
+	rzs_stat64_add(rzs, &rzs->stats.decompr_ns, rzs_stat_clock() - start);
+	rzs_stat64_inc(rzs, &rzs->stats.num_decompr);
 
 	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
+		read_unlock(&rzs->table_lock);
+		rzs_stream_put(stream);
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
-		goto out;
+		bio_io_error(bio);
+		return 0;
 	}
 
+out:
+	read_unlock(&rzs->table_lock);
+	rzs_stream_put(stream);
+
 	flush_dcache_page(page);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return 0;
-
-out:
-	bio_io_error(bio);
-	return 0;
 }
 
+/*
+ * Compression and allocation happen without the table lock. It is
+ * only taken (exclusive) to publish the new object in the table.
+ */
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
-	int ret;
-	u32 offset, index;
-	size_t clen;
+	int ret, dedup = 0;
+	long wb_slot = -ENOSPC;
+	u32 offset, index, checksum;
+	u64 start;
+	unsigned int clen;
+	unsigned long element;
 	struct zobj_header *zheader;
+	struct rzs_dedup_entry *entry;
 	struct page *page, *page_store;
+	struct ramzswap_stream *stream;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
@@ -333,29 +613,57 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
-
 	user_mem = kmap_atomic(page, KM_USER0);
-	if (page_zero_filled(user_mem)) {
+	if (page_same_filled(user_mem, &element)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
-		rzs_stat_inc(&rzs->stats.pages_zero);
-		rzs_set_flag(rzs, index, RZS_ZERO);
+
+		write_lock(&rzs->table_lock);
+		ramzswap_free_page(rzs, index);
+		if (element)
+			rzs_stat_inc(&rzs->stats.pages_same);
+		else
+			rzs_stat_inc(&rzs->stats.pages_zero);
+		rzs->table[index].element = element;
+		rzs_set_flag(rzs, index, RZS_SAME);
+		write_unlock(&rzs->table_lock);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
+	checksum = jhash2((u32 *)user_mem, PAGE_SIZE / sizeof(u32), 0);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	stream = rzs_stream_get(rzs);
+
+	/* Identical page already stored: just share its object */
+	entry = rzs_dedup_find(rzs, stream, page, checksum);
+	if (entry) {
+		rzs_stream_put(stream);
+
+		cmem = kmap_atomic(entry->page, KM_USER1) + entry->offset;
+		clen = xv_get_object_size(cmem) - sizeof(*zheader);
+		kunmap_atomic(cmem, KM_USER1);
+
+		page_store = entry->page;
+		offset = entry->offset;
+		dedup = 1;
+		goto update_table;
+	}
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	src = stream->buffer;
 
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = 2 * PAGE_SIZE;
+	start = rzs_stat_clock();
+	ret = crypto_comp_compress(stream->tfm, user_mem, PAGE_SIZE,
+				src, &clen);
+	rzs_stat64_add(rzs, &rzs->stats.compr_ns, rzs_stat_clock() - start);
+	rzs_stat64_inc(rzs, &rzs->stats.num_compr);
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		rzs_stream_put(stream);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
@@ -367,10 +675,30 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	 * errors which has side effect of hanging the system.
 	 */
 	if (unlikely(clen > max_zpage_size)) {
+		rzs_stream_put(stream);
+
+		if (rzs->backing_bdev)
+			wb_slot = rzs_wb_alloc(rzs, 1);
+		if (wb_slot >= 0) {
+			/*
+			 * Write the page out to the backing device instead.
+			 * On I/O error the slot is left mapped: the swap
+			 * layer keeps the page dirty and rewrites it here.
+			 */
+			write_lock(&rzs->table_lock);
+			ramzswap_free_page(rzs, index);
+			rzs->table[index].wb_index = wb_slot;
+			rzs_set_flag(rzs, index, RZS_WRITEBACK);
+			rzs_stat_inc(&rzs->stats.pages_wb);
+			write_unlock(&rzs->table_lock);
+
+			rzs_stat64_inc(rzs, &rzs->stats.num_wb_writes);
+			return ramzswap_wb_rw(rzs, bio, wb_slot, WRITE);
+		}
+
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
@@ -378,51 +706,75 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		}
 
 		offset = 0;
-		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_inc(&rzs->stats.pages_expand);
-		rzs->table[index].page = page_store;
 		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+		goto update_table;
+	}
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (unlikely(!entry)) {
+		rzs_stream_put(stream);
+		pr_info("Error allocating dedup entry for page: %u\n", index);
+		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
+		goto out;
 	}
 
 	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
-			&rzs->table[index].page, &offset,
+			&page_store, &offset,
 			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
+		rzs_stream_put(stream);
+		kfree(entry);
 		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
+			"page: %u, size=%u\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
 
-memstore:
-	rzs->table[index].offset = offset;
-
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = kmap_atomic(page_store, KM_USER1) + offset;
 
-#if 0
+	zheader = (struct zobj_header *)cmem;
+	zheader->entry = entry;
 	/* Back-reference needed for memory defragmentation */
-	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
+	zheader->table_idx = index;
+	cmem += sizeof(*zheader);
 
 	memcpy(cmem, src, clen);
 
 	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	rzs_stream_put(stream);
+
+	entry->checksum = checksum;
+	entry->refcount = 1;
+	entry->page = page_store;
+	entry->offset = offset;
+	rzs_dedup_insert(rzs, entry);
+
+update_table:
+	write_lock(&rzs->table_lock);
+
+	/* Drop whatever was stored at this index before */
+	ramzswap_free_page(rzs, index);
+
+	rzs->table[index].page = page_store;
+	rzs->table[index].offset = offset;
+	if (unlikely(clen == PAGE_SIZE)) {
+		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
+		rzs_stat_inc(&rzs->stats.pages_expand);
+	}
 
 	/* Update stats */
-	rzs->stats.compr_size += clen;
+	if (dedup)
+		rzs_stat_inc(&rzs->stats.pages_dedup);
+	else
+		rzs->stats.compr_size += clen;
 	rzs_stat_inc(&rzs->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_inc(&rzs->stats.good_compress);
 
-	mutex_unlock(&rzs->lock);
+	write_unlock(&rzs->table_lock);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
@@ -433,6 +785,311 @@ out:
 	return 0;
 }
 
+/*
+ * Move a compressed object out of a page being compacted.
+ * Called by xv_compact() for each object in the page.
+ */
+static int ramzswap_migrate_object(void *arg, struct page *page, u32 offset)
+{
+	int ret = -EBUSY;
+	u32 index, size, new_offset;
+	struct ramzswap *rzs = arg;
+	struct page *new_page;
+	struct zobj_header *zheader;
+	struct rzs_dedup_entry *entry;
+	unsigned char *obj, *new_obj;
+
+	write_lock(&rzs->table_lock);
+
+	obj = kmap_atomic(page, KM_USER0) + offset;
+	zheader = (struct zobj_header *)obj;
+	index = zheader->table_idx;
+	entry = zheader->entry;
+	size = xv_get_object_size(obj);
+	kunmap_atomic(obj, KM_USER0);
+
+	/*
+	 * The back-reference is only trusted if the table entry points
+	 * back to this object. It is stale for a shared object whose
+	 * first owner is gone: such objects are left in place.
+	 */
+	if (index >= rzs->disksize >> PAGE_SHIFT ||
+			rzs_test_flag(rzs, index, RZS_SAME) ||
+			rzs_test_flag(rzs, index, RZS_WRITEBACK) ||
+			rzs_test_flag(rzs, index, RZS_UNCOMPRESSED) ||
+			rzs->table[index].page != page ||
+			rzs->table[index].offset != offset)
+		goto out;
+
+	spin_lock(&rzs->dedup_lock);
+
+	/* Other table entries share this object */
+	if (entry->refcount != 1)
+		goto out_unlock;
+
+	/* Only reuse free space already in the pool */
+	if (xv_malloc(rzs->mem_pool, size, &new_page, &new_offset,
+			GFP_NOWAIT | __GFP_HIGHMEM)) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+
+	obj = kmap_atomic(page, KM_USER0) + offset;
+	new_obj = kmap_atomic(new_page, KM_USER1) + new_offset;
+	memcpy(new_obj, obj, size);
+	kunmap_atomic(new_obj, KM_USER1);
+	kunmap_atomic(obj, KM_USER0);
+
+	entry->page = new_page;
+	entry->offset = new_offset;
+	spin_unlock(&rzs->dedup_lock);
+
+	rzs->table[index].page = new_page;
+	rzs->table[index].offset = new_offset;
+	xv_free(rzs->mem_pool, page, offset);
+
+	write_unlock(&rzs->table_lock);
+	return 0;
+
+out_unlock:
+	spin_unlock(&rzs->dedup_lock);
+out:
+	write_unlock(&rzs->table_lock);
+	return ret;
+}
+
+static int ramzswap_compact(struct ramzswap *rzs, int nr_to_scan)
+{
+	return xv_compact(rzs->mem_pool, nr_to_scan,
+			ramzswap_migrate_object, rzs);
+}
+
+/*
+ * Compact the pool under memory pressure. The no. of pages that
+ * are not filled with objects is reported as freeable.
+ */
+static int ramzswap_shrink(struct shrinker *shrinker, int nr_to_scan,
+			gfp_t gfp_mask)
+{
+	int freeable = 0;
+	struct ramzswap *rzs = container_of(shrinker, struct ramzswap,
+						shrinker);
+
+	if (!mutex_trylock(&rzs->init_lock))
+		return nr_to_scan ? -1 : 0;
+
+	if (rzs->init_done) {
+		if (nr_to_scan)
+			ramzswap_compact(rzs, nr_to_scan);
+		freeable = (xv_get_total_size_bytes(rzs->mem_pool) -
+			xv_get_used_size_bytes(rzs->mem_pool)) >> PAGE_SHIFT;
+	}
+
+	mutex_unlock(&rzs->init_lock);
+
+	return freeable;
+}
+
+struct rzs_wb_batch {
+	struct completion done;
+	int error;
+};
+
+static void ramzswap_wb_batch_end_io(struct bio *bio, int err)
+{
+	struct rzs_wb_batch *batch = bio->bi_private;
+
+	batch->error = err;
+	complete(&batch->done);
+}
+
+/*
+ * Copy out the data stored at the given index, for writeback.
+ * Called with rzs->table_lock held.
+ */
+static int ramzswap_wb_copy_page(struct ramzswap *rzs,
+		struct ramzswap_stream *stream, u32 index, struct page *page)
+{
+	int ret = 0;
+	unsigned int clen = PAGE_SIZE;
+	unsigned char *user_mem, *cmem;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
+			rzs->table[index].offset;
+
+	if (rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))
+		memcpy(user_mem, cmem, PAGE_SIZE);
+	else
+		ret = crypto_comp_decompress(stream->tfm,
+			cmem + sizeof(struct zobj_header),
+			xv_get_object_size(cmem) - sizeof(struct zobj_header),
+			user_mem, &clen);
+
+	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	return ret;
+}
+
+/*
+ * Write back a batch of up to RZS_WB_BATCH idle pages with a single
+ * bio, starting the scan at *index. Candidates are flagged
+ * RZS_WB_PENDING; any free or rewrite of the slot meanwhile clears
+ * the flag and the written copy is then simply dropped.
+ * Returns the no. of pages written back, or a negative error.
+ */
+static int ramzswap_wb_batch(struct ramzswap *rzs, u32 *index)
+{
+	int i, nr = 0, added;
+	long slot;
+	u32 nr_pages = rzs->disksize >> PAGE_SHIFT;
+	u32 batch_index[RZS_WB_BATCH];
+	struct page *batch_page[RZS_WB_BATCH];
+	struct page *page = NULL;
+	struct ramzswap_stream *stream;
+	struct rzs_wb_batch batch;
+	struct bio *bio;
+
+	stream = rzs_stream_get(rzs);
+	for (; *index < nr_pages && nr < RZS_WB_BATCH; (*index)++) {
+		if (!page) {
+			page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+			if (!page)
+				break;
+		}
+
+		write_lock(&rzs->table_lock);
+		if (!rzs_test_flag(rzs, *index, RZS_IDLE) ||
+				ramzswap_wb_copy_page(rzs, stream,
+						*index, page)) {
+			write_unlock(&rzs->table_lock);
+			continue;
+		}
+		rzs_set_flag(rzs, *index, RZS_WB_PENDING);
+		write_unlock(&rzs->table_lock);
+
+		batch_index[nr] = *index;
+		batch_page[nr++] = page;
+		page = NULL;
+	}
+	rzs_stream_put(stream);
+
+	if (page)
+		__free_page(page);
+
+	/* Stopped early: out of memory */
+	if (!nr)
+		return *index < nr_pages ? -ENOMEM : 0;
+
+	added = 0;
+	slot = rzs_wb_alloc(rzs, nr);
+	if (slot < 0) {
+		batch.error = slot;
+		goto out;
+	}
+
+	bio = bio_alloc(GFP_NOIO, nr);
+	bio->bi_bdev = rzs->backing_bdev;
+	bio->bi_sector = slot << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = ramzswap_wb_batch_end_io;
+	bio->bi_private = &batch;
+	for (; added < nr; added++) {
+		if (bio_add_page(bio, batch_page[added], PAGE_SIZE, 0)
+							!= PAGE_SIZE)
+			break;
+	}
+
+	/* Slots for pages that did not fit in the bio are not used */
+	if (added < nr)
+		rzs_wb_free(rzs, slot + added, nr - added);
+
+	init_completion(&batch.done);
+	batch.error = 0;
+	submit_bio(WRITE, bio);
+	wait_for_completion(&batch.done);
+	bio_put(bio);
+
+out:
+	for (i = 0; i < nr; i++) {
+		write_lock(&rzs->table_lock);
+		if (i < added && !batch.error &&
+			rzs_test_flag(rzs, batch_index[i], RZS_WB_PENDING)) {
+			ramzswap_free_page(rzs, batch_index[i]);
+			rzs->table[batch_index[i]].wb_index = slot + i;
+			rzs_set_flag(rzs, batch_index[i], RZS_WRITEBACK);
+			rzs_stat_inc(&rzs->stats.pages_wb);
+			rzs_stat64_inc(rzs, &rzs->stats.num_wb_writes);
+		} else {
+			rzs_clear_flag(rzs, batch_index[i], RZS_WB_PENDING);
+			if (i < added)
+				rzs_wb_free(rzs, slot + i, 1);
+		}
+		write_unlock(&rzs->table_lock);
+
+		__free_page(batch_page[i]);
+	}
+
+	return batch.error ? batch.error : added;
+}
+
+/*
+ * Flag all pages resident in memory as idle. Any access until the
+ * next scan clears the flag.
+ */
+static void ramzswap_mark_idle(struct ramzswap *rzs)
+{
+	u32 index;
+
+	/* Index 0 is the swap header */
+	for (index = 1; index < rzs->disksize >> PAGE_SHIFT; index++) {
+		write_lock(&rzs->table_lock);
+		if (rzs->table[index].page &&
+				!rzs_test_flag(rzs, index, RZS_SAME) &&
+				!rzs_test_flag(rzs, index, RZS_WRITEBACK))
+			rzs_set_flag(rzs, index, RZS_IDLE);
+		write_unlock(&rzs->table_lock);
+
+		if (!(index % 1024))
+			cond_resched();
+	}
+}
+
+/*
+ * Periodically write back pages that stayed idle for a full
+ * wb_idle_secs period, then start a new one.
+ */
+static void ramzswap_wb_work(struct work_struct *work)
+{
+	u32 index = 1;
+	struct ramzswap *rzs = container_of(to_delayed_work(work),
+					struct ramzswap, wb_work);
+
+	while (index < rzs->disksize >> PAGE_SHIFT) {
+		if (ramzswap_wb_batch(rzs, &index) < 0)
+			break;
+		cond_resched();
+	}
+
+	ramzswap_mark_idle(rzs);
+
+	schedule_delayed_work(&rzs->wb_work, rzs->wb_idle_secs * HZ);
+}
+
+static void ramzswap_release_backing_dev(struct ramzswap *rzs)
+{
+	if (!rzs->backing_bdev)
+		return;
+
+	close_bdev_exclusive(rzs->backing_bdev, FMODE_READ | FMODE_WRITE);
+	vfree(rzs->wb_bitmap);
+
+	rzs->backing_bdev = NULL;
+	rzs->wb_bitmap = NULL;
+	rzs->wb_nr_pages = 0;
+	rzs->wb_idle_secs = 0;
+}
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -484,47 +1141,95 @@ static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
-static void reset_device(struct ramzswap *rzs)
+static void ramzswap_destroy_streams(struct ramzswap *rzs)
 {
-	size_t index;
+	int cpu;
 
-	/* Do not accept any new I/O request */
-	rzs->init_done = 0;
+	if (!rzs->streams)
+		return;
 
-	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
+	for_each_possible_cpu(cpu) {
+		struct ramzswap_stream *stream;
 
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+		stream = per_cpu_ptr(rzs->streams, cpu);
+		if (stream->tfm)
+			crypto_free_comp(stream->tfm);
+		free_pages((unsigned long)stream->buffer, 1);
+	}
 
-	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+	free_percpu(rzs->streams);
+	rzs->streams = NULL;
+}
 
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
+/*
+ * Allocate one compression stream per possible CPU. On failure,
+ * partially allocated streams are released by reset_device().
+ */
+static int ramzswap_create_streams(struct ramzswap *rzs)
+{
+	int cpu;
+	struct crypto_comp *tfm;
 
-		if (!page)
-			continue;
+	rzs->streams = alloc_percpu(struct ramzswap_stream);
+	if (!rzs->streams)
+		return -ENOMEM;
 
-		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
+	for_each_possible_cpu(cpu) {
+		struct ramzswap_stream *stream;
+
+		stream = per_cpu_ptr(rzs->streams, cpu);
+		mutex_init(&stream->lock);
+
+		tfm = crypto_alloc_comp(rzs->compressor, 0, 0);
+		if (IS_ERR(tfm))
+			return PTR_ERR(tfm);
+		stream->tfm = tfm;
+
+		stream->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!stream->buffer)
+			return -ENOMEM;
 	}
 
+	return 0;
+}
+
+static void reset_device(struct ramzswap *rzs)
+{
+	size_t index;
+
+	if (rzs->init_done) {
+		unregister_shrinker(&rzs->shrinker);
+		cancel_delayed_work_sync(&rzs->wb_work);
+	}
+
+	/* Do not accept any new I/O request */
+	rzs->init_done = 0;
+
+	/* Free various per-device buffers */
+	ramzswap_destroy_streams(rzs);
+
+	/*
+	 * Free all pages that are still in this ramzswap device.
+	 * No I/O can reach us anymore, so the table lock is not needed.
+	 */
+	for (index = 0; rzs->table && index < rzs->disksize >> PAGE_SHIFT;
+								index++)
+		ramzswap_free_page(rzs, index);
+
 	vfree(rzs->table);
 	rzs->table = NULL;
 
 	xv_destroy_pool(rzs->mem_pool);
 	rzs->mem_pool = NULL;
+	rzs->dedup_root = RB_ROOT;
 
 	/* Reset stats */
 	memset(&rzs->stats, 0, sizeof(rzs->stats));
 
+	ramzswap_release_backing_dev(rzs);
+
 	rzs->disksize = 0;
+	strlcpy(rzs->compressor, default_compressor, sizeof(rzs->compressor));
 }
 
 static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
@@ -541,17 +1246,10 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = ramzswap_create_streams(rzs);
+	if (ret) {
+		pr_err("Error allocating %s compression streams\n",
+			rzs->compressor);
 		goto fail;
 	}
 
@@ -592,8 +1290,12 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	}
 
 	rzs->init_done = 1;
+	register_shrinker(&rzs->shrinker);
+
+	if (rzs->backing_bdev && rzs->wb_idle_secs)
+		schedule_delayed_work(&rzs->wb_work, rzs->wb_idle_secs * HZ);
 
-	pr_debug("Initialization done!\n");
+	pr_debug("Initialization done! compressor=%s\n", rzs->compressor);
 	return 0;
 
 fail:
@@ -611,11 +1313,63 @@ static int ramzswap_ioctl_reset_device(struct ramzswap *rzs)
 	return 0;
 }
 
+static int ramzswap_ioctl_set_backing_dev(struct ramzswap *rzs,
+			struct ramzswap_ioctl_backing *backing)
+{
+	size_t bitmap_size;
+	struct block_device *bdev;
+
+	if (rzs->init_done)
+		return -EBUSY;
+
+	ramzswap_release_backing_dev(rzs);
+
+	backing->path[sizeof(backing->path) - 1] = '\0';
+	bdev = open_bdev_exclusive(backing->path, FMODE_READ | FMODE_WRITE,
+				rzs);
+	if (IS_ERR(bdev)) {
+		pr_info("Error opening backing device %s\n", backing->path);
+		return PTR_ERR(bdev);
+	}
+
+	rzs->wb_nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap_size = BITS_TO_LONGS(rzs->wb_nr_pages) * sizeof(long);
+	rzs->wb_bitmap = vmalloc(bitmap_size);
+	if (!rzs->wb_bitmap) {
+		close_bdev_exclusive(bdev, FMODE_READ | FMODE_WRITE);
+		rzs->wb_nr_pages = 0;
+		return -ENOMEM;
+	}
+	memset(rzs->wb_bitmap, 0, bitmap_size);
+
+	rzs->backing_bdev = bdev;
+	rzs->wb_idle_secs = backing->idle_secs;
+
+	pr_info("Backing device %s: %lu pages, idle writeback %us\n",
+		backing->path, rzs->wb_nr_pages, rzs->wb_idle_secs);
+	return 0;
+}
+
+static int ramzswap_ioctl_compact(struct ramzswap *rzs)
+{
+	int freed;
+
+	if (!rzs->init_done)
+		return -ENOTTY;
+
+	freed = ramzswap_compact(rzs, xv_get_total_size_bytes(rzs->mem_pool)
+						>> PAGE_SHIFT);
+	pr_debug("Compaction freed %d pages\n", freed);
+
+	return 0;
+}
+
 static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 			unsigned int cmd, unsigned long arg)
 {
 	int ret = 0;
 	size_t disksize_kb;
+	char compressor[RZS_COMP_NAME_LEN];
 
 	struct ramzswap *rzs = bdev->bd_disk->private_data;
 
@@ -655,8 +1409,65 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		kfree(stats);
 		break;
 	}
+	case RZSIO_SET_COMPRESSOR:
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(compressor, (void *)arg,
+						sizeof(compressor))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		compressor[sizeof(compressor) - 1] = '\0';
+		if (!crypto_has_comp(compressor, 0, 0)) {
+			pr_info("Compressor %s not available\n", compressor);
+			ret = -EINVAL;
+			goto out;
+		}
+		strlcpy(rzs->compressor, compressor, sizeof(rzs->compressor));
+		pr_info("Compressor set to %s\n", rzs->compressor);
+		break;
+
+	case RZSIO_GET_COMP_STATS:
+	{
+		struct ramzswap_ioctl_comp_stats stats;
+
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		memset(&stats, 0, sizeof(stats));
+		ramzswap_ioctl_get_comp_stats(rzs, &stats);
+		if (copy_to_user((void *)arg, &stats, sizeof(stats))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		break;
+	}
 	case RZSIO_INIT:
+		mutex_lock(&rzs->init_lock);
 		ret = ramzswap_ioctl_init_device(rzs);
+		mutex_unlock(&rzs->init_lock);
+		break;
+
+	case RZSIO_SET_BACKING_DEV:
+	{
+		struct ramzswap_ioctl_backing backing;
+
+		if (copy_from_user(&backing, (void *)arg, sizeof(backing))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		mutex_lock(&rzs->init_lock);
+		ret = ramzswap_ioctl_set_backing_dev(rzs, &backing);
+		mutex_unlock(&rzs->init_lock);
+		break;
+	}
+	case RZSIO_COMPACT:
+		mutex_lock(&rzs->init_lock);
+		ret = ramzswap_ioctl_compact(rzs);
+		mutex_unlock(&rzs->init_lock);
 		break;
 
 	case RZSIO_RESET:
@@ -670,7 +1481,9 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		if (bdev)
 			fsync_bdev(bdev);
 
+		mutex_lock(&rzs->init_lock);
 		ret = ramzswap_ioctl_reset_device(rzs);
+		mutex_unlock(&rzs->init_lock);
 		break;
 
 	default:
@@ -687,7 +1500,11 @@ void ramzswap_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct ramzswap *rzs;
 
 	rzs = bdev->bd_disk->private_data;
+
+	write_lock(&rzs->table_lock);
 	ramzswap_free_page(rzs, index);
+	write_unlock(&rzs->table_lock);
+
 	rzs_stat64_inc(rzs, &rzs->stats.notify_free);
 
 	return;
@@ -703,8 +1520,14 @@ static int create_device(struct ramzswap *rzs, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&rzs->lock);
+	mutex_init(&rzs->init_lock);
+	rwlock_init(&rzs->table_lock);
+	spin_lock_init(&rzs->dedup_lock);
+	rzs->dedup_root = RB_ROOT;
+	spin_lock_init(&rzs->wb_lock);
+	INIT_DELAYED_WORK(&rzs->wb_work, ramzswap_wb_work);
 	spin_lock_init(&rzs->stat64_lock);
+	strlcpy(rzs->compressor, default_compressor, sizeof(rzs->compressor));
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!rzs->queue) {
@@ -732,6 +1555,9 @@ static int create_device(struct ramzswap *rzs, int device_id)
 	rzs->disk->fops = &ramzswap_devops;
 	rzs->disk->queue = rzs->queue;
 	rzs->disk->private_data = rzs;
+
+	rzs->shrinker.shrink = ramzswap_shrink;
+	rzs->shrinker.seeks = DEFAULT_SEEKS;
 	snprintf(rzs->disk->disk_name, 16, "ramzswap%d", device_id);
 
 	/* Actual capacity set using RZSIO_SET_DISKSIZE_KB ioctl */
@@ -818,6 +1644,8 @@ static void __exit ramzswap_exit(void)
 		destroy_device(rzs);
 		if (rzs->init_done)
 			reset_device(rzs);
+		else
+			ramzswap_release_backing_dev(rzs);
 	}
 
 	unregister_blkdev(ramzswap_major, "ramzswap");
@@ -15,8 +15,14 @@
 #ifndef _RAMZSWAP_DRV_H_
 #define _RAMZSWAP_DRV_H_
 
+#include <linux/crypto.h>
+#include <linux/ktime.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/mm.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/percpu.h>
 
 #include "ramzswap_ioctl.h"
 #include "xvmalloc.h"
@@ -27,6 +33,19 @@
  */
 static const unsigned max_num_devices = 32;
 
+/*
+ * Every compressed object is tracked by a dedup entry, keyed by
+ * the checksum of its uncompressed page. Table entries holding
+ * identical pages share a single object.
+ */
+struct rzs_dedup_entry {
+	struct rb_node rb;
+	u32 checksum;
+	u32 refcount;		/* no. of table entries using this object */
+	struct page *page;
+	u16 offset;
+};
+
 /*
  * Stored at beginning of each compressed object.
  *
@@ -34,9 +53,8 @@ static const unsigned max_num_devices = 32;
  * object. This is required to support memory defragmentation.
  */
 struct zobj_header {
-#if 0
+	struct rzs_dedup_entry *entry;
 	u32 table_idx;
-#endif
 };
 
 /*-- Configurable parameters */
@@ -44,6 +62,12 @@ struct zobj_header {
 /* Default ramzswap disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/*
+ * Default compression backend. Any algorithm registered with the
+ * crypto compression API can be selected per device.
+ */
+static const char default_compressor[] = "lzo";
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -56,6 +80,9 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
  * otherwise, xv_malloc() would always return failure.
  */
 
+/* Max no. of idle pages written back with a single bio */
+#define RZS_WB_BATCH		32
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -68,8 +95,17 @@ enum rzs_pageflags {
 	/* Page is stored uncompressed */
 	RZS_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	RZS_ZERO,
+	/* Page is filled with a single repeated word (table[].element) */
+	RZS_SAME,
+
+	/* Page is stored on the backing device (table[].wb_index) */
+	RZS_WRITEBACK,
+
+	/* Page was not accessed since the last idle scan */
+	RZS_IDLE,
+
+	/* Page is being written back by the idle writeback work */
+	RZS_WB_PENDING,
 
 	__NR_RZS_PAGEFLAGS,
 };
@@ -81,7 +117,11 @@ enum rzs_pageflags {
  * These table entries must fit exactly in a page.
  */
 struct table {
-	struct page *page;
+	union {
+		struct page *page;
+		unsigned long element;	/* RZS_SAME pages */
+		unsigned long wb_index;	/* RZS_WRITEBACK pages */
+	};
 	u16 offset;
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
@@ -100,22 +140,54 @@ struct ramzswap_stats {
 	u64 invalid_io;		/* non-swap I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of other same filled pages */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 num_wb_reads;	/* reads served by the backing device */
+	u64 num_wb_writes;	/* pages written to the backing device */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u64 num_compr;		/* no. of compression calls */
+	u64 num_decompr;	/* no. of decompression calls */
+	u64 compr_ns;		/* time spent compressing */
+	u64 decompr_ns;		/* time spent decompressing */
 #endif
 };
 
+/*
+ * Per-CPU compression stream. Writers pick the stream of the CPU
+ * they are running on, so swap-out can proceed on all cores at once.
+ * The mutex is only contended if a writer migrates mid-compression.
+ */
+struct ramzswap_stream {
+	struct mutex lock;	/* serialize users of this stream */
+	struct crypto_comp *tfm;	/* compression backend */
+	void *buffer;		/* compressed output (2 pages) */
+};
+
 struct ramzswap {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct ramzswap_stream __percpu *streams;
 	struct table *table;
+	rwlock_t table_lock;	/* protect table entries and page stats */
+	spinlock_t dedup_lock;	/* protect dedup_root and refcounts */
+	struct rb_root dedup_root;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
 	struct request_queue *queue;
 	struct gendisk *disk;
+	struct shrinker shrinker;	/* compacts mem_pool */
+	struct mutex init_lock;	/* serialize init/reset vs. compaction */
 	int init_done;
+	char compressor[RZS_COMP_NAME_LEN];
+
+	/* Optional backing device for incompressible and idle pages */
+	struct block_device *backing_bdev;
+	unsigned long *wb_bitmap;	/* backing device pages in use */
+	unsigned long wb_nr_pages;
+	spinlock_t wb_lock;		/* protect wb_bitmap */
+	unsigned int wb_idle_secs;	/* 0: no idle writeback */
+	struct delayed_work wb_work;
 	/*
 	 * This is limit on amount of *uncompressed* worth of data
 	 * we can hold. When backing swap device is provided, it is
@@ -147,6 +219,18 @@ static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
 	spin_unlock(&rzs->stat64_lock);
 }
 
+static void rzs_stat64_add(struct ramzswap *rzs, u64 *v, u64 inc)
+{
+	spin_lock(&rzs->stat64_lock);
+	*v = *v + inc;
+	spin_unlock(&rzs->stat64_lock);
+}
+
+static u64 rzs_stat_clock(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
 static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 {
 	u64 val;
@@ -161,6 +245,8 @@ static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 #define rzs_stat_inc(v)
 #define rzs_stat_dec(v)
 #define rzs_stat64_inc(r, v)
+#define rzs_stat64_add(r, v, i)
+#define rzs_stat_clock()	0
 #define rzs_stat64_read(r, v)
 #endif /* CONFIG_RAMZSWAP_STATS */
 
@@ -34,9 +34,38 @@ struct ramzswap_ioctl_stats {
 	u64 mem_used_total;
 } __attribute__ ((packed, aligned(4)));
 
+#define RZS_COMP_NAME_LEN	32
+
+struct ramzswap_ioctl_comp_stats {
+	char compressor[RZS_COMP_NAME_LEN];
+	u64 num_compr;		/* no. of compression calls */
+	u64 num_decompr;	/* no. of decompression calls */
+	u64 compr_ns;		/* total time spent compressing */
+	u64 decompr_ns;		/* total time spent decompressing */
+	u32 compr_ns_per_page;
+	u32 decompr_ns_per_page;
+	u32 compr_ratio_pct;	/* compr_data_size * 100 / orig_data_size */
+	u32 pages_same;		/* no. of non-zero same filled pages */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 num_wb_reads;	/* reads served by the backing device */
+	u64 num_wb_writes;	/* pages written to the backing device */
+} __attribute__ ((packed, aligned(4)));
+
+#define RZS_BACKING_PATH_LEN	64
+
+struct ramzswap_ioctl_backing {
+	char path[RZS_BACKING_PATH_LEN];	/* backing block device */
+	u32 idle_secs;		/* write back pages idle this long, 0: off */
+} __attribute__ ((packed, aligned(4)));
+
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_COMPRESSOR	_IOW('z', 4, char[RZS_COMP_NAME_LEN])
+#define RZSIO_GET_COMP_STATS	_IOR('z', 5, struct ramzswap_ioctl_comp_stats)
+#define RZSIO_COMPACT		_IO('z', 6)
+#define RZSIO_SET_BACKING_DEV	_IOW('z', 7, struct ramzswap_ioctl_backing)
 
 #endif
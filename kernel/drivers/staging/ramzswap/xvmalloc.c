@@ -14,6 +14,8 @@
 #include <linux/errno.h>
 #include <linux/highmem.h>
 #include <linux/init.h>
+#include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/string.h>
 #include <linux/slab.h>
 
@@ -79,6 +81,26 @@ static struct block_header *BLOCK_NEXT(struct block_header *block)
 		((char *)block + block->size + XV_ALIGN);
 }
 
+static int page_isolated(struct page *page)
+{
+	return page_private(page) & XV_PAGE_ISOLATED;
+}
+
+static u32 page_used(struct page *page)
+{
+	return page_private(page) & XV_PAGE_USED_MASK;
+}
+
+/*
+ * Account 'size' bytes (block header included) allocated (size > 0)
+ * or freed (size < 0) in the given page.
+ */
+static void page_used_add(struct xv_pool *pool, struct page *page, int size)
+{
+	set_page_private(page, page_private(page) + size);
+	pool->used_bytes += size;
+}
+
 /*
  * Get index of free list containing blocks of maximum size
  * which is less than or equal to given size.
@@ -287,6 +309,9 @@ static int grow_pool(struct xv_pool *pool, gfp_t flags)
 	stat_inc(&pool->total_pages);
 
 	spin_lock(&pool->lock);
+	set_page_private(page, 0);
+	list_add(&page->lru, &pool->pages);
+
 	block = get_ptr_atomic(page, 0, KM_USER0);
 
 	block->size = PAGE_SIZE - XV_ALIGN;
@@ -317,6 +342,7 @@ struct xv_pool *xv_create_pool(void)
 		return NULL;
 
 	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->pages);
 
 	return pool;
 }
@@ -361,7 +387,7 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
 
 	if (!*page) {
 		spin_unlock(&pool->lock);
-		if (flags & GFP_NOWAIT)
+		if (!(flags & __GFP_WAIT))
 			return -ENOMEM;
 		error = grow_pool(pool, flags);
 		if (unlikely(error))
@@ -405,6 +431,7 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
 
 	block->size = origsize;
 	clear_flag(block, BLOCK_FREE);
+	page_used_add(pool, *page, size + XV_ALIGN);
 
 	put_ptr_atomic(block, KM_USER0);
 	spin_unlock(&pool->lock);
@@ -416,9 +443,14 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
 
 /*
  * Free block identified with <page, offset>
+ *
+ * Free blocks of pages isolated by xv_compact() are kept off the
+ * freelists, and such a page is not released here even if it
+ * becomes empty: xv_compact() takes care of it.
  */
 void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 {
+	int isolated;
 	void *page_start;
 	struct block_header *block, *tmpblock;
 
@@ -426,6 +458,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 
 	spin_lock(&pool->lock);
 
+	isolated = page_isolated(page);
 	page_start = get_ptr_atomic(page, 0, KM_USER0);
 	block = (struct block_header *)((char *)page_start + offset);
 
@@ -433,6 +466,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	BUG_ON(test_flag(block, BLOCK_FREE));
 
 	block->size = ALIGN(block->size, XV_ALIGN);
+	page_used_add(pool, page, -(block->size + XV_ALIGN));
 
 	tmpblock = BLOCK_NEXT(block);
 	if (offset + block->size + XV_ALIGN == PAGE_SIZE)
@@ -444,7 +478,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 		 * Blocks smaller than XV_MIN_ALLOC_SIZE
 		 * are not inserted in any free list.
 		 */
-		if (tmpblock->size >= XV_MIN_ALLOC_SIZE) {
+		if (!isolated && tmpblock->size >= XV_MIN_ALLOC_SIZE) {
 			remove_block(pool, page,
 				    offset + block->size + XV_ALIGN, tmpblock,
 				    get_index_for_insert(tmpblock->size));
@@ -458,7 +492,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 						get_blockprev(block));
 		offset = offset - tmpblock->size - XV_ALIGN;
 
-		if (tmpblock->size >= XV_MIN_ALLOC_SIZE)
+		if (!isolated && tmpblock->size >= XV_MIN_ALLOC_SIZE)
 			remove_block(pool, page, offset, tmpblock,
 				    get_index_for_insert(tmpblock->size));
 
@@ -467,7 +501,8 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	}
 
 	/* No used objects in this page. Free it. */
-	if (block->size == PAGE_SIZE - XV_ALIGN) {
+	if (block->size == PAGE_SIZE - XV_ALIGN && !isolated) {
+		list_del(&page->lru);
 		put_ptr_atomic(page_start, KM_USER0);
 		spin_unlock(&pool->lock);
 
@@ -477,7 +512,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	}
 
 	set_flag(block, BLOCK_FREE);
-	if (block->size >= XV_MIN_ALLOC_SIZE)
+	if (!isolated && block->size >= XV_MIN_ALLOC_SIZE)
 		insert_block(pool, page, offset, block);
 
 	if (offset + block->size + XV_ALIGN != PAGE_SIZE) {
@@ -505,3 +540,145 @@ u64 xv_get_total_size_bytes(struct xv_pool *pool)
 {
 	return pool->total_pages << PAGE_SHIFT;
 }
+
+/*
+ * Returns memory actually allocated to objects (including block headers)
+ */
+u64 xv_get_used_size_bytes(struct xv_pool *pool)
+{
+	return pool->used_bytes;
+}
+
+/*
+ * Take all free blocks of the page off the freelists, so that no
+ * allocation is satisfied from it while it is being emptied.
+ */
+static void isolate_page(struct xv_pool *pool, struct page *page)
+{
+	u32 offset;
+	char *page_start;
+	struct block_header *block;
+
+	page_start = get_ptr_atomic(page, 0, KM_USER0);
+	for (offset = 0; offset < PAGE_SIZE;
+			offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN) {
+		block = (struct block_header *)(page_start + offset);
+		if (test_flag(block, BLOCK_FREE) &&
+				block->size >= XV_MIN_ALLOC_SIZE)
+			remove_block(pool, page, offset, block,
+				    get_index_for_insert(block->size));
+	}
+	put_ptr_atomic(page_start, KM_USER0);
+
+	set_page_private(page, page_private(page) | XV_PAGE_ISOLATED);
+}
+
+/*
+ * Return free blocks of a page isolated with isolate_page() to the
+ * freelists, making it available for allocation again.
+ */
+static void putback_page(struct xv_pool *pool, struct page *page)
+{
+	u32 offset;
+	char *page_start;
+	struct block_header *block;
+
+	set_page_private(page, page_private(page) & ~XV_PAGE_ISOLATED);
+
+	page_start = get_ptr_atomic(page, 0, KM_USER0);
+	for (offset = 0; offset < PAGE_SIZE;
+			offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN) {
+		block = (struct block_header *)(page_start + offset);
+		if (test_flag(block, BLOCK_FREE) &&
+				block->size >= XV_MIN_ALLOC_SIZE)
+			insert_block(pool, page, offset, block);
+	}
+	put_ptr_atomic(page_start, KM_USER0);
+}
+
+/*
+ * Find the first allocated block at or after 'start' in the page.
+ * Returns its object offset, or PAGE_SIZE if there is none.
+ */
+static u32 next_used_block(struct page *page, u32 start)
+{
+	u32 offset;
+	char *page_start;
+	struct block_header *block;
+
+	page_start = get_ptr_atomic(page, 0, KM_USER0);
+	for (offset = 0; offset < PAGE_SIZE;
+			offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN) {
+		block = (struct block_header *)(page_start + offset);
+		if (offset >= start && !test_flag(block, BLOCK_FREE))
+			break;
+	}
+	put_ptr_atomic(page_start, KM_USER0);
+
+	return offset < PAGE_SIZE ? offset + XV_ALIGN : PAGE_SIZE;
+}
+
+/**
+ * xv_compact - release sparsely used pages of the pool
+ * @pool: pool to compact
+ * @nr_to_scan: max no. of pool pages to look at
+ * @migrate: callback relocating a single object
+ * @arg: passed to @migrate
+ *
+ * Pages that are at most half full are isolated, and all objects in
+ * them are handed to @migrate. Pages that end up empty are freed.
+ * Stops early if @migrate returns -ENOMEM.
+ *
+ * Returns the no. of pages freed.
+ */
+int xv_compact(struct xv_pool *pool, int nr_to_scan,
+		xv_migrate_t migrate, void *arg)
+{
+	int ret = 0, freed = 0;
+	u32 offset;
+	struct page *page;
+
+	while (nr_to_scan-- > 0 && ret != -ENOMEM) {
+		spin_lock(&pool->lock);
+		if (list_empty(&pool->pages)) {
+			spin_unlock(&pool->lock);
+			break;
+		}
+
+		/* Rotate so that each call looks at different pages */
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_move_tail(&page->lru, &pool->pages);
+
+		if (page_used(page) > PAGE_SIZE / 2) {
+			spin_unlock(&pool->lock);
+			continue;
+		}
+
+		isolate_page(pool, page);
+
+		offset = 0;
+		while ((offset = next_used_block(page, offset)) < PAGE_SIZE) {
+			spin_unlock(&pool->lock);
+			ret = migrate(arg, page, offset);
+			spin_lock(&pool->lock);
+			if (ret)
+				break;
+		}
+
+		if (!page_used(page)) {
+			list_del(&page->lru);
+			set_page_private(page, 0);
+			spin_unlock(&pool->lock);
+
+			__free_page(page);
+			stat_dec(&pool->total_pages);
+			freed++;
+			continue;
+		}
+
+		putback_page(pool, page);
+		spin_unlock(&pool->lock);
+	}
+
+	return freed;
+}
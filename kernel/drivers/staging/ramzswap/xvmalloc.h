@@ -13,6 +13,7 @@
 #ifndef _XV_MALLOC_H_
 #define _XV_MALLOC_H_
 
+#include <linux/mm_types.h>
 #include <linux/types.h>
 
 struct xv_pool;
@@ -26,5 +27,16 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset);
 
 u32 xv_get_object_size(void *obj);
 u64 xv_get_total_size_bytes(struct xv_pool *pool);
+u64 xv_get_used_size_bytes(struct xv_pool *pool);
+
+/*
+ * Called by xv_compact() for each object to move out of a sparse page.
+ * Must relocate the object (using GFP_NOWAIT allocations) and free the
+ * old copy, or return an error to leave the page in place.
+ */
+typedef int (*xv_migrate_t)(void *arg, struct page *page, u32 offset);
+
+int xv_compact(struct xv_pool *pool, int nr_to_scan,
+		xv_migrate_t migrate, void *arg);
 
 #endif
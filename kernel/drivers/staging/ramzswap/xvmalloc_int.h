@@ -47,6 +47,14 @@ enum blockflags {
 #define FLAGS_MASK	XV_ALIGN_MASK
 #define PREV_MASK	(~FLAGS_MASK)
 
+/*
+ * page->private of pool pages holds the no. of bytes allocated in
+ * the page, and this flag while the page is isolated for compaction.
+ * Free blocks of an isolated page are not on any freelist.
+ */
+#define XV_PAGE_ISOLATED	(1UL << 31)
+#define XV_PAGE_USED_MASK	(XV_PAGE_ISOLATED - 1)
+
 struct freelist_entry {
 	struct page *page;
 	u16 offset;
@@ -79,8 +87,12 @@ struct xv_pool {
 
 	struct freelist_entry freelist[NUM_FREE_LISTS];
 
+	/* all pages in this pool, linked through page->lru */
+	struct list_head pages;
+
 	/* stats */
 	u64 total_pages;
+	u64 used_bytes;
 };
 
 #endif
@@ -200,6 +200,9 @@ static int yaffs_InitialiseTempBuffers(yaffs_Device *dev)
 __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 {
 	int i, j;
+	__u8 *buf;
+
+	YLOCK(&dev->stateLock);
 
 	dev->tempInUse++;
 	if (dev->tempInUse > dev->maxTemp)
@@ -215,10 +218,16 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 					    dev->tempBuffer[j].line;
 			}
 
-			return dev->tempBuffer[i].buffer;
+			buf = dev->tempBuffer[i].buffer;
+			YUNLOCK(&dev->stateLock);
+			return buf;
 		}
 	}
 
+	dev->unmanagedTempAllocations++;
+
+	YUNLOCK(&dev->stateLock);
+
 	T(YAFFS_TRACE_BUFFERS,
 	  (TSTR("Out of temp buffers at line %d, other held by lines:"),
 	   lineNo));
@@ -232,7 +241,6 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 	 * This is not good.
 	 */
 
-	dev->unmanagedTempAllocations++;
 	return YMALLOC(dev->nDataBytesPerChunk);
 
 }
@@ -242,22 +250,29 @@ void yaffs_ReleaseTempBuffer(yaffs_Device *dev, __u8 *buffer,
 {
 	int i;
 
+	YLOCK(&dev->stateLock);
+
 	dev->tempInUse--;
 
 	for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++) {
 		if (dev->tempBuffer[i].buffer == buffer) {
 			dev->tempBuffer[i].line = 0;
+			YUNLOCK(&dev->stateLock);
 			return;
 		}
 	}
 
+	if (buffer)
+		dev->unmanagedTempDeallocations++;
+
+	YUNLOCK(&dev->stateLock);
+
 	if (buffer) {
 		/* assume it is an unmanaged one. */
 		T(YAFFS_TRACE_BUFFERS,
 		  (TSTR("Releasing unmanaged temp buffer in line %d" TENDSTR),
 		   lineNo));
 		YFREE(buffer);
-		dev->unmanagedTempDeallocations++;
 	}
 
 }
@@ -555,6 +570,7 @@ static void yaffs_HandleUpdateChunk(yaffs_Device *dev, int chunkInNAND,
 
 void yaffs_HandleChunkError(yaffs_Device *dev, yaffs_BlockInfo *bi)
 {
+	YLOCK(&dev->stateLock);
 	if (!bi->gcPrioritise) {
 		bi->gcPrioritise = 1;
 		dev->hasPendingPrioritisedGCs = 1;
@@ -566,6 +582,7 @@ void yaffs_HandleChunkError(yaffs_Device *dev, yaffs_BlockInfo *bi)
 
 		}
 	}
+	YUNLOCK(&dev->stateLock);
 }
 
 static void yaffs_HandleWriteChunkError(yaffs_Device *dev, int chunkInNAND,
@@ -3374,6 +3391,7 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 {
 
 	if (dev->param.nShortOpCaches > 0) {
+		YLOCK(&dev->stateLock);
 		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
 			/* Reset the cache usages */
 			int i;
@@ -3389,6 +3407,7 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 
 		if (isAWrite)
 			cache->dirty = 1;
+		YUNLOCK(&dev->stateLock);
 	}
 }
 
@@ -3511,7 +3530,10 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 
 		} else {
 
-			/* A full chunk. Read directly into the supplied buffer. */
+			/* A full chunk. Read directly into the supplied buffer.
+			 * This path neither fills nor flushes the cache, so it
+			 * is safe for concurrent readers.
+			 */
 			yaffs_ReadChunkDataFromObject(in, chunk, buffer);
 
 		}
@@ -5288,6 +5310,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->oldestDirtySequence = 0;
 	dev->oldestDirtyBlock = 0;
 
+	YLOCK_INIT(&dev->stateLock);
+
 	/* Initialise temporary buffers and caches. */
 	if (!yaffs_InitialiseTempBuffers(dev))
 		init_failed = 1;
@@ -729,6 +729,12 @@ struct yaffs_DeviceStruct {
 	int nUnlinkedFiles;		/* Count of unlinked files. */
 	int nBackgroundDeletions;	/* Count of background deletions. */
 
+	/* State that readers running concurrently under a shared OS lock
+	 * may change: the temporary buffers, the short op cache usage and
+	 * the block error flags.
+	 */
+	YLOCK_T stateLock;
+
 	/* Temporary buffer management */
 	yaffs_TempBuffer tempBuffer[YAFFS_N_TEMP_BUFFERS];
 	int maxTemp;
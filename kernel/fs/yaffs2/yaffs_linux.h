@@ -25,7 +25,8 @@ struct yaffs_LinuxContext {
 	struct super_block * superBlock;
 	struct task_struct *bgThread; /* Background thread for this device */
 	int bgRunning;
-        struct semaphore grossLock;     /* Gross locking semaphore */
+	/* Gross lock: held shared by pure reads, exclusive otherwise */
+	struct rw_semaphore grossLock;
 	__u8 *spareBuffer;      /* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 				 */
@@ -34,6 +35,8 @@ struct yaffs_LinuxContext {
 
 	struct task_struct *readdirProcess;
 	unsigned mount_id;
+	unsigned long lastDirtied; /* jiffies of the last change, for bg checkpoints */
+	int bgCheckpointFailed; /* no bg checkpoint retry until dirtied again */
 };
 
 #define yaffs_DeviceToLC(dev) ((struct yaffs_LinuxContext *)((dev)->osContext))
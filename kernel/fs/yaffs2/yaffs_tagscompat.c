@@ -334,7 +334,9 @@ static void yaffs_HandleReadDataError(yaffs_Device *dev, int chunkInNAND)
 	int blockInNAND = chunkInNAND / dev->param.nChunksPerBlock;
 
 	/* Mark the block for retirement */
+	YLOCK(&dev->stateLock);
 	yaffs_GetBlockInfo(dev, blockInNAND + dev->blockOffset)->needsRetiring = 1;
+	YUNLOCK(&dev->stateLock);
 	T(YAFFS_TRACE_ERROR | YAFFS_TRACE_BAD_BLOCKS,
 	  (TSTR("**>>Block %d marked for retirement" TENDSTR), blockInNAND));
 
@@ -163,6 +163,7 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 #include "yportenv.h"
 #include "yaffs_trace.h"
 #include "yaffs_guts.h"
+#include "yaffs_yaffs2.h"
 
 #include "yaffs_linux.h"
 
@@ -175,6 +176,7 @@ unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+unsigned int yaffs_bg_checkpoint = 30;
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
@@ -183,6 +185,7 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_bg_checkpoint, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
@@ -515,14 +518,44 @@ static unsigned yaffs_gc_control_callback(yaffs_Device *dev)
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locking %p\n"), current));
-	down(&(yaffs_DeviceToLC(dev)->grossLock));
+	down_write(&(yaffs_DeviceToLC(dev)->grossLock));
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locked %p\n"), current));
 }
 
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs unlocking %p\n"), current));
-	up(&(yaffs_DeviceToLC(dev)->grossLock));
+	up_write(&(yaffs_DeviceToLC(dev)->grossLock));
+}
+
+/*
+ * Shared locking for paths that only read the flash and the object tree.
+ * Anything that may allocate chunks, run gc, change the tree or lazy load
+ * an object must take the gross lock exclusive. The little state readers
+ * do change is covered by dev->stateLock in the guts.
+ */
+static void yaffs_GrossLockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locking shared %p\n"), current));
+	down_read(&(yaffs_DeviceToLC(dev)->grossLock));
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locked shared %p\n"), current));
+}
+
+static void yaffs_GrossUnlockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs unlocking shared %p\n"), current));
+	up_read(&(yaffs_DeviceToLC(dev)->grossLock));
+}
+
+/*
+ * A page read can be done under the shared lock if it covers whole
+ * chunks: yaffs_ReadDataFromFile() then never loads a chunk into the short
+ * op cache, which could flush a dirty one to flash.
+ */
+static int yaffs_ReadpageShared(yaffs_Device *dev)
+{
+	return !dev->param.inbandTags &&
+		(PAGE_CACHE_SIZE % dev->nDataBytesPerChunk) == 0;
 }
 
 #ifdef YAFFS_COMPILE_EXPORTFS
@@ -992,6 +1025,7 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	yaffs_Object *obj;
 	unsigned char *pg_buf;
 	int ret;
+	int shared;
 
 	yaffs_Device *dev;
 
@@ -1014,13 +1048,20 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
+	shared = yaffs_ReadpageShared(dev);
+	if (shared)
+		yaffs_GrossLockShared(dev);
+	else
+		yaffs_GrossLock(dev);
 
 	ret = yaffs_ReadDataFromFile(obj, pg_buf,
 				pg->index << PAGE_CACHE_SHIFT,
 				PAGE_CACHE_SIZE);
 
-	yaffs_GrossUnlock(dev);
+	if (shared)
+		yaffs_GrossUnlockShared(dev);
+	else
+		yaffs_GrossUnlock(dev);
 
 	if (ret >= 0)
 		ret = 0;
@@ -2155,7 +2196,7 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf)
 
 	T(YAFFS_TRACE_OS, (TSTR("yaffs_statfs\n")));
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	buf->f_type = YAFFS_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
@@ -2204,7 +2245,7 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf)
 	buf->f_ffree = 0;
 	buf->f_bavail = buf->f_bfree;
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 	return 0;
 }
 
@@ -2312,6 +2353,46 @@ void yaffs_background_waker(unsigned long data)
 	wake_up_process((struct task_struct *)data);
 }
 
+/*
+ * A checkpoint is only valid until the next change, so after a crash the
+ * mount usually has to scan the whole device. Once the fs has been quiet
+ * for yaffs_bg_checkpoint seconds, and gc is not pressing, write one from
+ * the background so that a crash outside a burst of writes still mounts
+ * from a checkpoint. A save that fails, e.g. for lack of space, is not
+ * retried until the fs changes again. Called with the gross lock held.
+ *
+ * This runs without s_umount, so it must not walk sb->s_inodes the way
+ * yaffs_FlushSuperBlock() does. It flushes yaffs' own dirty directories and
+ * chunk cache instead; the checkpoint records the objects' in-memory state,
+ * so the attributes the inode flush would write out are captured anyway.
+ */
+static void yaffs_BackgroundCheckpoint(yaffs_Device *dev, unsigned long now)
+{
+	struct yaffs_LinuxContext *context = yaffs_DeviceToLC(dev);
+	struct super_block *sb = context->superBlock;
+
+	if (!yaffs_bg_checkpoint || dev->isCheckpointed || !sb ||
+	    context->bgCheckpointFailed || !dev->param.isYaffs2 ||
+	    !yaffs2_CheckpointRequired(dev))
+		return;
+
+	if (!time_after(now, context->lastDirtied + yaffs_bg_checkpoint * HZ) ||
+	    yaffs_bg_gc_urgency(dev))
+		return;
+
+	T(YAFFS_TRACE_BACKGROUND | YAFFS_TRACE_CHECKPOINT,
+		(TSTR("yaffs_background checkpoint\n")));
+
+	yaffs_UpdateDirtyDirectories(dev);
+	yaffs_FlushEntireDeviceCache(dev);
+	yaffs_CheckpointSave(dev);
+	sb->s_dirt = 0;
+
+	/* The save dirties the superblock itself, so note this afterwards */
+	if (!dev->isCheckpointed)
+		context->bgCheckpointFailed = 1;
+}
+
 static int yaffs_BackgroundThread(void *data)
 {
 	yaffs_Device *dev = (yaffs_Device *)data;
@@ -2352,6 +2433,9 @@ static int yaffs_BackgroundThread(void *data)
 			next_dir_update = now + HZ;
 		}
 
+		if(yaffs_bg_enable)
+			yaffs_BackgroundCheckpoint(dev, now);
+
 		if(time_after(now,next_gc) && yaffs_bg_enable){
 			if(!dev->isCheckpointed){
 				urgency = yaffs_bg_gc_urgency(dev);
@@ -2599,6 +2683,8 @@ static void yaffs_MarkSuperBlockDirty(yaffs_Device *dev)
 	T(YAFFS_TRACE_OS, (TSTR("yaffs_MarkSuperBlockDirty() sb = %p\n"), sb));
 	if (sb)
 		sb->s_dirt = 1;
+	yaffs_DeviceToLC(dev)->lastDirtied = jiffies;
+	yaffs_DeviceToLC(dev)->bgCheckpointFailed = 0;
 }
 
 typedef struct {
@@ -3028,6 +3114,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		}
 	}
 	context->mount_id = mount_id;
+	context->lastDirtied = jiffies;
 
 	ylist_add_tail(&(yaffs_DeviceToLC(dev)->contextList), &yaffs_context_list);
 	up(&yaffs_context_lock);
@@ -3036,7 +3123,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         YINIT_LIST_HEAD(&(yaffs_DeviceToLC(dev)->searchContexts));
         param->removeObjectCallback = yaffs_RemoveObjectCallback;
 
-	init_MUTEX(&(yaffs_DeviceToLC(dev)->grossLock));
+	init_rwsem(&(yaffs_DeviceToLC(dev)->grossLock));
 
 	yaffs_GrossLock(dev);
 
@@ -49,6 +49,7 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/xattr.h>
+#include <linux/spinlock.h>
 
 #define YCHAR char
 #define YUCHAR unsigned char
@@ -76,6 +77,12 @@
 #define YYIELD() schedule()
 #define Y_DUMP_STACK() dump_stack()
 
+/* Short lock for the state that concurrent readers may touch. */
+#define YLOCK_T spinlock_t
+#define YLOCK_INIT(l) spin_lock_init(l)
+#define YLOCK(l) spin_lock(l)
+#define YUNLOCK(l) spin_unlock(l)
+
 #define YAFFS_ROOT_MODE			0755
 #define YAFFS_LOSTNFOUND_MODE		0700
 
@@ -154,6 +161,14 @@
 
 #endif
 
+#ifndef YLOCK_T
+/* Single threaded environments need no locking. */
+#define YLOCK_T int
+#define YLOCK_INIT(l) do { } while (0)
+#define YLOCK(l) do { } while (0)
+#define YUNLOCK(l) do { } while (0)
+#endif
+
 #if defined(CONFIG_YAFFS_DIRECT) || defined(CONFIG_YAFFS_WINCE)
 
 #ifdef CONFIG_YAFFSFS_PROVIDE_VALUES
@@ -34,6 +34,7 @@ struct mmc_csd {
 	unsigned int		read_blkbits;
 	unsigned int		write_blkbits;
 	unsigned int		capacity;
+	unsigned int		erase_size;		/* In sectors */
 	unsigned int		read_partial:1,
 				read_misalign:1,
 				write_partial:1,
@@ -46,6 +47,12 @@ struct mmc_ext_csd {
 	unsigned int		hs_max_dtr;
 	unsigned int		sectors;
 	unsigned int		card_type;
+	unsigned int		hc_erase_size;		/* In sectors */
+	unsigned int		access_size;		/* In sectors */
+	u8			rel_param;
+	unsigned int		rel_sectors;		/* Reliable write unit */
+	unsigned int		cache_size;		/* Units: KB */
+	bool			cache_ctrl;		/* Cache is enabled */
 };
 
 struct sd_scr {
@@ -113,6 +120,12 @@ struct mmc_card {
 	struct mmc_ext_csd	ext_csd;	/* mmc v4 extended card specific */
 	struct sd_scr		scr;		/* extra SD information */
 	struct sd_switch_caps	sw_caps;	/* switch (CMD6) caps */
+	unsigned int		erase_size;	/* erase block, in sectors */
+	unsigned int		write_size;	/* optimal write unit, in sectors */
+
+	unsigned long		cache_flushes;	/* mmc_flush_cache() calls */
+	unsigned long		cache_flush_ms;	/* time spent flushing */
+	unsigned long		rel_writes;	/* reliable writes issued */
 
 	unsigned int		sdio_funcs;	/* number of SDIO functions */
 	struct sdio_cccr	cccr;		/* common card info */
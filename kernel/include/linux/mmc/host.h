@@ -94,6 +94,18 @@ struct mmc_host_ops {
 	 */
 	int (*enable)(struct mmc_host *host);
 	int (*disable)(struct mmc_host *host, int lazy);
+	/*
+	 * 'pre_req' and 'post_req' are optional. 'pre_req' is called for
+	 * the next request while the current one is still transferring,
+	 * so that the host can map and prepare its DMA in parallel.
+	 * 'is_first_req' is set when no request is in flight. 'post_req'
+	 * undoes the preparation once the request is done, 'err' is set
+	 * when the request was prepared but never issued.
+	 */
+	void	(*post_req)(struct mmc_host *host, struct mmc_request *req,
+			    int err);
+	void	(*pre_req)(struct mmc_host *host, struct mmc_request *req,
+			   bool is_first_req);
 	void	(*request)(struct mmc_host *host, struct mmc_request *req);
 	void    (*dump_regs)(struct mmc_host *host);
 	void    (*abort_request)(struct mmc_host *host);
@@ -130,6 +142,18 @@ struct mmc_host_ops {
 struct mmc_card;
 struct device;
 
+struct mmc_async_req {
+	/* active mmc request */
+	struct mmc_request	*mrq;
+	/* signalled by the host when the request is done */
+	struct completion	complete;
+	/*
+	 * Check error status of completed mmc request.
+	 * Returns 0 if success otherwise non zero.
+	 */
+	int (*err_check) (struct mmc_card *, struct mmc_async_req *);
+};
+
 struct mmc_host {
 	struct device		*parent;
 	struct device		class_dev;
@@ -211,6 +235,7 @@ struct mmc_host {
 	struct delayed_work	disable;	/* disabling work */
 
 	struct mmc_card		*card;		/* device attached to this host */
+	struct mmc_async_req	*areq;		/* active async req */
 
 	wait_queue_head_t	wq;
 	struct task_struct	*claimer;	/* task that has host claimed */
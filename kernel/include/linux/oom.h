@@ -14,6 +14,7 @@
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -43,5 +44,30 @@ static inline void oom_killer_enable(void)
 {
 	oom_killer_disabled = false;
 }
+
+/*
+ * The Android lowmemorykiller keeps thread group leaders in a tree
+ * sorted by oom_adj. All updates are done with tasklist_lock held
+ * for writing.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_adj_tree_add(struct task_struct *task);
+extern void lowmem_adj_tree_del(struct task_struct *task);
+extern void lowmem_adj_tree_replace(struct task_struct *old,
+				    struct task_struct *new);
+#else
+static inline void lowmem_adj_tree_add(struct task_struct *task)
+{
+}
+
+static inline void lowmem_adj_tree_del(struct task_struct *task)
+{
+}
+
+static inline void lowmem_adj_tree_replace(struct task_struct *old,
+					   struct task_struct *new)
+{
+}
+#endif
 #endif /* __KERNEL__*/
 #endif /* _INCLUDE_LINUX_OOM_H */
@@ -249,6 +249,19 @@ extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						int nid);
 extern int __isolate_lru_page(struct page *page, int mode, int file);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
+
+/*
+ * Cumulative global LRU reclaim counters, split by who did the work.
+ * Consumers sample them and look at the deltas.
+ */
+struct reclaim_pressure {
+	unsigned long kswapd_scanned;
+	unsigned long kswapd_reclaimed;
+	unsigned long direct_scanned;
+	unsigned long direct_reclaimed;
+	unsigned long stall_us;		/* time spent in direct reclaim */
+};
+extern void get_reclaim_pressure(struct reclaim_pressure *rp);
 extern int vm_swappiness;
 extern int remove_mapping(struct address_space *mapping, struct page *page);
 extern long vm_total_pages;
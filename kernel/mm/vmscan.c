@@ -40,6 +40,7 @@
 #include <linux/memcontrol.h>
 #include <linux/delayacct.h>
 #include <linux/sysctl.h>
+#include <linux/ktime.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -130,6 +131,12 @@ long vm_total_pages;	/* The total number of pages which the VM controls */
 static LIST_HEAD(shrinker_list);
 static DECLARE_RWSEM(shrinker_rwsem);
 
+static atomic_long_t reclaim_kswapd_scanned;
+static atomic_long_t reclaim_kswapd_reclaimed;
+static atomic_long_t reclaim_direct_scanned;
+static atomic_long_t reclaim_direct_reclaimed;
+static atomic_long_t reclaim_stall_us;
+
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 #define scanning_global_lru(sc)	(!(sc)->mem_cgroup)
 #else
@@ -1111,6 +1118,33 @@ static int too_many_isolated(struct zone *zone, int file,
 	return isolated > inactive;
 }
 
+/*
+ * Account inactive list scanning for get_reclaim_pressure().
+ */
+static void note_reclaim_pressure(unsigned long nr_scanned,
+				  unsigned long nr_reclaimed)
+{
+	if (!nr_scanned)
+		return;
+	if (current_is_kswapd()) {
+		atomic_long_add(nr_scanned, &reclaim_kswapd_scanned);
+		atomic_long_add(nr_reclaimed, &reclaim_kswapd_reclaimed);
+	} else {
+		atomic_long_add(nr_scanned, &reclaim_direct_scanned);
+		atomic_long_add(nr_reclaimed, &reclaim_direct_reclaimed);
+	}
+}
+
+void get_reclaim_pressure(struct reclaim_pressure *rp)
+{
+	rp->kswapd_scanned = atomic_long_read(&reclaim_kswapd_scanned);
+	rp->kswapd_reclaimed = atomic_long_read(&reclaim_kswapd_reclaimed);
+	rp->direct_scanned = atomic_long_read(&reclaim_direct_scanned);
+	rp->direct_reclaimed = atomic_long_read(&reclaim_direct_reclaimed);
+	rp->stall_us = atomic_long_read(&reclaim_stall_us);
+}
+EXPORT_SYMBOL_GPL(get_reclaim_pressure);
+
 /*
  * shrink_inactive_list() is a helper for shrink_zone().  It returns the number
  * of reclaimed pages
@@ -1265,6 +1299,8 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 done:
 	spin_unlock_irq(&zone->lru_lock);
 	pagevec_release(&pvec);
+	if (scanning_global_lru(sc))
+		note_reclaim_pressure(nr_scanned, nr_reclaimed);
 	return nr_reclaimed;
 }
 
@@ -1927,8 +1963,13 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 		.mem_cgroup = NULL,
 		.nodemask = nodemask,
 	};
+	ktime_t start = ktime_get();
+	unsigned long nr_reclaimed;
 
-	return do_try_to_free_pages(zonelist, &sc);
+	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
+	atomic_long_add(ktime_us_delta(ktime_get(), start), &reclaim_stall_us);
+
+	return nr_reclaimed;
 }
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR